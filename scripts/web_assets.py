@@ -0,0 +1,241 @@
+# Compile the web UI of data/ into the firmware.
+#
+# PlatformIO runs this before building (extra_scripts = pre:...). The
+# .html, .css, .js and .svg files of data/ are minified (indentation,
+# blank lines and comments removed; <pre>, <textarea> and script
+# strings are left alone), gzipped and written as PROGMEM arrays to
+# $BUILD_DIR/web_assets/WebAssetsData.h, which src/services/
+# WebAssets.cpp includes. For every file the header holds:
+#  - the gzip body;
+#  - its header lines (Content-Type, Content-Encoding, Content-Length,
+#    ETag), so nothing is formatted per request. The ETag is the CRC-32
+#    and length of the content, as in the gzip trailer;
+#  - a slot in a minimal perfect hash table: the path is hashed once to
+#    pick a seed, then again with that seed to find its slot, so a
+#    lookup costs two hashes and one string comparison.
+# References to local .css and .js files in the pages get a
+# "?v=<crc>" suffix so the browser may cache them for good: a new
+# content means a new URL. The gzip header has no time stamp, so an
+# unchanged file gives the same bytes and the same ETag from one build
+# to the next. The header is only rewritten when it changes.
+#
+# When the filesystem image is requested (buildfs, uploadfs,
+# uploadfsota) it is made from the other files of data/ only (the JSON
+# configuration): the UI lives in flash and keeps working with an
+# empty or damaged filesystem.
+#
+# Standalone use, to check the output: python scripts/web_assets.py
+# data out
+
+import gzip
+import io
+import os
+import re
+import shutil
+import sys
+import zlib
+
+EMBEDDED = (".html", ".htm", ".css", ".js", ".svg")
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".htm": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".svg": "image/svg+xml",
+}
+
+VERBATIM = re.compile(r"(<(pre|textarea|script|style)\b.*?</\2\s*>)",
+                      re.IGNORECASE | re.DOTALL)
+HTML_COMMENT = re.compile(r"<!--(?!\[).*?-->", re.DOTALL)
+CSS_COMMENT = re.compile(r"/\*.*?\*/", re.DOTALL)
+ASSET_REF = re.compile(r"""((?:href|src)=["'])([\w./-]+\.(?:css|js))(["'])""")
+
+
+def strip_lines(text):
+    lines = (line.strip() for line in text.splitlines())
+    return "\n".join(line for line in lines if line)
+
+
+def minify_html(text):
+    out = []
+    pos = 0
+    for match in VERBATIM.finditer(text):
+        out.append(strip_lines(HTML_COMMENT.sub("", text[pos:match.start()])))
+        block = match.group(1)
+        tag = match.group(2).lower()
+        if tag == "style":
+            block = strip_lines(CSS_COMMENT.sub("", block))
+        elif tag == "script":
+            # Only the indentation: comments may hide in strings.
+            block = strip_lines(block)
+        out.append(block)
+        pos = match.end()
+    out.append(strip_lines(HTML_COMMENT.sub("", text[pos:])))
+    return "\n".join(part for part in out if part)
+
+
+def minify(name, text):
+    if name.endswith((".html", ".htm", ".svg")):
+        return minify_html(text)
+    if name.endswith(".css"):
+        return strip_lines(CSS_COMMENT.sub("", text))
+    return strip_lines(text)
+
+
+def fingerprint(text, versions):
+    def replace(match):
+        version = versions.get(os.path.basename(match.group(2)))
+        if not version:
+            return match.group(0)
+        return "%s%s?v=%s%s" % (match.group(1), match.group(2), version,
+                                match.group(3))
+    return ASSET_REF.sub(replace, text)
+
+
+def compress(data):
+    raw = io.BytesIO()
+    # mtime=0 and no file name: reproducible output.
+    with gzip.GzipFile(filename="", mode="wb", fileobj=raw,
+                       compresslevel=9, mtime=0) as out:
+        out.write(data)
+    return raw.getvalue()
+
+
+def fnv(text, seed):
+    # Must match WebAssets.cpp.
+    h = 2166136261 ^ seed
+    for c in text.encode("utf-8"):
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def perfect_hash(paths):
+    # Hash and displace: the largest buckets are placed first.
+    n = len(paths)
+    buckets = [[] for _ in range(n)]
+    for path in paths:
+        buckets[fnv(path, 0) % n].append(path)
+    seeds = [0] * n
+    slots = [None] * n
+    for b in sorted(range(n), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            continue
+        seed = 1
+        while True:
+            wanted = [fnv(path, seed) % n for path in buckets[b]]
+            if (len(set(wanted)) == len(wanted) and
+                    all(slots[s] is None for s in wanted)):
+                break
+            seed += 1
+        seeds[b] = seed
+        for path, s in zip(buckets[b], wanted):
+            slots[s] = path
+    return seeds, slots
+
+
+def load_assets(source):
+    texts = {}
+    versions = {}
+    for name in sorted(os.listdir(source)):
+        path = os.path.join(source, name)
+        if not os.path.isfile(path) or not name.endswith(EMBEDDED):
+            continue
+        with open(path, encoding="utf-8") as f:
+            texts[name] = minify(name, f.read())
+        if name.endswith((".css", ".js")):
+            data = texts[name].encode("utf-8")
+            versions[name] = "%08x" % (zlib.crc32(data) & 0xFFFFFFFF)
+    assets = {}
+    for name, text in texts.items():
+        if name.endswith((".html", ".htm")):
+            text = fingerprint(text, versions)
+        data = text.encode("utf-8")
+        body = compress(data)
+        etag = '"%08x-%x"' % (zlib.crc32(data) & 0xFFFFFFFF, len(data))
+        head = ("Content-Type: %s\r\nContent-Encoding: gzip\r\n"
+                "Content-Length: %d\r\nETag: %s\r\n" %
+                (CONTENT_TYPES[os.path.splitext(name)[1]], len(body), etag))
+        assets["/" + name] = (head, etag, body)
+    return assets
+
+
+def c_string(text):
+    return '"%s"' % text.replace("\\", "\\\\").replace('"', '\\"') \
+        .replace("\r", "\\r").replace("\n", "\\n")
+
+
+def render(assets):
+    paths = sorted(assets)
+    seeds, slots = perfect_hash(paths) if paths else ([], [])
+    out = ["// Generated by scripts/web_assets.py from data/. Do not edit.",
+           "",
+           "#define WEB_ASSET_COUNT %d" % len(slots), ""]
+    for i, path in enumerate(slots):
+        head, etag, body = assets[path]
+        out.append("// %s" % path)
+        out.append("static const char kPath%d[] PROGMEM = %s;" %
+                   (i, c_string(path)))
+        out.append("static const char kHead%d[] PROGMEM = %s;" %
+                   (i, c_string(head)))
+        out.append("static const char kEtag%d[] PROGMEM = %s;" %
+                   (i, c_string(etag)))
+        out.append("static const uint8_t kBody%d[] PROGMEM = {" % i)
+        for pos in range(0, len(body), 16):
+            out.append("  " + ", ".join("0x%02x" % b
+                                        for b in body[pos:pos + 16]) + ",")
+        out.append("};")
+        out.append("")
+    out.append("static const uint16_t kSeeds[] PROGMEM = {%s};" %
+               ", ".join(str(s) for s in seeds))
+    out.append("static const WebAssets::Entry kEntries[] PROGMEM = {")
+    for i, path in enumerate(slots):
+        out.append("  {kPath%d, kHead%d, kEtag%d, kBody%d, %d}," %
+                   (i, i, i, i, len(assets[path][2])))
+    out.append("};")
+    return "\n".join(out) + "\n"
+
+
+def write_if_changed(path, text):
+    if os.path.isfile(path):
+        with open(path, encoding="utf-8") as f:
+            if f.read() == text:
+                return
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, "w", encoding="utf-8") as f:
+        f.write(text)
+
+
+def build_header(source, target):
+    assets = load_assets(source)
+    write_if_changed(os.path.join(target, "WebAssetsData.h"), render(assets))
+    before = sum(os.path.getsize(os.path.join(source, p[1:])) for p in assets)
+    after = sum(len(a[2]) for a in assets.values())
+    print("web_assets: %d files, %d -> %d bytes in flash" %
+          (len(assets), before, after))
+
+
+def build_data(source, target):
+    # Filesystem image: everything but the embedded UI.
+    if os.path.isdir(target):
+        shutil.rmtree(target)
+    os.makedirs(target)
+    for name in sorted(os.listdir(source)):
+        path = os.path.join(source, name)
+        if os.path.isfile(path) and not name.endswith(EMBEDDED):
+            shutil.copy2(path, os.path.join(target, name))
+
+
+if __name__ == "__main__":
+    build_header(sys.argv[1], sys.argv[2])
+    build_data(sys.argv[1], os.path.join(sys.argv[2], "data"))
+else:
+    Import("env")  # noqa: F821 (provided by SCons)
+    from SCons.Script import COMMAND_LINE_TARGETS
+    source = env.subst("$PROJECT_DATA_DIR")  # noqa: F821
+    target = os.path.join(env.subst("$BUILD_DIR"), "web_assets")  # noqa
+    build_header(source, target)
+    env.Append(CPPPATH=[target])  # noqa: F821
+    if {"buildfs", "uploadfs", "uploadfsota"} & set(COMMAND_LINE_TARGETS):
+        build_data(source, os.path.join(target, "data"))
+        env.Replace(PROJECT_DATA_DIR=os.path.join(target, "data"))  # noqa
@@ -2,7 +2,7 @@
 
 #include "ConfigStore.h"
 
-ConfigStore::ConfigStore() : m_count(0) {}
+ConfigStore::ConfigStore() : m_count(0), m_generation(0) {}
 
 void ConfigStore::begin() {
   // Define a static list of configuration areas. If more areas are
@@ -20,6 +20,7 @@ void ConfigStore::begin() {
   };
 
   m_count = 0;
+  m_generation++;
   // Iterate through the list and try to load each file.
   for (size_t i = 0; i < kMaxAreas; i++) {
     if (i >= sizeof(defaultAreas) / sizeof(defaultAreas[0]))
@@ -28,6 +29,7 @@ void ConfigStore::begin() {
     e.area = String(defaultAreas[i]);
     e.doc.clear();
     e.loaded = false;
+    e.revision = 1;
     String filename = "/" + e.area + String(".json");
     if (LittleFS.exists(filename)) {
       File f = LittleFS.open(filename, "r");
@@ -57,6 +59,7 @@ JsonDocument &ConfigStore::getConfig(const String &area) {
     e.area = area;
     e.doc.clear();
     e.loaded = false;
+    e.revision = 1;
     return e.doc;
   }
   // As a last resort, return the first entry. This should not
@@ -115,6 +118,27 @@ bool ConfigStore::updateConfig(const String &area, const JsonDocument &doc) {
   // Copy doc into stored doc
   m_entries[index].doc.set(doc);
   m_entries[index].loaded = true;
+  m_entries[index].revision++;
+  m_generation++;
   Serial.println(String(F("[CFG] Config saved: ")) + filename);
   return true;
 }
+
+uint32_t ConfigStore::revision(const String &area) const {
+  for (size_t i = 0; i < m_count; i++) {
+    if (m_entries[i].area == area) {
+      return m_entries[i].revision;
+    }
+  }
+  return 0;
+}
+
+void ConfigStore::touch(const String &area) {
+  for (size_t i = 0; i < m_count; i++) {
+    if (m_entries[i].area == area) {
+      m_entries[i].revision++;
+      m_generation++;
+      return;
+    }
+  }
+}
@@ -34,11 +34,26 @@ public:
   // success.
   bool updateConfig(const String &area, const JsonDocument &doc);
 
+  // Revision counter of an area, incremented whenever its document is
+  // replaced. Modules that derive state from a configuration area
+  // compare it to rebuild only when needed. Returns 0 for unknown areas.
+  uint32_t revision(const String &area) const;
+
+  // Record that the in-memory document of an area was modified by the
+  // caller (e.g. before a deferred write through FileWriteService).
+  void touch(const String &area);
+
+  // Incremented whenever any revision changes. Polling modules compare
+  // it first and only look up the revision of their area (a string
+  // search) when it moved.
+  uint32_t generation() const { return m_generation; }
+
 private:
   struct Entry {
     String area;
     StaticJsonDocument<2048> doc;
     bool loaded;
+    uint32_t revision;
   };
   // Fixed list of areas. Additional areas can be added here but
   // increasing this count also increases memory usage because each
@@ -46,6 +61,7 @@ private:
   static const size_t kMaxAreas = 8;
   Entry m_entries[kMaxAreas];
   size_t m_count;
+  uint32_t m_generation;
 };
 
 #endif // MINILABOESP_CONFIGSTORE_H
\ No newline at end of file
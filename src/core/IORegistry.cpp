@@ -232,51 +232,75 @@ void IORegistry::begin(ConfigStore *config) {
 }
 
 float IORegistry::readRaw(const String &id) {
-  // Search for channel by id
+  return readRawAt(find(id));
+}
+
+int IORegistry::find(const String &id) const {
   for (size_t i = 0; i < m_channelCount; i++) {
     if (m_channels[i].id == id) {
-      const Channel &ch = m_channels[i];
-      if (ch.isUdpIn) {
-        if (ch.remoteHasRaw) {
-          return ch.lastRemoteRaw;
-        }
-        if (ch.remoteHasValue) {
-          return ch.lastRemoteValue;
-        }
-        return 0.0f;
-      }
-      if (ch.type == "a0") {
-        // Read the built-in ADC. The ESP8266 ADC returns 0-1023.
-        int raw = analogRead(A0);
-        return static_cast<float>(raw);
-      } else if (ch.type == "ads1115") {
-        if (!m_adsInitialized) {
-          ensureAdsReady();
-        }
-        if (m_adsInitialized && ch.index < 4) {
-          int16_t val = m_ads->readADC_SingleEnded(ch.index);
-          return static_cast<float>(val);
-        }
-        return 0.0f;
-      } else {
-        // Unknown type; return zero
-        return 0.0f;
-      }
+      return (int)i;
     }
   }
-  // If not found return zero
-  return 0.0f;
+  return -1;
 }
 
-float IORegistry::convert(const String &id, float raw) {
-  for (size_t i = 0; i < m_channelCount; i++) {
-    if (m_channels[i].id == id) {
-      return m_channels[i].k * raw + m_channels[i].b;
+bool IORegistry::isRemote(int handle) const {
+  if (handle < 0 || (size_t)handle >= m_channelCount) {
+    return false;
+  }
+  return m_channels[handle].isUdpIn;
+}
+
+bool IORegistry::isFast(int handle) const {
+  if (handle < 0 || (size_t)handle >= m_channelCount) {
+    return false;
+  }
+  return !m_channels[handle].isUdpIn && m_channels[handle].type == "a0";
+}
+
+float IORegistry::readRawAt(int handle) {
+  if (handle < 0 || (size_t)handle >= m_channelCount) {
+    return 0.0f;
+  }
+  const Channel &ch = m_channels[handle];
+  if (ch.isUdpIn) {
+    if (ch.remoteHasRaw) {
+      return ch.lastRemoteRaw;
+    }
+    if (ch.remoteHasValue) {
+      return ch.lastRemoteValue;
     }
+    return 0.0f;
   }
+  if (ch.type == "a0") {
+    // Read the built-in ADC. The ESP8266 ADC returns 0-1023.
+    int raw = analogRead(A0);
+    return static_cast<float>(raw);
+  } else if (ch.type == "ads1115") {
+    if (!m_adsInitialized) {
+      ensureAdsReady();
+    }
+    if (m_adsInitialized && ch.index < 4) {
+      int16_t val = m_ads->readADC_SingleEnded(ch.index);
+      return static_cast<float>(val);
+    }
+    return 0.0f;
+  }
+  // Unknown type; return zero
   return 0.0f;
 }
 
+float IORegistry::convert(const String &id, float raw) {
+  return convertAt(find(id), raw);
+}
+
+float IORegistry::convertAt(int handle, float raw) const {
+  if (handle < 0 || (size_t)handle >= m_channelCount) {
+    return 0.0f;
+  }
+  return m_channels[handle].k * raw + m_channels[handle].b;
+}
+
 float IORegistry::readValue(const String &id) {
   float raw = readRaw(id);
   return convert(id, raw);
@@ -42,6 +42,20 @@ public:
   // Convenience function to read and convert in one call.
   float readValue(const String &id);
 
+  // Handle-based access for callers that sample the same channel
+  // repeatedly (DMM engine): the id is looked up once with find() and
+  // readRawAt()/convertAt() skip the string comparisons. find() returns
+  // -1 for unknown ids; invalid handles read as 0.
+  int find(const String &id) const;
+  float readRawAt(int handle);
+  float convertAt(int handle, float raw) const;
+  // True for channels fed by UDP frames: reading them again returns the
+  // same cached value until the next frame arrives.
+  bool isRemote(int handle) const;
+  // True for the internal ADC, which can be sampled every ~100 us. The
+  // ADS1115 driver blocks for a full conversion (~8 ms) per read.
+  bool isFast(int handle) const;
+
   // Update the cached value of a remote UDP input. The value is matched
   // against the configured remote descriptors (MAC/IP/hostname and
   // channel identifier). Returns the number of channels updated.
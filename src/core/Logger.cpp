@@ -41,6 +41,33 @@ void Logger::log(Level level, const String &message) {
     m_file.println(json);
     m_file.flush();
   }
+  // Keep the entry for live views.
+  Entry &entry = m_recent[m_sequence % kRecentEntries];
+  entry.seq = ++m_sequence;
+  entry.ts = doc["ts"];
+  entry.level = level;
+  // Only the start of long messages: the ring must not pin the heap.
+  if (message.length() > kRecentMsgChars) {
+    entry.msg = message.substring(0, kRecentMsgChars);
+  } else {
+    entry.msg = message;
+  }
+}
+
+void Logger::recent(uint32_t after, JsonArray out) const {
+  uint32_t first =
+      m_sequence > kRecentEntries ? m_sequence - kRecentEntries + 1 : 1;
+  if (after >= first) {
+    first = after + 1;
+  }
+  for (uint32_t seq = first; seq <= m_sequence; ++seq) {
+    const Entry &entry = m_recent[(seq - 1) % kRecentEntries];
+    JsonObject obj = out.createNestedObject();
+    obj["seq"] = entry.seq;
+    obj["ts"] = entry.ts;
+    obj["level"] = levelToString(entry.level);
+    obj["msg"] = entry.msg;
+  }
 }
 
 const char *Logger::levelToString(Level lvl) {
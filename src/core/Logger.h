@@ -42,9 +42,30 @@ public:
   // not exist an empty string is returned.
   bool tail(size_t n, String &out);
 
+  // Number of entries kept in RAM for live views, and the length their
+  // message is cut to.
+  static const size_t kRecentEntries = 8;
+  static const size_t kRecentMsgChars = 120;
+
+  // Number of entries logged since boot.
+  uint32_t sequence() const { return m_sequence; }
+
+  // Append the entries numbered after `after` that are still in RAM to
+  // out, oldest first, as objects {seq, ts, level, msg}.
+  void recent(uint32_t after, JsonArray out) const;
+
 private:
+  struct Entry {
+    uint32_t seq;
+    unsigned long ts;
+    Level level;
+    String msg;
+  };
+
   File m_file;
-  const char *levelToString(Level lvl);
+  Entry m_recent[kRecentEntries];
+  uint32_t m_sequence = 0;
+  static const char *levelToString(Level lvl);
 };
 
 #endif // MINILABOESP_LOGGER_H
\ No newline at end of file
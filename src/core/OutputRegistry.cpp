@@ -0,0 +1,330 @@
+// Implementation of the OutputRegistry class
+
+#include "OutputRegistry.h"
+
+#include <LittleFS.h>
+#include <stdlib.h>
+
+#include "ConfigStore.h"
+#include "Logger.h"
+
+namespace {
+struct PinMapEntry {
+  const char *label;
+  uint8_t gpio;
+};
+
+const PinMapEntry kPinMap[] = {
+    {"D0", 16}, {"D1", 5},  {"D2", 4},  {"D3", 0}, {"D4", 2},
+    {"D5", 14}, {"D6", 12}, {"D7", 13}, {"D8", 15},
+};
+
+bool allDigits(const String &value) {
+  if (!value.length()) return false;
+  for (size_t i = 0; i < value.length(); ++i) {
+    char c = value.charAt(i);
+    if (c < '0' || c > '9') return false;
+  }
+  return true;
+}
+
+uint32_t readFrequency(JsonVariantConst value) {
+  if (value.is<uint32_t>()) {
+    return value.as<uint32_t>();
+  }
+  if (value.is<float>()) {
+    return (uint32_t)(value.as<float>() + 0.5f);
+  }
+  return 0;
+}
+} // namespace
+
+OutputRegistry::OutputRegistry(ConfigStore *config, Logger *logger)
+    : m_config(config), m_logger(logger), m_count(0), m_correctionCount(0),
+      m_builtRevision(0), m_configGeneration(0), m_generation(0) {}
+
+void OutputRegistry::begin() {
+  loadCorrections();
+  compile();
+}
+
+bool OutputRegistry::refresh() {
+  // Called on every pass of the generator loop: skip the area lookup
+  // while nothing in the store changed.
+  if (!m_config || m_config->generation() == m_configGeneration) {
+    return false;
+  }
+  m_configGeneration = m_config->generation();
+  if (m_config->revision("outputs") == m_builtRevision) {
+    return false;
+  }
+  compile();
+  return true;
+}
+
+int OutputRegistry::find(const String &id) const {
+  if (!id.length()) {
+    return kInvalidHandle;
+  }
+  for (size_t i = 0; i < m_count; ++i) {
+    if (m_bindings[i].id.equalsIgnoreCase(id)) {
+      return (int)i;
+    }
+  }
+  return kInvalidHandle;
+}
+
+const OutputRegistry::Binding *OutputRegistry::get(int handle) const {
+  if (handle < 0 || (size_t)handle >= m_count) {
+    return nullptr;
+  }
+  return &m_bindings[handle];
+}
+
+void OutputRegistry::compile() {
+  m_count = 0;
+  m_generation++;
+  if (!m_config) {
+    return;
+  }
+  m_builtRevision = m_config->revision("outputs");
+  m_configGeneration = m_config->generation();
+
+  JsonDocument &doc = m_config->getConfig("outputs");
+  if (!doc.is<JsonArray>()) {
+    if (m_logger) {
+      m_logger->warning(F("OutputRegistry: outputs config is not an array"));
+    }
+    return;
+  }
+  for (JsonVariantConst v : doc.as<JsonArrayConst>()) {
+    if (m_count >= kMaxOutputs) {
+      if (m_logger) {
+        m_logger->warning(F("OutputRegistry: too many outputs, ignoring rest"));
+      }
+      break;
+    }
+    if (!v.is<JsonObjectConst>()) {
+      continue;
+    }
+    if (compileEntry(v.as<JsonObjectConst>(), m_bindings[m_count])) {
+      m_count++;
+    }
+  }
+  attachCorrections();
+  if (m_logger) {
+    m_logger->info(String(F("OutputRegistry: ")) + String(m_count) +
+                   F(" sorties compilées"));
+  }
+}
+
+bool OutputRegistry::compileEntry(JsonObjectConst obj, Binding &out) {
+  const char *id = obj["id"] | "";
+  const char *type = obj["type"] | "";
+  if (!id[0]) {
+    return false;
+  }
+  JsonObjectConst cfg = obj["config"];
+
+  out.id = id;
+  out.type = type;
+  out.driver = DRIVER_NONE;
+  out.gpio = 0xFF;
+  out.pwmFreq = 0;
+  out.i2cAddress = 0;
+  out.rangeMin = cfg["range"]["min"] | 0.0f;
+  out.rangeMax = cfg["range"]["max"] | 0.0f;
+  out.unit = cfg["range"]["unit"] | "V";
+  out.rcCutoffHz = 0.0f;
+  out.lut = nullptr;
+
+  if (strcasecmp(type, "mcp4725") == 0) {
+    uint8_t address = 0x60;
+    if (cfg["address"].is<const char *>()) {
+      address = (uint8_t)strtol(cfg["address"].as<const char *>(), nullptr, 0);
+    } else if (cfg["address"].is<int>()) {
+      address = (uint8_t)cfg["address"].as<int>();
+    }
+    out.driver = DRIVER_MCP4725;
+    out.i2cAddress = address;
+    return true;
+  }
+
+  if (strcasecmp(type, "pwm_rc") == 0 || strcasecmp(type, "pwm_0_10v") == 0 ||
+      strcasecmp(type, "charge_pump_doubler") == 0) {
+    String pinLabel;
+    if (cfg["pin"].is<const char *>()) {
+      pinLabel = cfg["pin"].as<const char *>();
+    } else if (cfg["pin"].is<int>()) {
+      pinLabel = String(cfg["pin"].as<int>());
+    }
+    int gpio = pinLabelToGpio(pinLabel);
+    if (gpio < 0) {
+      if (m_logger) {
+        m_logger->warning(String(F("OutputRegistry: invalid GPIO for ")) + id);
+      }
+      // Keep the entry so that lookups report it as unavailable rather
+      // than unknown.
+      return true;
+    }
+    uint32_t freq = readFrequency(cfg["frequency"]);
+    if (freq == 0) {
+      freq = readFrequency(cfg["pwm"]["frequency"]);
+    }
+    if (freq == 0) {
+      if (strcasecmp(type, "pwm_rc") == 0) {
+        freq = 5000;
+      } else if (strcasecmp(type, "pwm_0_10v") == 0) {
+        freq = 2000;
+      } else {
+        freq = 4000;
+      }
+    }
+    float rOhm = cfg["filter"]["r_ohm"] | 0.0f;
+    float cUf = cfg["filter"]["c_uF"] | 0.0f;
+    if (rOhm > 0.0f && cUf > 0.0f) {
+      out.rcCutoffHz = 1.0f / (2.0f * PI * rOhm * cUf * 1e-6f);
+    }
+    out.driver = DRIVER_PWM;
+    out.gpio = (uint8_t)gpio;
+    out.pwmFreq = freq;
+    return true;
+  }
+
+  if (m_logger) {
+    m_logger->warning(String(F("OutputRegistry: unsupported type ")) +
+                      (type[0] ? type : "?") + F(" for ") + id);
+  }
+  return true;
+}
+
+void OutputRegistry::loadCorrections() {
+  m_correctionCount = 0;
+  File f = LittleFS.open("/calibration.json", "r");
+  if (!f) {
+    return;
+  }
+  DynamicJsonDocument doc(2048);
+  DeserializationError err = deserializeJson(doc, f);
+  f.close();
+  if (err) {
+    if (m_logger) {
+      m_logger->warning(String(F("OutputRegistry: calibration.json ")) +
+                        err.c_str());
+    }
+    return;
+  }
+  for (JsonObjectConst entry : doc["outputs"].as<JsonArrayConst>()) {
+    JsonArrayConst lut = entry["lut"];
+    const char *id = entry["id"] | "";
+    if (!id[0] || lut.size() != kCalPoints ||
+        m_correctionCount >= kMaxOutputs) {
+      continue;
+    }
+    Correction &c = m_corrections[m_correctionCount++];
+    c.id = id;
+    c.input = entry["input"] | "";
+    size_t i = 0;
+    for (JsonVariantConst v : lut) {
+      c.lut[i++] = v.as<uint16_t>();
+    }
+  }
+}
+
+void OutputRegistry::attachCorrections() {
+  for (size_t i = 0; i < m_count; ++i) {
+    m_bindings[i].lut = nullptr;
+    for (size_t j = 0; j < m_correctionCount; ++j) {
+      if (m_corrections[j].id.equalsIgnoreCase(m_bindings[i].id)) {
+        m_bindings[i].lut = m_corrections[j].lut;
+        break;
+      }
+    }
+  }
+}
+
+bool OutputRegistry::setCorrection(const String &id, const uint16_t *lut,
+                                   const String &inputId) {
+  Correction *slot = nullptr;
+  for (size_t i = 0; i < m_correctionCount; ++i) {
+    if (m_corrections[i].id.equalsIgnoreCase(id)) {
+      slot = &m_corrections[i];
+      break;
+    }
+  }
+  if (!slot) {
+    if (m_correctionCount >= kMaxOutputs) {
+      return false;
+    }
+    slot = &m_corrections[m_correctionCount++];
+    slot->id = id;
+  }
+  slot->input = inputId;
+  memcpy(slot->lut, lut, sizeof(slot->lut));
+  attachCorrections();
+  return true;
+}
+
+bool OutputRegistry::clearCorrection(const String &id) {
+  for (size_t i = 0; i < m_correctionCount; ++i) {
+    if (!m_corrections[i].id.equalsIgnoreCase(id)) {
+      continue;
+    }
+    // Move the last table into the freed slot; attachCorrections()
+    // refreshes the pointers held by the bindings.
+    m_correctionCount--;
+    if (i != m_correctionCount) {
+      m_corrections[i].id = m_corrections[m_correctionCount].id;
+      m_corrections[i].input = m_corrections[m_correctionCount].input;
+      memcpy(m_corrections[i].lut, m_corrections[m_correctionCount].lut,
+             sizeof(m_corrections[i].lut));
+    }
+    attachCorrections();
+    return true;
+  }
+  return false;
+}
+
+void OutputRegistry::serializeCorrections(JsonDocument &doc) const {
+  doc.clear();
+  JsonArray arr = doc.createNestedArray("outputs");
+  for (size_t i = 0; i < m_correctionCount; ++i) {
+    const Correction &c = m_corrections[i];
+    JsonObject entry = arr.createNestedObject();
+    entry["id"] = c.id;
+    entry["input"] = c.input;
+    JsonArray lut = entry.createNestedArray("lut");
+    for (size_t j = 0; j < kCalPoints; ++j) {
+      lut.add(c.lut[j]);
+    }
+  }
+}
+
+int OutputRegistry::pinLabelToGpio(const String &label) {
+  String trimmed = label;
+  trimmed.trim();
+  if (!trimmed.length()) return -1;
+
+  for (const auto &entry : kPinMap) {
+    if (trimmed.equalsIgnoreCase(entry.label)) {
+      return entry.gpio;
+    }
+  }
+
+  String upper = trimmed;
+  upper.toUpperCase();
+  if (upper.startsWith("GPIO")) {
+    String numeric = upper.substring(4);
+    if (allDigits(numeric)) {
+      int value = numeric.toInt();
+      if (value >= 0 && value <= 16) return value;
+    }
+    return -1;
+  }
+
+  if (allDigits(trimmed)) {
+    int value = trimmed.toInt();
+    if (value >= 0 && value <= 16) return value;
+  }
+  return -1;
+}
@@ -0,0 +1,123 @@
+// OutputRegistry compiles the analog outputs described in outputs.json
+// into a small table of typed bindings (driver, GPIO, PWM frequency,
+// I2C address, range and filter). Consumers look up an output once by
+// id and keep its handle; the table is only rebuilt when the "outputs"
+// configuration area changes, so the JSON document is never walked on
+// the signal path.
+//
+// Outputs can also carry a correction table measured by the function
+// generator calibration (output looped back to an input). Tables are
+// kept in /calibration.json and reattached by id whenever the table is
+// rebuilt.
+
+#ifndef MINILABOESP_OUTPUTREGISTRY_H
+#define MINILABOESP_OUTPUTREGISTRY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+class ConfigStore;
+class Logger;
+
+class OutputRegistry {
+public:
+  enum Driver { DRIVER_NONE, DRIVER_MCP4725, DRIVER_PWM };
+
+  // Points of a correction table. Entry i holds the drive level (Q16
+  // fraction of full scale) that produced i / (kCalPoints - 1) of the
+  // calibrated span.
+  static const size_t kCalPoints = 33;
+
+  struct Binding {
+    String id;
+    String type;   // type string from outputs.json ("pwm_rc", ...)
+    Driver driver;
+    uint8_t gpio;  // PWM pin, 0xFF for I2C outputs
+    uint32_t pwmFreq;
+    uint8_t i2cAddress;
+    float rangeMin;
+    float rangeMax;
+    String unit;
+    float rcCutoffHz; // RC filter cutoff, 0 if no filter is described
+    const uint16_t *lut; // correction table, nullptr if uncalibrated
+  };
+
+  static const int kInvalidHandle = -1;
+
+  // Maximum number of outputs kept in the table.
+  static const size_t kMaxOutputs = 8;
+
+  OutputRegistry(ConfigStore *config, Logger *logger);
+
+  // Build the table from outputs.json and load /calibration.json. Call
+  // after ConfigStore.begin().
+  void begin();
+
+  // Rebuild the table if the outputs area was modified since the last
+  // build. Returns true when the table changed.
+  bool refresh();
+
+  // Handle of the output with the given id (case-insensitive), or
+  // kInvalidHandle.
+  int find(const String &id) const;
+
+  // Binding for a handle, or nullptr if the handle is not valid.
+  const Binding *get(int handle) const;
+
+  size_t count() const { return m_count; }
+
+  // Incremented on every rebuild. Consumers that cache handles compare
+  // it to know when to look them up again.
+  uint32_t generation() const { return m_generation; }
+
+  // Store or drop the correction table of an output. The input id is
+  // kept for reference only. Returns false if no slot is available.
+  bool setCorrection(const String &id, const uint16_t *lut,
+                     const String &inputId);
+  bool clearCorrection(const String &id);
+
+  // Write every correction table in the /calibration.json layout.
+  void serializeCorrections(JsonDocument &doc) const;
+
+  // Map a requested fraction (0..1) through a correction table using
+  // linear interpolation in Q16: two table reads and one multiply.
+  static float applyCorrection(const uint16_t *lut, float value) {
+    uint32_t pos = (uint32_t)(value * (float)((kCalPoints - 1) << 16));
+    uint32_t seg = pos >> 16;
+    if (seg >= kCalPoints - 1) {
+      return lut[kCalPoints - 1] / 65535.0f;
+    }
+    int32_t a = lut[seg];
+    int32_t b = lut[seg + 1];
+    int32_t out = a + (int32_t)(((int64_t)(b - a) * (pos & 0xFFFF)) >> 16);
+    return out / 65535.0f;
+  }
+
+  // Convert a NodeMCU pin label ("D5"), "GPIO14" or a plain number to
+  // a GPIO number. Returns -1 for unknown labels.
+  static int pinLabelToGpio(const String &label);
+
+private:
+  void compile();
+  bool compileEntry(JsonObjectConst obj, Binding &out);
+  void loadCorrections();
+  void attachCorrections();
+
+  struct Correction {
+    String id;
+    String input;
+    uint16_t lut[kCalPoints];
+  };
+
+  ConfigStore *m_config;
+  Logger *m_logger;
+  Binding m_bindings[kMaxOutputs];
+  size_t m_count;
+  Correction m_corrections[kMaxOutputs];
+  size_t m_correctionCount;
+  uint32_t m_builtRevision;
+  uint32_t m_configGeneration; // ConfigStore::generation() last checked
+  uint32_t m_generation;
+};
+
+#endif // MINILABOESP_OUTPUTREGISTRY_H
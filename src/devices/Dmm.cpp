@@ -1,19 +1,56 @@
 // Implementation of the DMM device driver
 
 #include "Dmm.h"
+
+#include <math.h>
 
 #include "core/IORegistry.h"
 #include "core/Logger.h"
 #include "core/ConfigStore.h"
+#include "core/OutputRegistry.h"
+#include "devices/FuncGen.h"
+
+namespace {
+const float kPow10[] = {1.0f, 10.0f, 100.0f, 1e3f, 1e4f, 1e5f, 1e6f};
+} // namespace
 
 Dmm::Dmm(IORegistry *ioReg, Logger *logger, ConfigStore *config)
-    : m_count(0), m_io(ioReg), m_logger(logger), m_config(config) {}
+    : m_count(0), m_current(0), m_configRevision(0), m_configGeneration(0),
+      m_io(ioReg), m_logger(logger), m_config(config), m_outputs(nullptr),
+      m_funcGen(nullptr) {}
+
+const char *Dmm::modeName(Mode kind) {
+  switch (kind) {
+  case MODE_UAC:
+    return "UAC";
+  case MODE_BIN:
+    return "BIN";
+  case MODE_CONT:
+    return "CONT";
+  case MODE_FREQ:
+    return "FREQ";
+  case MODE_UDC:
+  default:
+    return "UDC";
+  }
+}
 
 void Dmm::begin() {
+  loadConfig();
+}
+
+void Dmm::loadConfig() {
+  for (size_t i = 0; i < m_count; i++) {
+    disarmCounter(m_channels[i]);
+  }
   m_count = 0;
+  m_current = 0;
+  m_configRevision = m_config->revision("dmm");
   // Read configuration from dmm.json. Expect an array of channel
   // definitions with fields: io (string), mode (string), decimals (int),
-  // threshold (float), hyst (float). Missing fields use defaults.
+  // threshold (float), hyst (float), aperture_ms (int) and the
+  // processing keys accepted by configure(). Missing fields use
+  // defaults.
   JsonDocument &doc = m_config->getConfig("dmm");
   if (doc.is<JsonArray>()) {
     JsonArray arr = doc.as<JsonArray>();
@@ -23,30 +60,791 @@ void Dmm::begin() {
       JsonObject obj = v.as<JsonObject>();
       Channel &ch = m_channels[m_count++];
       ch.ioId = obj["io"] | String();
-      ch.mode = obj["mode"] | String("UDC");
+      const char *mode = obj["mode"] | "UDC";
+      ch.kind = MODE_UDC;
+      if (strcasecmp(mode, "UAC") == 0) {
+        ch.kind = MODE_UAC;
+      } else if (strcasecmp(mode, "BIN") == 0) {
+        ch.kind = MODE_BIN;
+      } else if (strcasecmp(mode, "CONT") == 0) {
+        ch.kind = MODE_CONT;
+      } else if (strcasecmp(mode, "FREQ") == 0) {
+        ch.kind = MODE_FREQ;
+      } else if (strcasecmp(mode, "UDC") != 0 && m_logger) {
+        m_logger->warning(String(F("DMM: mode non géré ")) + mode +
+                          F(", UDC utilisé"));
+      }
+      ch.unit = ch.kind == MODE_FREQ ? "Hz" : "V";
       ch.decimals = obj["decimals"] | 2;
+      if (ch.decimals > 6) ch.decimals = 6;
+      ch.scale = kPow10[ch.decimals];
       ch.threshold = obj["threshold"] | 0.0;
       ch.hyst = obj["hyst"] | 0.0;
+      // A frequency gate needs far longer than a DC reading, and a UAC
+      // reading enough runs of samples for a stable RMS.
+      long aperture = obj["aperture_ms"] | (ch.kind == MODE_FREQ  ? 1000L
+                                            : ch.kind == MODE_UAC ? 200L
+                                                                  : 20L);
+      if (aperture < 1) aperture = 1;
+      if (aperture > 10000) aperture = 10000;
+      ch.apertureMs = (uint16_t)aperture;
+      ch.ioHandle = m_io ? m_io->find(ch.ioId) : -1;
+      ch.error = nullptr;
+      int gpio = -1;
+      if (ch.kind == MODE_FREQ) {
+        String pin = obj["gpio"] | ch.ioId;
+        if (!ch.ioId.length()) ch.ioId = pin;
+        gpio = OutputRegistry::pinLabelToGpio(pin);
+        const char *method = obj["method"] | "auto";
+        ch.freq.method = strcmp(method, "reciprocal") == 0 ? FREQ_RECIPROCAL
+                         : strcmp(method, "gated") == 0    ? FREQ_GATED
+                                                           : FREQ_AUTO;
+        // GPIO16 (D0) has no interrupt support on the ESP8266.
+        if (gpio < 0 || gpio >= 16) {
+          ch.error = "FREQ requires a GPIO with interrupt (not D0)";
+        } else {
+          ch.error = pinConflict((uint8_t)gpio);
+        }
+      } else if (ch.ioHandle < 0) {
+        ch.error = "unknown input";
+      } else if (ch.kind == MODE_UAC && !m_io->isFast(ch.ioHandle)) {
+        ch.error = "UAC requires the internal ADC";
+      }
+      if (ch.error && m_logger) {
+        m_logger->warning(String(F("DMM ")) + ch.ioId + F(": ") + ch.error);
+      }
+      clearAccumulators(ch);
+      ch.acCount = 0;
+      ch.acLevel = 0;
+      ch.acHyst = 0;
+      ch.blockSamples = 0;
+      ch.freqEdges = 0;
+      ch.freqRunUs = 0;
+      ch.valid = false;
+      ch.raw = 0.0f;
+      ch.measured = 0.0f;
+      ch.value = 0.0f;
+      ch.samples = 0;
+      ch.readingMs = 0;
+      ch.dcValue = 0.0f;
+      ch.freqHz = 0.0f;
+      ch.crest = 0.0f;
+      resetChannelStats(ch.stats);
+      float halfHyst = fabsf(ch.hyst) / 2.0f;
+      ch.logic.onLevel = ch.threshold + halfHyst;
+      ch.logic.offLevel = ch.threshold - halfHyst;
+      resetLogic(ch.logic);
+      Processing &p = ch.proc;
+      p.avgCount = 1;
+      p.avgFill = 0;
+      p.avgPos = 0;
+      p.rel = false;
+      p.relPending = false;
+      p.relRef = 0.0f;
+      p.hold = false;
+      p.minmax = false;
+      p.capCount = 0;
+      applyProcessing(p, obj);
+      ch.freq.overrange = false;
+      ch.freq.backoffUntilMs = 0;
+      ch.freq.periodUs = 0.0f;
+      ch.freq.dutyPct = -1.0f;
+      ch.freq.edges = 0;
+      if (ch.kind == MODE_FREQ && !ch.error) {
+        ch.freq.counter.gpio = (uint8_t)gpio;
+        pinMode(gpio, INPUT);
+        armCounter(ch, ch.freq.method == FREQ_GATED);
+      }
     }
+  }
+}
+
+void Dmm::loop() {
+  if (m_config && m_config->generation() != m_configGeneration) {
+    m_configGeneration = m_config->generation();
+    if (m_config->revision("dmm") != m_configRevision) {
+      loadConfig();
+    }
+  }
+  if (!m_count || !m_io) {
+    return;
+  }
+  // Logic channels on cheap inputs are watched on every call so that
+  // their transitions do not depend on the round-robin. Frequency gates
+  // are closed here too: they only read the interrupt counters.
+  for (size_t i = 0; i < m_count; i++) {
+    Channel &other = m_channels[i];
+    if (other.kind == MODE_FREQ) {
+      if (other.error) {
+        continue;
+      }
+      // The generator may take the pin after dmm.json was loaded.
+      other.error = pinConflict(other.freq.counter.gpio);
+      if (other.error) {
+        disarmCounter(other);
+        other.valid = false;
+        if (m_logger) {
+          m_logger->warning(String(F("DMM ")) + other.ioId + F(": ") +
+                            other.error);
+        }
+        continue;
+      }
+      updateCounter(other);
+      continue;
+    }
+    if (i != m_current && isLogic(other) && !other.error &&
+        (m_io->isFast(other.ioHandle) || m_io->isRemote(other.ioHandle))) {
+      sampleLogic(other);
+    }
+  }
+  Channel &ch = m_channels[m_current];
+  if (ch.error || ch.kind == MODE_FREQ) {
+    m_current = (m_current + 1) % m_count;
+    return;
+  }
+  if (!ch.accCount && !(ch.kind == MODE_UAC && ch.acCount)) {
+    ch.apertureStartMs = millis();
+  }
+  if (ch.kind == MODE_UAC) {
+    captureAcBlock(ch);
+  } else {
+    // Remote inputs only change when a frame arrives: one sample per
+    // call is enough.
+    bool burst = !m_io->isRemote(ch.ioHandle);
+    bool logic = isLogic(ch);
+    unsigned long start = micros();
+    do {
+      if (logic) {
+        ch.acc += sampleLogic(ch);
+      } else {
+        ch.acc += m_io->readRawAt(ch.ioHandle);
+      }
+      ch.accCount++;
+    } while (burst && (uint32_t)(micros() - start) < kLoopBudgetUs);
+  }
+
+  if (millis() - ch.apertureStartMs >= ch.apertureMs) {
+    completeAperture(ch);
+    m_current = (m_current + 1) % m_count;
+  }
+}
+
+void Dmm::captureAcBlock(Channel &ch) {
+  if (!ch.acCount) {
+    ch.acSum = 0;
+    ch.acSumSq = 0;
+    ch.acEdges = 0;
+    ch.acRunUs = 0;
+  }
+  // One run of evenly spaced samples, within the loop budget. Crossings
+  // of the previous block's mean are only counted between samples of
+  // the run, and the time they cover is counted with them.
+  const int32_t level = ch.acLevel;
+  const int32_t hyst = ch.acHyst;
+  bool high = false;
+  unsigned long start = micros();
+  unsigned long next = start;
+  for (uint16_t i = 0; ch.acCount < kUacMaxSamples; ++i) {
+    while ((int32_t)(micros() - next) < 0) {
+    }
+    int32_t x = (int32_t)m_io->readRawAt(ch.ioHandle);
+    ch.acSum += (uint32_t)x;
+    ch.acSumSq += (uint32_t)(x * x);
+    if (!ch.acCount) {
+      ch.acMin = ch.acMax = x;
+    }
+    if (x < ch.acMin) ch.acMin = x;
+    if (x > ch.acMax) ch.acMax = x;
+    ch.acCount++;
+    if (i == 0) {
+      // Counting the crossings of level + hyst from a known state
+      // keeps the rate unbiased whatever the phase of the run.
+      high = x > level + hyst;
+    } else {
+      ch.acRunUs += kUacSampleUs;
+      if (!high && x > level + hyst) {
+        high = true;
+        ch.acEdges++;
+      } else if (high && x < level - hyst) {
+        high = false;
+      }
+    }
+    next += kUacSampleUs;
+    if ((uint32_t)(next - start) >= kLoopBudgetUs) {
+      break;
+    }
+  }
+  if (ch.acCount >= kUacMaxSamples) {
+    closeAcBlock(ch);
+  }
+}
+
+void Dmm::closeAcBlock(Channel &ch) {
+  // Sums fit in 32 bits: 128 samples of at most 1023.
+  uint32_t n = ch.acCount;
+  ch.acCount = 0;
+  if (n < 2) {
+    return;
+  }
+  // n^2 * variance, exact in integers: the DC part is removed without a
+  // second pass over the samples.
+  uint64_t var = (uint64_t)n * ch.acSumSq - (uint64_t)ch.acSum * ch.acSum;
+  float rmsRaw = sqrtf((float)var) / n;
+  float dcRaw = (float)ch.acSum / n;
+  float peak = ch.acMax - dcRaw;
+  if (dcRaw - ch.acMin > peak) peak = dcRaw - ch.acMin;
+  float gain = fabsf(m_io->convertAt(ch.ioHandle, 1.0f) -
+                     m_io->convertAt(ch.ioHandle, 0.0f));
+  float rms = rmsRaw * gain;
+
+  int32_t swing = ch.acMax - ch.acMin;
+  ch.acLevel = (int32_t)((ch.acSum + n / 2) / n);
+  ch.acHyst = swing / 16 > 2 ? swing / 16 : 2;
+  if (swing < kUacMinSwing) {
+    // Noise only: its crossings say nothing about a frequency.
+    ch.freqEdges = 0;
+    ch.freqRunUs = 0;
+    ch.freqHz = 0.0f;
+  } else {
+    ch.freqEdges += ch.acEdges;
+    ch.freqRunUs += ch.acRunUs;
+    if (ch.freqRunUs >= kUacFreqWindowUs) {
+      ch.freqHz = ch.freqEdges * 1e6f / ch.freqRunUs;
+      ch.freqEdges = 0;
+      ch.freqRunUs = 0;
+    }
+  }
+  ch.blockSamples = (uint16_t)n;
+
+  float crest = rmsRaw > 0.0f ? peak / rmsRaw : 0.0f;
+  if (crest > ch.accCrest) ch.accCrest = crest;
+  ch.acc += (double)rms * rms * n;
+  ch.accDc += (double)dcRaw * n;
+  ch.accCount += n;
+}
+
+float Dmm::sampleLogic(Channel &ch) {
+  float raw = m_io->readRawAt(ch.ioHandle);
+  evaluateLogic(ch.logic, m_io->convertAt(ch.ioHandle, raw), millis());
+  return raw;
+}
+
+void Dmm::evaluateLogic(Logic &logic, float value, unsigned long nowMs) {
+  if (!logic.known) {
+    // The first sample only sets the initial state.
+    logic.known = true;
+    logic.high = value >= logic.onLevel;
+    logic.lastEdgeMs = nowMs;
+    return;
+  }
+  bool high = logic.high;
+  if (!high && value >= logic.onLevel) {
+    high = true;
+  } else if (high && value <= logic.offLevel) {
+    high = false;
+  }
+  if (high == logic.high) {
+    return;
+  }
+  uint32_t held = (uint32_t)(nowMs - logic.lastEdgeMs);
+  if (high) {
+    logic.rising++;
+    logic.timeLowMs += held;
+    logic.lastLowMs = held;
+  } else {
+    logic.falling++;
+    logic.timeHighMs += held;
+    logic.lastHighMs = held;
+  }
+  logic.high = high;
+  logic.lastEdgeMs = nowMs;
+  LogicEvent &ev = logic.events[logic.eventSeq % kLogicEvents];
+  ev.seq = ++logic.eventSeq;
+  ev.ms = nowMs;
+  ev.high = high;
+}
+
+void Dmm::resetLogic(Logic &logic) {
+  logic.known = false;
+  logic.high = false;
+  logic.rising = 0;
+  logic.falling = 0;
+  logic.lastEdgeMs = millis();
+  logic.timeHighMs = 0;
+  logic.timeLowMs = 0;
+  logic.lastHighMs = 0;
+  logic.lastLowMs = 0;
+  logic.eventSeq = 0;
+}
+
+void Dmm::clearAccumulators(Channel &ch) {
+  ch.acc = 0.0;
+  ch.accCount = 0;
+  ch.accDc = 0.0;
+  ch.accCrest = 0.0f;
+}
+
+void Dmm::completeAperture(Channel &ch) {
+  if (ch.kind == MODE_UAC) {
+    // The block in progress ends with the aperture.
+    closeAcBlock(ch);
+    if (!ch.accCount) {
+      return;
+    }
+    // Blocks are combined as a mean of squares, which keeps the result
+    // a true RMS over the whole aperture.
+    float rms = (float)sqrt(ch.acc / ch.accCount);
+    ch.raw = (float)(ch.accDc / ch.accCount);
+    ch.dcValue = m_io->convertAt(ch.ioHandle, ch.raw);
+    ch.crest = ch.accCrest;
+    ch.samples = ch.accCount;
+    publish(ch, rms);
+  } else {
+    ch.raw = (float)(ch.acc / ch.accCount);
+    ch.samples = ch.accCount;
+    publish(ch, m_io->convertAt(ch.ioHandle, ch.raw));
+  }
+  ch.readingMs = millis();
+  ch.valid = true;
+  clearAccumulators(ch);
+}
+
+void Dmm::publish(Channel &ch, float measured) {
+  Processing &p = ch.proc;
+  ch.measured = measured;
+  float value = measured;
+  if (p.avgCount > 1) {
+    p.avgBuf[p.avgPos] = measured;
+    p.avgPos = (p.avgPos + 1) % p.avgCount;
+    if (p.avgFill < p.avgCount) p.avgFill++;
+    float sum = 0.0f;
+    for (uint8_t k = 0; k < p.avgFill; k++) sum += p.avgBuf[k];
+    value = sum / p.avgFill;
+  }
+  if (p.rel) {
+    if (p.relPending) {
+      p.relRef = value;
+      p.relPending = false;
+    }
+    value -= p.relRef;
+  }
+  if (p.minmax) {
+    unsigned long now = millis();
+    if (!p.capCount || value < p.capMin) {
+      p.capMin = value;
+      p.capMinMs = now;
+    }
+    if (!p.capCount || value > p.capMax) {
+      p.capMax = value;
+      p.capMaxMs = now;
+    }
+    p.capCount++;
+  }
+  addToStats(ch.stats, value);
+  if (!p.hold) {
+    ch.value = value;
+  }
+}
+
+void Dmm::applyProcessing(Processing &p, JsonObjectConst obj) {
+  if (obj.containsKey("avg")) {
+    long n = obj["avg"] | 1L;
+    if (n < 1) n = 1;
+    if (n > kMaxAverage) n = kMaxAverage;
+    if ((uint8_t)n != p.avgCount) {
+      p.avgCount = (uint8_t)n;
+      p.avgFill = 0;
+      p.avgPos = 0;
+    }
+  }
+  JsonVariantConst rel = obj["rel"];
+  if (rel.is<bool>()) {
+    p.rel = rel.as<bool>();
+    p.relPending = p.rel;
+  } else if (rel.is<const char *>() &&
+             strcmp(rel.as<const char *>(), "capture") == 0) {
+    p.rel = true;
+    p.relPending = true;
+  }
+  if (obj.containsKey("rel_value")) {
+    p.relRef = obj["rel_value"] | 0.0f;
+    p.relPending = false;
+    if (rel.isNull()) {
+      p.rel = true;
+    }
+  }
+  if (obj.containsKey("hold")) {
+    p.hold = obj["hold"] | false;
+  }
+  if (obj.containsKey("minmax")) {
+    bool on = obj["minmax"] | false;
+    if (on && !p.minmax) {
+      p.capCount = 0;
+    }
+    p.minmax = on;
+  }
+}
+
+bool Dmm::configure(int index, JsonObjectConst obj, String &error) {
+  if (index < 0 || (size_t)index >= m_count) {
+    error = F("invalid channel");
+    return false;
+  }
+  Channel &ch = m_channels[index];
+  applyProcessing(ch.proc, obj);
+  const char *reset = obj["reset"] | "";
+  bool all = strcmp(reset, "all") == 0;
+  if (all || strcmp(reset, "minmax") == 0) {
+    ch.proc.capCount = 0;
+  }
+  if (all || strcmp(reset, "avg") == 0) {
+    ch.proc.avgFill = 0;
+    ch.proc.avgPos = 0;
+  }
+  if (all || strcmp(reset, "stats") == 0) {
+    resetChannelStats(ch.stats);
+  }
+  return true;
+}
+
+bool Dmm::latest(int index, float &value) const {
+  if (index < 0 || (size_t)index >= m_count || !m_channels[index].valid) {
+    return false;
+  }
+  value = m_channels[index].measured;
+  return true;
+}
+
+int Dmm::findChannel(const String &id) const {
+  for (size_t i = 0; i < m_count; i++) {
+    if (m_channels[i].ioId.equalsIgnoreCase(id)) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+void Dmm::addToStats(Stats &s, float value) {
+  s.count++;
+  if (s.count == 1 || value < s.min) s.min = value;
+  if (s.count == 1 || value > s.max) s.max = value;
+  double delta = value - s.mean;
+  s.mean += delta / s.count;
+  s.m2 += delta * (value - s.mean);
+}
+
+void IRAM_ATTR Dmm::onEdgeTimed(void *arg) {
+  Counter *c = static_cast<Counter *>(arg);
+  uint32_t now = ESP.getCycleCount();
+  if (GPIP(c->gpio)) {
+    if (!c->edges) {
+      c->firstCycle = now;
+    }
+    c->lastCycle = now;
+    c->edges = c->edges + 1;
+  } else if (c->edges) {
+    // Falling edge closing a pulse that started in this gate.
+    c->highCycles = c->highCycles + (now - c->lastCycle);
+    c->pulses = c->pulses + 1;
+  }
+}
+
+void IRAM_ATTR Dmm::onEdgeCounted(void *arg) {
+  Counter *c = static_cast<Counter *>(arg);
+  c->edges = c->edges + 1;
+}
+
+void Dmm::armCounter(Channel &ch, bool gated) {
+  disarmCounter(ch);
+  Counter &c = ch.freq.counter;
+  c.edges = 0;
+  c.highCycles = 0;
+  c.pulses = 0;
+  c.gated = gated;
+  ch.freq.gateStartUs = micros();
+  ch.freq.gateStartMs = millis();
+  attachInterruptArg(digitalPinToInterrupt(c.gpio),
+                     gated ? onEdgeCounted : onEdgeTimed, &c,
+                     gated ? RISING : CHANGE);
+  c.armed = true;
+}
+
+void Dmm::disarmCounter(Channel &ch) {
+  Counter &c = ch.freq.counter;
+  if (c.armed) {
+    detachInterrupt(digitalPinToInterrupt(c.gpio));
+    c.armed = false;
+  }
+}
+
+void Dmm::updateCounter(Channel &ch) {
+  FreqState &f = ch.freq;
+  Counter &c = f.counter;
+  unsigned long nowMs = millis();
+  if (!c.armed) {
+    if ((long)(nowMs - f.backoffUntilMs) >= 0) {
+      armCounter(ch, c.gated);
+    }
+    return;
+  }
+  uint32_t elapsedMs = (uint32_t)(nowMs - f.gateStartMs);
+  // Check the rate of edges on every call: an input far too fast would
+  // otherwise run the interrupt on each edge until the gate closes. One
+  // millisecond of margin covers the edges seen since the last call.
+  uint32_t edgesSoFar = c.edges;
+  if (!c.gated &&
+      edgesSoFar > kMaxReciprocalHz / 1000 * (elapsedMs + 1)) {
+    if (f.method == FREQ_AUTO) {
+      armCounter(ch, true);
+    } else {
+      suspendCounter(ch, edgesSoFar * 1000.0f / (elapsedMs + 1), nowMs);
+    }
+    return;
+  }
+  if (edgesSoFar > kMaxCountHz / 1000 * (elapsedMs + 1)) {
+    suspendCounter(ch, edgesSoFar * 1000.0f / (elapsedMs + 1), nowMs);
+    return;
+  }
+  if (elapsedMs < ch.apertureMs) {
+    return;
+  }
+  // A reciprocal measurement needs two rising edges: stretch the gate
+  // until they arrive or the timeout expires.
+  if (!c.gated && c.edges < 2 && elapsedMs < kFreqTimeoutMs) {
+    return;
+  }
+
+  noInterrupts();
+  uint32_t edges = c.edges;
+  uint32_t first = c.firstCycle;
+  uint32_t last = c.lastCycle;
+  uint32_t highCycles = c.highCycles;
+  uint32_t pulses = c.pulses;
+  unsigned long nowUs = micros();
+  c.edges = 0;
+  c.highCycles = 0;
+  c.pulses = 0;
+  interrupts();
+  uint32_t gateUs = (uint32_t)(nowUs - f.gateStartUs);
+  f.gateStartUs = nowUs;
+  f.gateStartMs = nowMs;
+
+  float cyclesPerUs = (float)ESP.getCpuFreqMHz();
+  float hz = 0.0f;
+  f.dutyPct = -1.0f;
+  if (c.gated) {
+    hz = gateUs ? edges * 1e6f / gateUs : 0.0f;
+  } else if (edges >= 2) {
+    float period = (float)(last - first) / (edges - 1);
+    hz = cyclesPerUs * 1e6f / period;
+    if (pulses) {
+      f.dutyPct = 100.0f * ((float)highCycles / pulses) / period;
+    }
+  }
+  f.edges = edges;
+  f.periodUs = hz > 0.0f ? 1e6f / hz : 0.0f;
+  ch.raw = (float)edges;
+  ch.samples = edges;
+  uint32_t maxHz =
+      c.gated || f.method == FREQ_AUTO ? kMaxCountHz : kMaxReciprocalHz;
+  if (hz > maxHz) {
+    suspendCounter(ch, hz, nowMs);
+    return;
+  }
+  f.overrange = false;
+  ch.readingMs = nowMs;
+  ch.valid = true;
+  publish(ch, hz);
+
+  if (f.method == FREQ_AUTO) {
+    if (!c.gated && hz > kGatedAboveHz) {
+      armCounter(ch, true);
+    } else if (c.gated && hz < kReciprocalBelowHz) {
+      armCounter(ch, false);
+    }
+  }
+}
+
+void Dmm::suspendCounter(Channel &ch, float hz, unsigned long nowMs) {
+  FreqState &f = ch.freq;
+  // Too many interrupts: give the WiFi stack room and retry later.
+  disarmCounter(ch);
+  f.overrange = true;
+  f.backoffUntilMs = nowMs + kOverrangeBackoffMs;
+  ch.measured = hz;
+  ch.readingMs = nowMs;
+  ch.valid = false;
+  if (m_logger) {
+    m_logger->warning(String(F("DMM ")) + ch.ioId +
+                      F(": fréquence hors plage, compteur suspendu"));
+  }
+}
+
+const char *Dmm::pinConflict(uint8_t gpio) const {
+  if (m_outputs) {
+    for (size_t i = 0; i < m_outputs->count(); ++i) {
+      const OutputRegistry::Binding *b = m_outputs->get((int)i);
+      if (b && b->driver == OutputRegistry::DRIVER_PWM && b->gpio == gpio) {
+        return "GPIO used by an output of outputs.json";
+      }
+    }
+  }
+  if (m_funcGen && m_funcGen->usesGpio(gpio)) {
+    return "GPIO used by the function generator";
+  }
+  return nullptr;
+}
+
+void Dmm::resetChannelStats(Stats &stats) {
+  stats.count = 0;
+  stats.min = 0.0f;
+  stats.max = 0.0f;
+  stats.mean = 0.0;
+  stats.m2 = 0.0;
+}
+
+void Dmm::resetStats() {
+  for (size_t i = 0; i < m_count; i++) {
+    resetChannelStats(m_channels[i].stats);
+    Logic &logic = m_channels[i].logic;
+    // Keep the current level: only the counters restart.
+    bool known = logic.known;
+    bool high = logic.high;
+    resetLogic(logic);
+    logic.known = known;
+    logic.high = high;
+  }
+}
+
+size_t Dmm::snapshotJsonCapacity() const {
+  size_t capacity = JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(m_count);
+  for (size_t i = 0; i < m_count; i++) {
+    const Channel &ch = m_channels[i];
+    capacity += kSnapshotChannelCapacity + ch.ioId.length() +
+                (isLogic(ch) ? kSnapshotLogicCapacity
+                             : kSnapshotModeCapacity);
   }
+  return capacity;
 }
 
 void Dmm::getSnapshot(JsonDocument &doc) {
   // Prepare an array in the provided document. The caller must
   // allocate sufficient capacity for the expected number of channels.
   JsonArray arr = doc.createNestedArray("channels");
+  unsigned long now = millis();
   for (size_t i = 0; i < m_count; i++) {
     const Channel &ch = m_channels[i];
-    float raw = m_io->readRaw(ch.ioId);
-    float val = m_io->convert(ch.ioId, raw);
-    // Round to the configured number of decimals
-    float scale = 1.0;
-    for (uint8_t j = 0; j < ch.decimals; j++) scale *= 10.0;
-    val = roundf(val * scale) / scale;
+    const Processing &p = ch.proc;
+    const float scale = ch.scale;
     JsonObject obj = arr.createNestedObject();
     obj["id"] = ch.ioId;
-    obj["raw"] = raw;
-    obj["value"] = val;
-    obj["unit"] = (ch.mode == "UDC") ? "V" : "";
+    obj["raw"] = ch.raw;
+    obj["value"] = roundTo(ch.value, scale);
+    obj["mode"] = modeName(ch.kind);
+    obj["unit"] = ch.unit;
+    obj["valid"] = ch.valid;
+    if (ch.error) {
+      obj["error"] = ch.error;
+    }
+    obj["samples"] = ch.samples;
+    obj["aperture_ms"] = ch.apertureMs;
+    obj["age_ms"] = ch.valid ? (uint32_t)(now - ch.readingMs) : 0;
+    if (p.avgCount > 1 || p.rel || p.hold) {
+      obj["measured"] = roundTo(ch.measured, scale);
+    }
+    if (p.avgCount > 1) {
+      JsonObject avg = obj.createNestedObject("avg");
+      avg["count"] = p.avgCount;
+      avg["filled"] = p.avgFill;
+    }
+    if (p.rel) {
+      JsonObject rel = obj.createNestedObject("rel");
+      rel["ref"] = roundTo(p.relRef, scale);
+      rel["pending"] = p.relPending;
+    }
+    if (p.hold) {
+      obj["hold"] = true;
+    }
+    if (p.minmax) {
+      JsonObject mm = obj.createNestedObject("minmax");
+      mm["count"] = p.capCount;
+      if (p.capCount) {
+        mm["min"] = roundTo(p.capMin, scale);
+        mm["max"] = roundTo(p.capMax, scale);
+        mm["min_age_ms"] = (uint32_t)(now - p.capMinMs);
+        mm["max_age_ms"] = (uint32_t)(now - p.capMaxMs);
+      }
+    }
+
+    const Stats &s = ch.stats;
+    JsonObject stats = obj.createNestedObject("stats");
+    stats["count"] = s.count;
+    if (s.count) {
+      stats["min"] = roundTo(s.min, scale);
+      stats["max"] = roundTo(s.max, scale);
+      stats["mean"] = roundTo((float)s.mean, scale);
+      float stddev = s.count > 1 ? sqrtf((float)(s.m2 / (s.count - 1))) : 0;
+      // One more decimal than the reading: the spread is usually small.
+      stats["stddev"] = roundTo(stddev, scale * 10.0f);
+    }
+
+    if (ch.kind == MODE_UAC) {
+      JsonObject ac = obj.createNestedObject("ac");
+      ac["dc"] = roundTo(ch.dcValue, scale);
+      ac["freq_hz"] = roundf(ch.freqHz * 10.0f) / 10.0f;
+      ac["crest"] = roundf(ch.crest * 100.0f) / 100.0f;
+      ac["block_samples"] = ch.blockSamples;
+      ac["sample_us"] = (uint32_t)kUacSampleUs;
+    }
+
+    if (ch.kind == MODE_FREQ) {
+      const FreqState &f = ch.freq;
+      JsonObject freq = obj.createNestedObject("freq");
+      freq["gpio"] = f.counter.gpio;
+      freq["method"] = f.counter.gated ? "gated" : "reciprocal";
+      freq["auto"] = f.method == FREQ_AUTO;
+      freq["period_us"] = f.periodUs;
+      if (f.dutyPct >= 0.0f) {
+        freq["duty_pct"] = roundf(f.dutyPct * 10.0f) / 10.0f;
+      }
+      freq["edges"] = f.edges;
+      freq["overrange"] = f.overrange;
+      freq["max_hz"] = f.counter.gated || f.method == FREQ_AUTO
+                           ? (uint32_t)kMaxCountHz
+                           : (uint32_t)kMaxReciprocalHz;
+    }
+
+    if (isLogic(ch)) {
+      const Logic &l = ch.logic;
+      JsonObject logic = obj.createNestedObject("logic");
+      logic["known"] = l.known;
+      logic["high"] = l.high;
+      if (ch.kind == MODE_CONT) {
+        logic["closed"] = l.known && !l.high;
+      }
+      logic["threshold"] = ch.threshold;
+      logic["hyst"] = ch.hyst;
+      logic["rising"] = l.rising;
+      logic["falling"] = l.falling;
+      // Include the time spent so far in the current state.
+      uint32_t current = l.known ? (uint32_t)(now - l.lastEdgeMs) : 0;
+      logic["time_high_ms"] = l.timeHighMs + (l.high ? current : 0);
+      logic["time_low_ms"] = l.timeLowMs + (l.high ? 0 : current);
+      logic["state_ms"] = current;
+      logic["last_high_ms"] = l.lastHighMs;
+      logic["last_low_ms"] = l.lastLowMs;
+      logic["event_seq"] = l.eventSeq;
+      JsonArray events = logic.createNestedArray("events");
+      size_t stored = l.eventSeq < kLogicEvents ? l.eventSeq : kLogicEvents;
+      for (size_t k = 0; k < stored; k++) {
+        // Oldest first.
+        const LogicEvent &ev =
+            l.events[(l.eventSeq - stored + k) % kLogicEvents];
+        JsonObject e = events.createNestedObject();
+        e["seq"] = ev.seq;
+        e["age_ms"] = (uint32_t)(now - ev.ms);
+        e["high"] = ev.high;
+      }
+    }
   }
-}
\ No newline at end of file
+}
@@ -2,8 +2,72 @@
 // IORegistry to read raw analog values and converts them to user
 // defined quantities according to the DMM configuration. Each DMM
 // channel defines which IO source to use, how many decimals to
-// display and optional threshold/hysteresis for binary modes. Only
-// direct measurement (UDC) is implemented in this skeleton.
+// display and optional threshold/hysteresis for binary modes. Modes:
+// "UDC" (averaged DC voltage), "UAC" (true RMS of the AC component),
+// "BIN" (logic level), "CONT" (continuity: closed below threshold) and
+// "FREQ" (frequency, period and duty cycle on a GPIO).
+//
+// Measurements run continuously from loop(): the channels are measured
+// one after the other, each one averaging samples over its aperture
+// ("aperture_ms", 20 ms by default) before its reading is published.
+// The samples are not contiguous: each loop() call takes a burst of at
+// most kLoopBudgetUs, and the rest of the loop runs in between, so the
+// average does not reject 50 Hz mains the way a full-cycle integration
+// would. Running statistics are kept per channel and
+// getSnapshot() only reports this cached state, so HTTP requests never
+// touch the ADCs.
+//
+// UAC samples the internal ADC every kUacSampleUs (5 kHz) in runs of
+// at most kLoopBudgetUs per loop() call, and sums the samples into
+// blocks of up to kUacMaxSamples, so a block spans several calls. Each
+// block gives, from integer sums, the DC component, the RMS of what
+// remains and the crest factor; blocks are combined into the aperture
+// (200 ms by default) weighted by their samples. The RMS does not need
+// the samples to be contiguous, only not synchronous with the signal.
+// The frequency is the rate of level crossings seen between consecutive
+// samples of a run, accumulated over kUacFreqWindowUs of sampled time
+// (several seconds of wall time): it is a rough indication, within
+// about 20 % at 50 Hz and better at higher frequencies. Above 1 kHz
+// there are too few samples per period.
+//
+// BIN and CONT channels still publish their averaged voltage, and every
+// sample also goes through a Schmitt trigger (high above threshold +
+// hyst/2, low below threshold - hyst/2) that counts edges, accumulates
+// the time spent in each state and records transitions in a small
+// event ring. Fast and remote inputs of these channels are sampled on
+// every loop() call, not only on their round-robin turn, so pulses
+// longer than one loop period are never missed between HTTP polls.
+//
+// FREQ channels ("gpio": "D5") count edges from an interrupt and time
+// them with the CPU cycle counter (12.5 ns at 80 MHz), so the result
+// does not depend on how busy loop() is with HTTP or UDP. Two methods:
+//  - reciprocal: the time between the first and last rising edge of the
+//    gate gives the period with a constant resolution of one CPU cycle,
+//    which suits low frequencies. Both edges are timed, so the duty
+//    cycle is reported too. The gate is stretched until two edges are
+//    seen, up to kFreqTimeoutMs (lowest frequency ~0.2 Hz).
+//  - gated: rising edges are only counted over the gate (aperture_ms,
+//    1 s by default), +-1 count, which suits high frequencies and keeps
+//    the interrupt handler minimal.
+// "method": "auto" (default) switches to gated above kGatedAboveHz and
+// back below kReciprocalBelowHz. Each edge costs an interrupt of a few
+// microseconds: the counter is specified up to kMaxReciprocalHz (20 kHz)
+// in reciprocal mode (two interrupts per period) and kMaxCountHz
+// (100 kHz) in gated mode. The edge count is checked against these
+// rates on every loop() call, not only when the gate closes: beyond
+// them the interrupt is detached for a second to keep WiFi alive and
+// the channel reports "overrange" (in auto mode, a reciprocal gate
+// switches to gated instead). GPIO16 (D0) has no interrupt and cannot
+// be used, nor can a pin declared in outputs.json or used by the
+// function generator.
+//
+// Every published reading then goes through the front-panel functions
+// of its channel, in this order: averaging over the last "avg"
+// readings, REL (subtract "rel_value", or the next reading when "rel"
+// is enabled without a value), MIN/MAX capture ("minmax") and HOLD
+// (the displayed value stops updating). They are set in dmm.json or at
+// runtime with configure(). Scale and unit are resolved when dmm.json
+// is loaded, so getSnapshot() does no parsing or string comparison.
 
 #ifndef MINILABOESP_DMM_H
 #define MINILABOESP_DMM_H
@@ -14,38 +78,267 @@
 class IORegistry;
 class Logger;
 class ConfigStore;
+class OutputRegistry;
+class FuncGen;
 
 class Dmm {
 public:
   Dmm(IORegistry *ioReg, Logger *logger, ConfigStore *config);
 
+  // Outputs and generator whose pins FREQ channels must not use. Set
+  // before begin().
+  void setOutputs(const OutputRegistry *outputs, const FuncGen *funcGen) {
+    m_outputs = outputs;
+    m_funcGen = funcGen;
+  }
+
   // Initialise the device by reading configuration. Must be called
   // after ConfigStore.begin().
   void begin();
 
-  // Update internal state. Not used in this simple implementation but
-  // kept for future expansions (filters, RMS calculations).
-  void loop() {}
+  // Run the measurement engine. Each call samples the current channel
+  // for at most kLoopBudgetUs (one sample for slow ADCs such as the
+  // ADS1115) and publishes its reading once the aperture has elapsed.
+  // dmm.json is reloaded when it changes.
+  void loop();
 
   // Produce a snapshot of all configured DMM channels. The returned
   // document contains an array named "channels" with objects:
-  // { "id": <string>, "raw": <number>, "value": <float>, "unit": <string> }.
+  // { "id": <string>, "raw": <number>, "value": <float>, "unit": <string>,
+  //   "samples", "aperture_ms", "age_ms", "stats": {count, min, max,
+  //   mean, stddev} }. UAC channels add "ac": {dc, freq_hz, crest,
+  //   block_samples}. BIN/CONT channels add "logic": {state, edges,
+  //   times, last pulses, events}. Values come from the last completed
+  //   aperture.
   void getSnapshot(JsonDocument &doc);
+  // Capacity of the JSON document to pass to getSnapshot() for the
+  // configured channels, with room for an "ok" and "error" beside
+  // "channels".
+  size_t snapshotJsonCapacity() const;
 
+  // Restart the running statistics (and logic counters) of every
+  // channel.
+  void resetStats();
+
+  // Change the front-panel functions of a channel at runtime. Keys:
+  // avg (1..kMaxAverage), rel (bool or "capture"), rel_value, hold,
+  // minmax, reset ("minmax", "stats", "avg" or "all"). The changes are
+  // not written to dmm.json. Returns false with a reason in error.
+  bool configure(int index, JsonObjectConst obj, String &error);
+
+  // Index of the channel measuring the given io id or GPIO label, or -1.
+  int findChannel(const String &id) const;
+
+  size_t channelCount() const { return m_count; }
+
+  // Last reading of a channel from the cached state, as measured:
+  // averaging, REL and HOLD only apply to the displayed value. Returns
+  // false while no valid reading exists.
+  bool latest(int index, float &value) const;
+
 private:
+  // Running statistics over the published readings (Welford).
+  struct Stats {
+    uint32_t count;
+    float min;
+    float max;
+    double mean;
+    double m2;
+  };
+
+  enum Mode { MODE_UDC, MODE_UAC, MODE_BIN, MODE_CONT, MODE_FREQ };
+  enum FreqMethod { FREQ_AUTO, FREQ_RECIPROCAL, FREQ_GATED };
+
+  // State shared with the edge interrupt of a FREQ channel. Cycle counts
+  // come from ESP.getCycleCount().
+  struct Counter {
+    volatile uint32_t edges;      // rising edges in the current gate
+    volatile uint32_t firstCycle; // first rising edge of the gate
+    volatile uint32_t lastCycle;  // latest rising edge
+    volatile uint32_t highCycles; // summed length of complete pulses
+    volatile uint32_t pulses;     // number of complete pulses
+    uint8_t gpio;
+    bool armed;
+    bool gated; // handler in use: count only (true) or timed edges
+  };
+
+  struct FreqState {
+    FreqMethod method;
+    Counter counter;
+    unsigned long gateStartUs;
+    unsigned long gateStartMs;
+    unsigned long backoffUntilMs; // re-arm time after an overrange
+    bool overrange;
+    float periodUs;
+    float dutyPct; // negative when not measured (gated)
+    uint32_t edges;
+  };
+
+  static const size_t kLogicEvents = 8;
+
+  // Snapshot capacity of a channel: the members every channel has (its
+  // id copied), then the part of its mode.
+  static const size_t kSnapshotChannelCapacity =
+      JSON_OBJECT_SIZE(18) + 2 * JSON_OBJECT_SIZE(2) +
+      2 * JSON_OBJECT_SIZE(5) + 32;
+  static const size_t kSnapshotModeCapacity = JSON_OBJECT_SIZE(8);
+  static const size_t kSnapshotLogicCapacity =
+      JSON_OBJECT_SIZE(14) + JSON_ARRAY_SIZE(kLogicEvents) +
+      kLogicEvents * JSON_OBJECT_SIZE(3);
+
+  struct LogicEvent {
+    uint32_t seq;
+    unsigned long ms;
+    bool high;
+  };
+
+  // Schmitt trigger state of a BIN/CONT channel. Levels are in the
+  // converted unit of the input.
+  struct Logic {
+    float onLevel;
+    float offLevel;
+    bool known;
+    bool high;
+    uint32_t rising;
+    uint32_t falling;
+    unsigned long lastEdgeMs;
+    uint32_t timeHighMs; // completed time in each state
+    uint32_t timeLowMs;
+    uint32_t lastHighMs; // length of the last completed pulses
+    uint32_t lastLowMs;
+    uint32_t eventSeq;   // number of transitions since the last reset
+    LogicEvent events[kLogicEvents];
+  };
+
+  static const uint8_t kMaxAverage = 16;
+
+  // Front-panel processing applied to published readings.
+  struct Processing {
+    uint8_t avgCount; // 1 = no averaging
+    uint8_t avgFill;
+    uint8_t avgPos;
+    float avgBuf[kMaxAverage];
+    bool rel;
+    bool relPending; // take the next reading as reference
+    float relRef;
+    bool hold;
+    bool minmax;
+    uint32_t capCount;
+    float capMin;
+    float capMax;
+    unsigned long capMinMs;
+    unsigned long capMaxMs;
+  };
+
   struct Channel {
     String ioId;
-    String mode;
+    Mode kind;
     uint8_t decimals;
+    float scale;      // 10^decimals
+    const char *unit; // resolved from the mode
     float threshold;
     float hyst;
+    uint16_t apertureMs;
+    int ioHandle; // IORegistry handle, -1 if the input is unknown
+    const char *error; // why the channel cannot measure, or nullptr
+    // Aperture being integrated.
+    double acc;
+    uint32_t accCount;
+    unsigned long apertureStartMs;
+    // UAC aperture accumulators, weighted by the samples of each block:
+    // acc holds the sum of squared block RMS values, accCount the
+    // samples.
+    double accDc;
+    float accCrest;
+    // UAC block being captured, over several calls (raw ADC units).
+    uint16_t acCount;
+    uint32_t acSum;
+    uint32_t acSumSq;
+    int32_t acMin;
+    int32_t acMax;
+    uint32_t acEdges;
+    uint32_t acRunUs; // time between consecutive samples of the runs
+    // UAC state carried from one block to the next.
+    int32_t acLevel;
+    int32_t acHyst;
+    uint16_t blockSamples;
+    // Level crossings and sampled time of the frequency window.
+    uint32_t freqEdges;
+    uint32_t freqRunUs;
+    // Last published reading. measured is the reading itself, value
+    // what is displayed after averaging, REL and HOLD.
+    bool valid;
+    float raw;
+    float measured;
+    float value;
+    uint32_t samples;
+    unsigned long readingMs;
+    float dcValue;
+    float freqHz;
+    float crest;
+    Stats stats;
+    Logic logic;
+    FreqState freq;
+    Processing proc;
   };
+
+  // Time spent sampling per loop() call. Kept short: reading the
+  // internal ADC back to back for long starves the WiFi stack.
+  static const uint32_t kLoopBudgetUs = 1000;
   static const size_t kMaxChannels = 8;
+  static const uint32_t kUacSampleUs = 200;
+  static const uint16_t kUacMaxSamples = 128;
+  static const uint32_t kUacFreqWindowUs = 500000;
+  // Peak-to-peak swing (raw LSB) below which no frequency is reported.
+  static const int32_t kUacMinSwing = 8;
+  static const uint32_t kFreqTimeoutMs = 5000;
+  static const uint32_t kGatedAboveHz = 5000;
+  static const uint32_t kReciprocalBelowHz = 4000;
+  static const uint32_t kMaxReciprocalHz = 20000;
+  static const uint32_t kMaxCountHz = 100000;
+  static const uint32_t kOverrangeBackoffMs = 1000;
+
+  void loadConfig();
+  void completeAperture(Channel &ch);
+  void captureAcBlock(Channel &ch);
+  void closeAcBlock(Channel &ch);
+  void clearAccumulators(Channel &ch);
+  // Sample a channel once and feed the value to its Schmitt trigger.
+  float sampleLogic(Channel &ch);
+  void evaluateLogic(Logic &logic, float value, unsigned long nowMs);
+  static void resetLogic(Logic &logic);
+  static const char *modeName(Mode kind);
+  static bool isLogic(const Channel &ch) {
+    return ch.kind == MODE_BIN || ch.kind == MODE_CONT;
+  }
+  static void resetChannelStats(Stats &stats);
+  static void addToStats(Stats &stats, float value);
+  // Run a new reading through the channel processing and publish it.
+  void publish(Channel &ch, float measured);
+  static void applyProcessing(Processing &p, JsonObjectConst obj);
+  static float roundTo(float value, float scale) {
+    return roundf(value * scale) / scale;
+  }
+  void armCounter(Channel &ch, bool gated);
+  void disarmCounter(Channel &ch);
+  void updateCounter(Channel &ch);
+  // Detach the interrupt of a channel whose input is too fast.
+  void suspendCounter(Channel &ch, float hz, unsigned long nowMs);
+  // Why a FREQ channel cannot use the GPIO, or nullptr.
+  const char *pinConflict(uint8_t gpio) const;
+  static void IRAM_ATTR onEdgeTimed(void *arg);
+  static void IRAM_ATTR onEdgeCounted(void *arg);
+
   Channel m_channels[kMaxChannels];
   size_t m_count;
+  size_t m_current;
+  uint32_t m_configRevision;
+  uint32_t m_configGeneration; // ConfigStore::generation() last checked
   IORegistry *m_io;
   Logger *m_logger;
   ConfigStore *m_config;
+  const OutputRegistry *m_outputs;
+  const FuncGen *m_funcGen;
 };
 
-#endif // MINILABOESP_DMM_H
\ No newline at end of file
+#endif // MINILABOESP_DMM_H
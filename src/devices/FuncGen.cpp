@@ -4,11 +4,18 @@
 
 #include "core/Logger.h"
 #include "core/ConfigStore.h"
+#include "core/IORegistry.h"
+#include "core/OutputRegistry.h"
+#include "services/FileWriteService.h"
+#include "services/OutputTester.h"
+#include <LittleFS.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 namespace {
+const float kQ24 = 16777216.0f;
+
 const char *waveformName(FuncGen::Waveform wave) {
   switch (wave) {
   case FuncGen::SINE:
@@ -23,45 +30,319 @@ const char *waveformName(FuncGen::Waveform wave) {
     return "unknown";
   }
 }
+
+bool parseWaveform(const char *typeStr, FuncGen::Waveform &out) {
+  if (!typeStr) {
+    return false;
+  }
+  if (strcasecmp(typeStr, "sine") == 0) {
+    out = FuncGen::SINE;
+  } else if (strcasecmp(typeStr, "square") == 0) {
+    out = FuncGen::SQUARE;
+  } else if (strcasecmp(typeStr, "triangle") == 0) {
+    out = FuncGen::TRIANGLE;
+  } else if (strcasecmp(typeStr, "dc") == 0) {
+    out = FuncGen::DC;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *runModeName(FuncGen::RunMode mode) {
+  switch (mode) {
+  case FuncGen::MODE_BURST:
+    return "burst";
+  case FuncGen::MODE_GATED:
+    return "gated";
+  case FuncGen::MODE_CONTINUOUS:
+  default:
+    return "continuous";
+  }
+}
+
+FuncGen::RunMode parseRunMode(const char *str) {
+  if (str && strcasecmp(str, "burst") == 0) {
+    return FuncGen::MODE_BURST;
+  }
+  if (str && strcasecmp(str, "gated") == 0) {
+    return FuncGen::MODE_GATED;
+  }
+  return FuncGen::MODE_CONTINUOUS;
+}
+
+const char *triggerSourceName(FuncGen::TriggerSource src) {
+  switch (src) {
+  case FuncGen::TRIG_INPUT:
+    return "input";
+  case FuncGen::TRIG_GPIO:
+    return "gpio";
+  case FuncGen::TRIG_MANUAL:
+  default:
+    return "manual";
+  }
+}
+
+FuncGen::TriggerSource parseTriggerSource(const char *str) {
+  if (str && strcasecmp(str, "input") == 0) {
+    return FuncGen::TRIG_INPUT;
+  }
+  if (str && strcasecmp(str, "gpio") == 0) {
+    return FuncGen::TRIG_GPIO;
+  }
+  return FuncGen::TRIG_MANUAL;
+}
+
+// Wrap a phase value into [0,1). Large scheduler gaps can push the
+// accumulator past several periods so a single subtraction is not
+// enough.
+float wrapPhase(float phase) { return phase - floorf(phase); }
+
+// Sigma-delta modulator settings. The timer period sets the dither
+// rate; the error clamp keeps the second order loop stable when the
+// requested level sits on a rail.
+const uint32_t kDitherPeriodMs = 1;
+const int32_t kDitherErrorLimit = 4L << 16;
+const uint16_t kPwmMaxCode = 1023;
+
+uint8_t parseDither(JsonVariantConst value) {
+  if (value.is<const char *>()) {
+    const char *mode = value.as<const char *>();
+    if (strcasecmp(mode, "sd2") == 0 || strcasecmp(mode, "second") == 0) {
+      return 2;
+    }
+    if (strcasecmp(mode, "sd1") == 0 || strcasecmp(mode, "first") == 0) {
+      return 1;
+    }
+    return 0;
+  }
+  int order = value | 0;
+  if (order < 0) order = 0;
+  if (order > 2) order = 2;
+  return (uint8_t)order;
+}
+
+// Codes per second the modulator can actually apply: a new duty only
+// takes effect at the next PWM period.
+uint32_t ditherRateHz(uint32_t pwmFreq) {
+  uint32_t rate = 1000 / kDitherPeriodMs;
+  return pwmFreq && pwmFreq < rate ? pwmFreq : rate;
+}
+
+// Rough effective resolution of a PWM output after a first order RC
+// filter. Quantisation noise of an order-L modulator shrinks with the
+// oversampling ratio OSR = f_dither / (2 * f_cutoff), but the carrier
+// ripple left by the filter, about pi/2 * f_cutoff / f_pwm of full
+// scale at 50 % duty, bounds the result whatever the dither.
+float estimateDitherBits(uint8_t order, float cutoffHz, uint32_t pwmFreq) {
+  if (cutoffHz <= 0.0f) {
+    return 10.0f;
+  }
+  float bits = 10.0f;
+  float osr = ditherRateHz(pwmFreq) / (2.0f * cutoffHz);
+  if (order > 0 && osr > 1.0f) {
+    float gainDb =
+        (2.0f * order + 1.0f) * 10.0f * log10f(osr) -
+        10.0f * log10f(powf(PI, 2.0f * order) / (2.0f * order + 1.0f));
+    if (gainDb > 0.0f) {
+      bits += gainDb / 6.02f;
+    }
+  }
+  if (pwmFreq > 0) {
+    float rippleBits = log2f(pwmFreq / (0.5f * PI * cutoffHz));
+    if (bits > rippleBits) bits = rippleBits;
+  }
+  if (bits > 16.0f) bits = 16.0f;
+  if (bits < 0.0f) bits = 0.0f;
+  return bits;
+}
+
+float normalizeDegrees(float deg) {
+  deg = fmodf(deg, 360.0f);
+  if (deg < 0.0f) deg += 360.0f;
+  return deg;
+}
 } // namespace
 
-FuncGen::FuncGen(Logger *logger, ConfigStore *config)
-    : m_logger(logger), m_config(config), m_phase(0.0f), m_lastMicros(0),
-      m_disabledLogged(false), m_zeroFreqLogged(false),
-      m_lastEnabledState(false), m_lastDcLevelLogged(-1.0f),
-      m_lastOutputValue(-1.0f), m_lastLoggedOutput(-1.0f),
-      m_noTargetLogged(false) {
-  m_settings.type = SINE;
-  m_settings.freq = 0.0f;
-  m_settings.amp = 0.0f;
-  m_settings.offset = 0.5f;
-  m_settings.enabled = false;
-  m_settings.targetId = F("DAC0");
-
-  m_target.driver = DRIVER_NONE;
-  m_target.id = F("");
-  m_target.gpio = 0xFF;
-  m_target.pwmFreq = 0;
-  m_target.mcpAddress = 0x60;
-  m_target.available = false;
+FuncGen::FuncGen(Logger *logger, ConfigStore *config, OutputRegistry *outputs,
+                 IORegistry *io)
+    : m_logger(logger), m_config(config), m_outputs(outputs), m_io(io),
+      m_files(nullptr), m_tester(nullptr), m_outputsGeneration(0),
+      m_channelCount(1), m_lastMicros(0), m_tickDeltaUs(0), m_lastTickUs(0),
+      m_maxTickUs(0),
+      m_ditherRunning(false), m_persistDirty(false), m_persistFirstMs(0),
+      m_persistLastMs(0), m_persistDeferred(0), m_persistWrites(0) {
+  for (size_t i = 0; i < kMaxChannels; ++i) {
+    resetChannel(m_channels[i]);
+  }
+  m_channels[0].settings.targetId = F("DAC0");
+  m_cal.active = false;
+  m_cal.channel = -1;
+  m_cal.step = 0;
+  m_cal.state = "idle";
+  m_cal.nonlinearityPct = 0.0f;
+}
+
+void FuncGen::resetChannel(Channel &ch) {
+  ch.settings.type = SINE;
+  ch.settings.freq = 0.0f;
+  ch.settings.amp = 0.0f;
+  ch.settings.offset = 0.5f;
+  ch.settings.enabled = false;
+  ch.settings.targetId = F("");
+  ch.settings.phaseDeg = 0.0f;
+  ch.settings.lockTo = -1;
+  ch.settings.dither = 0;
+  ch.settings.mode = MODE_CONTINUOUS;
+  ch.settings.burstCycles = 1;
+  ch.settings.trigSource = TRIG_MANUAL;
+  ch.settings.trigInput = F("");
+  ch.settings.trigPin = F("");
+  ch.settings.trigLevel = 0.0f;
+  ch.settings.trigHyst = 0.0f;
+  ch.settings.trigFalling = false;
+  ch.settings.trigPollMs = 10;
+  ch.settings.slewPctPerS = 0.0f;
+  ch.ramp.active = false;
+  ch.slewQ24 = -1;
+  ch.slewPerKus = 0;
+
+  ch.target.handle = OutputRegistry::kInvalidHandle;
+  ch.target.driver = OutputRegistry::DRIVER_NONE;
+  ch.target.id = F("");
+  ch.target.gpio = 0xFF;
+  ch.target.pwmFreq = 0;
+  ch.target.mcpAddress = 0x60;
+  ch.target.available = false;
+  ch.target.rcCutoffHz = 0.0f;
+  ch.target.lut = nullptr;
+
+  ch.phase = 0.0f;
+  ch.samplePhase = 0.0f;
+  ch.disabledLogged = false;
+  ch.zeroFreqLogged = false;
+  ch.lastEnabledState = false;
+  ch.lastDcLevelLogged = -1.0f;
+  ch.lastOutputValue = -1.0f;
+  ch.lastLoggedOutput = -1.0f;
+  ch.noTargetLogged = false;
+  ch.cpu.lastUs = 0;
+  ch.cpu.maxUs = 0;
+  ch.cpu.avgUs = 0.0f;
+  ch.ditherTarget = 0;
+  ch.sdErr1 = 0;
+  ch.sdErr2 = 0;
+  ch.lastPwmCode = 0xFFFF;
+  ch.ditherWrites = 0;
+
+  resetTiming(ch.timing);
+
+  TriggerState &t = ch.trig;
+  t.isrEdges = 0;
+  t.isrUs = 0;
+  t.seenEdges = 0;
+  t.gpio = 0xFF;
+  t.inputHigh = false;
+  t.inputPrimed = false;
+  t.lastPollMs = 0;
+  t.gate = false;
+  t.restart = false;
+  t.burstActive = false;
+  t.cyclesLeft = 0;
+  t.measuring = false;
+  t.atUs = 0;
+  t.count = 0;
+  t.completed = 0;
+  t.late = 0;
+  t.lastLatencyUs = 0;
+  t.minLatencyUs = UINT32_MAX;
+  t.maxLatencyUs = 0;
+  t.lastSource = "";
 }
 
 void FuncGen::begin() {
   // Initialise the DAC with the default address. The actual address can
   // be overridden by the selected target configuration when
   // resolveTargetBinding() runs.
-  m_dac.begin(0x60);
+  m_channels[0].dac.begin(0x60);
   // Load initial settings from funcgen.json
   loadFromConfig();
-  resolveTargetBinding();
+  if (m_outputs) {
+    m_outputsGeneration = m_outputs->generation();
+  }
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    resolveTargetBinding(i);
+  }
   // Set initial lastMicros to current time
   m_lastMicros = micros();
-  m_disabledLogged = false;
-  m_zeroFreqLogged = false;
-  m_lastEnabledState = m_settings.enabled;
-  m_lastDcLevelLogged = -1.0f;
-  m_lastOutputValue = -1.0f;
-  m_lastLoggedOutput = -1.0f;
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    Channel &ch = m_channels[i];
+    ch.disabledLogged = false;
+    ch.zeroFreqLogged = false;
+    ch.lastEnabledState = ch.settings.enabled;
+    ch.lastDcLevelLogged = -1.0f;
+    ch.lastOutputValue = -1.0f;
+    ch.lastLoggedOutput = -1.0f;
+    ch.slewPerKus = slewRateToQ24(ch.settings.slewPctPerS);
+    armTrigger(i);
+  }
+  updateDitherTimer();
+}
+
+void FuncGen::loadChannelSettings(JsonObjectConst obj, Settings &settings) {
+  const char *typeStr = obj["type"] | "sine";
+  parseWaveform(typeStr, settings.type);
+  settings.freq = obj["freq"] | 0.0f;
+  float amp_pct = obj["amp_pct"] | 0.0f;
+  float offset_pct = obj["offset_pct"] | 50.0f;
+  settings.amp = amp_pct / 100.0f;
+  settings.offset = offset_pct / 100.0f;
+  settings.enabled = obj["enabled"] | false;
+  const char *target = obj["target"] | "";
+  if (target && target[0]) {
+    settings.targetId = String(target);
+  }
+  settings.phaseDeg = normalizeDegrees(obj["phase_deg"] | 0.0f);
+  settings.lockTo = obj["lock"] | -1;
+  settings.dither = parseDither(obj["dither"]);
+  settings.slewPctPerS = obj["slew_pct_s"] | 0.0f;
+  settings.mode = parseRunMode(obj["mode"] | "continuous");
+  settings.burstCycles = obj["burst_cycles"] | 1;
+  if (settings.burstCycles == 0) settings.burstCycles = 1;
+  JsonObjectConst trig = obj["trigger"];
+  if (!trig.isNull()) {
+    loadTriggerSettings(trig, settings);
+  }
+}
+
+void FuncGen::loadTriggerSettings(JsonObjectConst trig, Settings &settings) {
+  if (trig.containsKey("source")) {
+    settings.trigSource = parseTriggerSource(trig["source"] | "manual");
+  }
+  if (trig["input"].is<const char *>()) {
+    settings.trigInput = String(trig["input"].as<const char *>());
+  }
+  if (trig["gpio"].is<const char *>()) {
+    settings.trigPin = String(trig["gpio"].as<const char *>());
+  } else if (trig["gpio"].is<int>()) {
+    settings.trigPin = String(trig["gpio"].as<int>());
+  }
+  if (trig.containsKey("level")) {
+    settings.trigLevel = trig["level"].as<float>();
+  }
+  if (trig.containsKey("hyst")) {
+    settings.trigHyst = fabsf(trig["hyst"].as<float>());
+  }
+  if (trig.containsKey("edge")) {
+    const char *edge = trig["edge"] | "rising";
+    settings.trigFalling = strcasecmp(edge, "falling") == 0;
+  }
+  if (trig.containsKey("poll_ms")) {
+    int poll = trig["poll_ms"] | 10;
+    if (poll < 1) poll = 1;
+    if (poll > 1000) poll = 1000;
+    settings.trigPollMs = (uint16_t)poll;
+  }
 }
 
 void FuncGen::loadFromConfig() {
@@ -69,296 +350,813 @@ void FuncGen::loadFromConfig() {
   if (!doc.is<JsonObject>()) {
     return;
   }
-  const char *typeStr = doc["type"] | "sine";
-  if (strcasecmp(typeStr, "sine") == 0) {
-    m_settings.type = SINE;
-  } else if (strcasecmp(typeStr, "square") == 0) {
-    m_settings.type = SQUARE;
-  } else if (strcasecmp(typeStr, "triangle") == 0) {
-    m_settings.type = TRIANGLE;
-  } else if (strcasecmp(typeStr, "dc") == 0) {
-    m_settings.type = DC;
+  // Multi-channel layout: a "channels" array. Older files only hold the
+  // top-level keys which describe channel 0.
+  JsonArrayConst channels = doc["channels"].as<JsonArrayConst>();
+  if (!channels.isNull() && channels.size() > 0) {
+    m_channelCount = 0;
+    for (JsonVariantConst v : channels) {
+      if (m_channelCount >= kMaxChannels) break;
+      Channel &ch = m_channels[m_channelCount];
+      resetChannel(ch);
+      if (m_channelCount == 0) {
+        ch.settings.targetId = F("DAC0");
+      }
+      if (v.is<JsonObjectConst>()) {
+        loadChannelSettings(v.as<JsonObjectConst>(), ch.settings);
+      }
+      m_channelCount++;
+    }
+  } else {
+    loadChannelSettings(doc.as<JsonObjectConst>(), m_channels[0].settings);
+    m_channelCount = 1;
+  }
+
+  // Only one level of locking is supported: a follower must point at a
+  // free-running channel.
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    Settings &s = m_channels[i].settings;
+    if (s.lockTo < 0) continue;
+    bool valid = (size_t)s.lockTo < m_channelCount && (size_t)s.lockTo != i &&
+                 m_channels[s.lockTo].settings.lockTo < 0;
+    if (!valid) {
+      if (m_logger) {
+        m_logger->warning(channelTag(i) + F(": verrouillage de phase invalide"));
+      }
+      s.lockTo = -1;
+    }
+  }
+}
+
+int FuncGen::findChannelByTarget(const String &targetId) const {
+  if (!targetId.length()) {
+    return -1;
   }
-  m_settings.freq = doc["freq"] | 0.0f;
-  float amp_pct = doc["amp_pct"] | 0.0f;
-  float offset_pct = doc["offset_pct"] | 50.0f;
-  m_settings.amp = amp_pct / 100.0f;
-  m_settings.offset = offset_pct / 100.0f;
-  m_settings.enabled = doc["enabled"] | false;
-  const char *target = doc["target"] | "DAC0";
-  if (target) {
-    m_settings.targetId = String(target);
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    if (m_channels[i].settings.targetId.equalsIgnoreCase(targetId)) {
+      return (int)i;
+    }
   }
+  return -1;
+}
+
+bool FuncGen::isOutputActive(const String &targetId) const {
+  int index = findChannelByTarget(targetId);
+  return index >= 0 && m_channels[index].settings.enabled;
+}
+
+bool FuncGen::usesGpio(uint8_t gpio) const {
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    const Channel &ch = m_channels[i];
+    if (ch.settings.enabled && ch.target.available &&
+        ch.target.driver == OutputRegistry::DRIVER_PWM &&
+        ch.target.gpio == gpio) {
+      return true;
+    }
+    if (ch.trig.gpio == gpio) {
+      return true;
+    }
+  }
+  return false;
 }
 
 void FuncGen::updateSettings(const JsonDocument &doc) {
   // Update internal settings from the provided document. Do minimal
   // validation to ensure values stay within [0,1].
   if (m_logger) {
-    String payload;
-    serializeJson(doc, payload);
-    m_logger->info(String(F("FuncGen updateSettings payload=")) + payload);
+    // Short and at debug level: Serial output blocks loop().
+    char payload[97];
+    serializeJson(doc, payload, sizeof(payload));
+    m_logger->debug(String(F("FuncGen updateSettings payload=")) + payload);
+  }
+
+  // Select the channel: explicit index, then the channel already bound
+  // to the requested target, then channel 0 (single-output behaviour).
+  int index = -1;
+  if (doc.containsKey("channel")) {
+    index = doc["channel"] | -1;
+    if (index < 0 || (size_t)index >= kMaxChannels) {
+      if (m_logger) {
+        m_logger->warning(String(F("FuncGen: canal invalide ")) +
+                          String(index));
+      }
+      return;
+    }
+  } else if (doc["target"].is<const char *>()) {
+    index = findChannelByTarget(String(doc["target"].as<const char *>()));
+  }
+  if (index < 0) {
+    index = 0;
+  }
+  while (m_channelCount <= (size_t)index) {
+    resetChannel(m_channels[m_channelCount++]);
+  }
+
+  if (doc["sync"] | false) {
+    for (size_t i = 0; i < m_channelCount; ++i) {
+      m_channels[i].phase = 0.0f;
+    }
   }
 
-  Settings old = m_settings;
+  Channel &ch = m_channels[index];
+  Settings &settings = ch.settings;
+  Settings old = settings;
   bool transitionToDisabled = false;
   if (doc.containsKey("type")) {
-    const char *typeStr = doc["type"].as<const char *>();
-    if (strcasecmp(typeStr, "sine") == 0) {
-      m_settings.type = SINE;
-    } else if (strcasecmp(typeStr, "square") == 0) {
-      m_settings.type = SQUARE;
-    } else if (strcasecmp(typeStr, "triangle") == 0) {
-      m_settings.type = TRIANGLE;
-    } else if (strcasecmp(typeStr, "dc") == 0) {
-      m_settings.type = DC;
-    }
+    parseWaveform(doc["type"].as<const char *>(), settings.type);
   }
   if (doc.containsKey("freq")) {
-    m_settings.freq = doc["freq"];
+    settings.freq = doc["freq"];
   }
   if (doc.containsKey("amp_pct")) {
     float pct = doc["amp_pct"];
     if (pct < 0) pct = 0; if (pct > 100) pct = 100;
-    m_settings.amp = pct / 100.0f;
+    settings.amp = pct / 100.0f;
   }
   if (doc.containsKey("offset_pct")) {
     float pct = doc["offset_pct"];
     if (pct < 0) pct = 0; if (pct > 100) pct = 100;
-    m_settings.offset = pct / 100.0f;
+    settings.offset = pct / 100.0f;
   }
   if (doc.containsKey("enabled")) {
     bool newEnabled = doc["enabled"];
     transitionToDisabled = old.enabled && !newEnabled;
-    m_settings.enabled = newEnabled;
+    settings.enabled = newEnabled;
   }
   if (doc.containsKey("target")) {
     const char *target = doc["target"].as<const char *>();
     if (target && target[0]) {
-      m_settings.targetId = String(target);
+      settings.targetId = String(target);
+    }
+  }
+  if (doc.containsKey("phase_deg")) {
+    settings.phaseDeg = normalizeDegrees(doc["phase_deg"].as<float>());
+  }
+  if (doc.containsKey("dither")) {
+    settings.dither = parseDither(doc["dither"]);
+  }
+  if (doc.containsKey("slew_pct_s")) {
+    float slew = doc["slew_pct_s"] | 0.0f;
+    if (slew < 0.0f) slew = 0.0f;
+    settings.slewPctPerS = slew;
+  }
+  if (doc.containsKey("amp_pct") || doc.containsKey("offset_pct")) {
+    // An explicit level wins over a ramp in progress.
+    ch.ramp.active = false;
+  }
+  if (doc.containsKey("mode")) {
+    settings.mode = parseRunMode(doc["mode"] | "continuous");
+  }
+  if (doc.containsKey("burst_cycles")) {
+    long cycles = doc["burst_cycles"] | 1L;
+    if (cycles < 1) cycles = 1;
+    if (cycles > 65535) cycles = 65535;
+    settings.burstCycles = (uint16_t)cycles;
+  }
+  JsonObjectConst trigObj = doc["trigger"];
+  if (!trigObj.isNull()) {
+    loadTriggerSettings(trigObj, settings);
+  }
+  if (doc.containsKey("lock")) {
+    int master = doc["lock"] | -1;
+    bool hasFollowers = false;
+    for (size_t i = 0; i < m_channelCount; ++i) {
+      if (i != (size_t)index && m_channels[i].settings.lockTo == index) {
+        hasFollowers = true;
+      }
+    }
+    if (master < 0) {
+      settings.lockTo = -1;
+    } else if ((size_t)master >= m_channelCount || master == index ||
+               m_channels[master].settings.lockTo >= 0 || hasFollowers) {
+      if (m_logger) {
+        m_logger->warning(channelTag(index) +
+                          F(": verrouillage refusé vers le canal ") +
+                          String(master));
+      }
+    } else {
+      settings.lockTo = (int8_t)master;
     }
   }
 
   if (m_logger) {
-    String summary = String(F("FuncGen settings => type="));
-    switch (m_settings.type) {
-    case SINE:
-      summary += F("sine");
-      break;
-    case SQUARE:
-      summary += F("square");
-      break;
-    case TRIANGLE:
-      summary += F("triangle");
-      break;
-    case DC:
-      summary += F("dc");
-      break;
-    }
+    String summary = channelTag(index) + F(" settings => type=");
+    summary += waveformName(settings.type);
     summary += F(", freq=");
-    summary += String(m_settings.freq, 3);
+    summary += String(settings.freq, 3);
     summary += F("Hz, amp=");
-    summary += String(m_settings.amp, 3);
+    summary += String(settings.amp, 3);
     summary += F(", offset=");
-    summary += String(m_settings.offset, 3);
+    summary += String(settings.offset, 3);
     summary += F(", enabled=");
-    summary += (m_settings.enabled ? F("true") : F("false"));
-    if (m_settings.targetId.length()) {
+    summary += (settings.enabled ? F("true") : F("false"));
+    if (settings.targetId.length()) {
       summary += F(", target=");
-      summary += m_settings.targetId;
+      summary += settings.targetId;
+    }
+    if (settings.lockTo >= 0) {
+      summary += F(", lock=");
+      summary += String(settings.lockTo);
+    }
+    if (settings.phaseDeg != 0.0f) {
+      summary += F(", phase=");
+      summary += String(settings.phaseDeg, 1);
+    }
+    if (settings.dither) {
+      summary += F(", dither=sd");
+      summary += String(settings.dither);
+    }
+    if (settings.mode != MODE_CONTINUOUS) {
+      summary += F(", mode=");
+      summary += runModeName(settings.mode);
+      summary += F(", trigger=");
+      summary += triggerSourceName(settings.trigSource);
     }
     m_logger->info(summary);
 
-    if (old.enabled && !m_settings.enabled) {
-      m_logger->warning(F("FuncGen disabled via update"));
-    } else if (!old.enabled && m_settings.enabled) {
-      m_logger->info(F("FuncGen enabled via update"));
+    if (old.enabled && !settings.enabled) {
+      m_logger->warning(channelTag(index) + F(" disabled via update"));
+    } else if (!old.enabled && settings.enabled) {
+      m_logger->info(channelTag(index) + F(" enabled via update"));
     }
   }
 
-  m_disabledLogged = false;
-  m_zeroFreqLogged = false;
-  if (!old.targetId.equalsIgnoreCase(m_settings.targetId)) {
-    resolveTargetBinding();
+  ch.disabledLogged = false;
+  ch.zeroFreqLogged = false;
+  if (!old.targetId.equalsIgnoreCase(settings.targetId) ||
+      !ch.target.available) {
+    resolveTargetBinding(index);
   }
-  if (!m_settings.enabled) {
-    m_phase = 0.0f;
-    if (transitionToDisabled || m_lastOutputValue > 0.0005f ||
-        m_lastOutputValue < 0.0f) {
-      ensureOutputDisabled();
+  if (settings.enabled && !old.enabled && m_tester && ch.target.available &&
+      m_tester->busy(ch.target.driver, ch.target.gpio,
+                     ch.target.mcpAddress)) {
+    settings.enabled = false;
+    if (m_logger) {
+      m_logger->warning(channelTag(index) +
+                        F(": sortie occupée par un test, canal non activé"));
     }
   }
-  // Persist settings to funcgen.json
-  JsonDocument &cfg = m_config->getConfig("funcgen");
-  const char *typeName = "sine";
-  switch (m_settings.type) {
-  case SINE:
-    typeName = "sine";
-    break;
-  case SQUARE:
-    typeName = "square";
-    break;
-  case TRIANGLE:
-    typeName = "triangle";
-    break;
-  case DC:
-    typeName = "dc";
-    break;
+  ch.slewPerKus = slewRateToQ24(settings.slewPctPerS);
+  if (!settings.enabled) {
+    ch.phase = 0.0f;
+    ch.ramp.active = false;
+    // With a slew limit the loop ramps the output down first.
+    bool rampDown = ch.slewPerKus && ch.slewQ24 > 0;
+    if (!rampDown && (transitionToDisabled || ch.lastOutputValue > 0.0005f ||
+                      ch.lastOutputValue < 0.0f)) {
+      ensureOutputDisabled(ch);
+    }
+  }
+  if (settings.dither != old.dither) {
+    ch.sdErr1 = 0;
+    ch.sdErr2 = 0;
+    ch.lastPwmCode = 0xFFFF;
+    // Re-emit the current level through the newly selected path.
+    ch.lastOutputValue = -1.0f;
+  }
+  if (settings.mode != old.mode || !trigObj.isNull()) {
+    // New trigger setup: drop any burst in progress and rearm.
+    ch.trig.burstActive = false;
+    ch.trig.gate = false;
+    ch.trig.restart = false;
+    ch.trig.measuring = false;
+    ch.trig.inputPrimed = false;
+    if (settings.mode != MODE_CONTINUOUS) {
+      ch.phase = 0.0f;
+    }
+    armTrigger(index);
+  }
+  updateDitherTimer();
+  persistSettings();
+}
+
+void FuncGen::writeChannelSettings(const Settings &settings,
+                                   JsonObject obj) const {
+  obj["type"] = waveformName(settings.type);
+  obj["freq"] = settings.freq;
+  obj["amp_pct"] = (int)(settings.amp * 100);
+  obj["offset_pct"] = (int)(settings.offset * 100);
+  obj["enabled"] = settings.enabled;
+  if (settings.targetId.length()) {
+    obj["target"] = settings.targetId;
+  }
+  if (settings.phaseDeg != 0.0f) {
+    obj["phase_deg"] = settings.phaseDeg;
+  }
+  if (settings.lockTo >= 0) {
+    obj["lock"] = settings.lockTo;
+  }
+  if (settings.dither) {
+    obj["dither"] = settings.dither;
   }
-  cfg["type"] = typeName;
-  cfg["freq"] = m_settings.freq;
-  cfg["amp_pct"] = (int)(m_settings.amp * 100);
-  cfg["offset_pct"] = (int)(m_settings.offset * 100);
-  cfg["enabled"] = m_settings.enabled;
-  if (m_settings.targetId.length()) {
-    cfg["target"] = m_settings.targetId;
+  if (settings.slewPctPerS > 0.0f) {
+    obj["slew_pct_s"] = settings.slewPctPerS;
+  }
+  if (settings.mode != MODE_CONTINUOUS ||
+      settings.trigSource != TRIG_MANUAL) {
+    obj["mode"] = runModeName(settings.mode);
+    obj["burst_cycles"] = settings.burstCycles;
+    JsonObject trig = obj.createNestedObject("trigger");
+    trig["source"] = triggerSourceName(settings.trigSource);
+    if (settings.trigInput.length()) {
+      trig["input"] = settings.trigInput;
+    }
+    if (settings.trigPin.length()) {
+      trig["gpio"] = settings.trigPin;
+    }
+    trig["level"] = settings.trigLevel;
+    trig["hyst"] = settings.trigHyst;
+    trig["edge"] = settings.trigFalling ? "falling" : "rising";
+    trig["poll_ms"] = settings.trigPollMs;
+  }
+}
+
+void FuncGen::persistSettings() {
+  // Sliders in the web UI post many updates per second. Only remember
+  // that something changed; loop() saves once the values settle.
+  unsigned long now = millis();
+  if (m_persistDirty) {
+    m_persistDeferred++;
   } else {
-    cfg.remove("target");
+    m_persistFirstMs = now;
+  }
+  m_persistDirty = true;
+  m_persistLastMs = now;
+}
+
+void FuncGen::flushSettings() {
+  m_persistDirty = false;
+  m_persistWrites++;
+  // Build a fresh document instead of editing the stored one in place:
+  // overwriting strings inside a StaticJsonDocument does not release
+  // the previous copies, so repeated updates would exhaust its pool.
+  DynamicJsonDocument cfg(1536);
+  JsonObject root = cfg.to<JsonObject>();
+  // Channel 0 stays mirrored at the top level for pages that read
+  // funcgen.json directly.
+  writeChannelSettings(m_channels[0].settings, root);
+  JsonArray arr = root.createNestedArray("channels");
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    writeChannelSettings(m_channels[i].settings, arr.createNestedObject());
+  }
+  if (!m_files) {
+    m_config->updateConfig("funcgen", cfg);
+    return;
   }
-  m_config->updateConfig("funcgen", cfg);
+  // Keep the in-memory copy current and hand the file write to the
+  // background queue, which also merges it with an unsent older copy.
+  JsonDocument &stored = m_config->getConfig("funcgen");
+  stored.clear();
+  stored.set(cfg);
+  m_config->touch(F("funcgen"));
+  String out;
+  serializeJson(cfg, out);
+  m_files->enqueue(F("/funcgen.json"), out);
 }
 
-void FuncGen::snapshotStatus(JsonObject obj) const {
+void FuncGen::snapshotStatus(JsonObject obj) const { snapshotStatus(obj, 0); }
+
+void FuncGen::snapshotStatus(JsonObject obj, int channel) const {
   if (!obj) {
     return;
   }
+  if (channel < 0 || (size_t)channel >= m_channelCount) {
+    channel = 0;
+  }
 
-  const char *typeName = waveformName(m_settings.type);
-  obj["type"] = typeName;
-  obj["waveform"] = typeName;
-  obj["freq"] = m_settings.freq;
-  obj["amp_pct"] = (int)roundf(m_settings.amp * 100.0f);
-  obj["offset_pct"] = (int)roundf(m_settings.offset * 100.0f);
-  obj["amp_fraction"] = m_settings.amp;
-  obj["offset_fraction"] = m_settings.offset;
-  obj["enabled"] = m_settings.enabled;
+  obj["channel"] = channel;
   obj["timestamp_ms"] = (uint32_t)millis();
-  if (m_settings.targetId.length()) {
-    obj["target"] = m_settings.targetId;
+  obj["channel_count"] = m_channelCount;
+  obj["max_channels"] = (uint32_t)kMaxChannels;
+  obj["tick_us"] = m_lastTickUs;
+  obj["tick_max_us"] = m_maxTickUs;
+
+  JsonArray edges = obj.createNestedArray("interval_buckets_us");
+  for (size_t i = 0; i + 1 < kIntervalBuckets; ++i) {
+    edges.add(kIntervalBucketUs << i);
+  }
+
+  JsonObject cal = obj.createNestedObject("calibration");
+  cal["state"] = m_cal.state;
+  if (m_cal.channel >= 0) {
+    cal["channel"] = m_cal.channel;
+    cal["input"] = m_cal.input;
+    cal["step"] = m_cal.step;
+    cal["steps"] = (uint32_t)kCalSteps;
+    cal["settle_ms"] = m_cal.settleMs;
+  }
+  if (m_cal.error.length()) {
+    cal["error"] = m_cal.error;
+  }
+  if (strcmp(m_cal.state, "done") == 0) {
+    cal["nonlinearity_pct"] = m_cal.nonlinearityPct;
+  }
+
+  JsonObject persist = obj.createNestedObject("persist");
+  persist["pending"] = m_persistDirty;
+  persist["deferred"] = m_persistDeferred;
+  persist["writes"] = m_persistWrites;
+  if (m_persistDirty) {
+    uint32_t quiet = (uint32_t)(millis() - m_persistLastMs);
+    persist["due_in_ms"] =
+        quiet < kPersistDebounceMs ? kPersistDebounceMs - quiet : 0;
+  }
+
+  JsonArray arr = obj.createNestedArray("channels");
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    describeChannel(i, arr.createNestedObject());
+  }
+}
+
+void FuncGen::describeChannel(size_t index, JsonObject obj) const {
+  const Channel &ch = m_channels[index];
+  const Settings &settings = ch.settings;
+  const char *typeName = waveformName(settings.type);
+  obj["channel"] = index;
+  obj["type"] = typeName;
+  obj["freq"] = settings.freq;
+  obj["amp_pct"] = (int)roundf(settings.amp * 100.0f);
+  obj["offset_pct"] = (int)roundf(settings.offset * 100.0f);
+  obj["amp_fraction"] = settings.amp;
+  obj["offset_fraction"] = settings.offset;
+  obj["enabled"] = settings.enabled;
+  obj["phase_deg"] = settings.phaseDeg;
+  obj["lock"] = settings.lockTo;
+  obj["dither"] = settings.dither;
+  obj["mode"] = runModeName(settings.mode);
+  obj["burst_cycles"] = settings.burstCycles;
+  obj["slew_pct_s"] = settings.slewPctPerS;
+  // The limit applies to DC levels and to resting levels only.
+  obj["slew_active"] = ch.slewPerKus != 0 &&
+                       (settings.type == DC || !isRunning(ch));
+  if (ch.ramp.active) {
+    const Ramp &ramp = ch.ramp;
+    JsonObject r = obj.createNestedObject("ramp");
+    r["target"] = ramp.onOffset ? "offset" : "level";
+    r["from_pct"] = ramp.fromQ24 * 100.0f / kQ24;
+    r["to_pct"] = ramp.toQ24 * 100.0f / kQ24;
+    r["shape"] = ramp.sCurve ? "scurve" : "linear";
+    r["duration_ms"] = ramp.durationUs / 1000;
+    r["progress_pct"] = ramp.elapsedUs * 100.0f / ramp.durationUs;
+  }
+  if (settings.targetId.length()) {
+    obj["target"] = settings.targetId;
   }
 
-  JsonObject hw = obj["hardware"].isNull() ? obj.createNestedObject("hardware")
-                                            : obj["hardware"].as<JsonObject>();
+  JsonObject hw = obj.createNestedObject("hardware");
   const char *driverStr = "none";
-  switch (m_target.driver) {
-  case DRIVER_MCP4725:
+  switch (ch.target.driver) {
+  case OutputRegistry::DRIVER_MCP4725:
     driverStr = "mcp4725";
     break;
-  case DRIVER_PWM:
+  case OutputRegistry::DRIVER_PWM:
     driverStr = "pwm";
     break;
-  case DRIVER_NONE:
+  case OutputRegistry::DRIVER_NONE:
   default:
     driverStr = "none";
     break;
   }
   hw["driver"] = driverStr;
-  hw["available"] = m_target.available;
-  if (m_target.id.length()) {
-    hw["id"] = m_target.id;
-  }
-  if (m_target.driver == DRIVER_PWM) {
-    hw["gpio"] = m_target.gpio;
-    hw["pwm_freq"] = m_target.pwmFreq;
-  } else if (m_target.driver == DRIVER_MCP4725) {
+  hw["available"] = ch.target.available;
+  if (ch.target.id.length()) {
+    hw["id"] = ch.target.id;
+  }
+  hw["calibrated"] = ch.target.lut != nullptr;
+  hw["handle"] = ch.target.handle;
+  if (ch.target.driver == OutputRegistry::DRIVER_PWM) {
+    hw["gpio"] = ch.target.gpio;
+    hw["pwm_freq"] = ch.target.pwmFreq;
+    JsonObject dither = hw.createNestedObject("dither");
+    dither["order"] = settings.dither;
+    dither["active"] = isDithered(ch);
+    dither["rate_hz"] = ditherRateHz(ch.target.pwmFreq);
+    if (ch.target.rcCutoffHz > 0.0f) {
+      dither["rc_cutoff_hz"] = ch.target.rcCutoffHz;
+    }
+    dither["effective_bits"] =
+        estimateDitherBits(settings.dither, ch.target.rcCutoffHz,
+                           ch.target.pwmFreq);
+    dither["writes"] = ch.ditherWrites;
+  } else if (ch.target.driver == OutputRegistry::DRIVER_MCP4725) {
     char buf[8];
-    snprintf(buf, sizeof(buf), "0x%02X", m_target.mcpAddress);
+    snprintf(buf, sizeof(buf), "0x%02X", ch.target.mcpAddress);
     hw["address"] = buf;
   }
-  if (m_lastOutputValue >= 0.0f) {
-    hw["last_output_fraction"] = m_lastOutputValue;
-    hw["last_output_pct"] = m_lastOutputValue * 100.0f;
+  if (ch.lastOutputValue >= 0.0f) {
+    hw["last_output_fraction"] = ch.lastOutputValue;
+    hw["last_output_pct"] = ch.lastOutputValue * 100.0f;
+  }
+
+  const TriggerState &t = ch.trig;
+  JsonObject trig = obj.createNestedObject("trigger");
+  trig["source"] = triggerSourceName(settings.trigSource);
+  if (settings.trigSource == TRIG_INPUT) {
+    trig["input"] = settings.trigInput;
+    trig["level"] = settings.trigLevel;
+    trig["hyst"] = settings.trigHyst;
+    trig["poll_ms"] = settings.trigPollMs;
+  } else if (settings.trigSource == TRIG_GPIO) {
+    trig["gpio"] = settings.trigPin;
+    trig["armed"] = t.gpio != 0xFF;
+  }
+  trig["edge"] = settings.trigFalling ? "falling" : "rising";
+  trig["running"] = isRunning(ch);
+  trig["gate"] = t.gate;
+  trig["cycles_left"] = t.cyclesLeft;
+  trig["count"] = t.count;
+  trig["completed"] = t.completed;
+  trig["last_source"] = t.lastSource;
+  JsonObject latency = trig.createNestedObject("latency_us");
+  latency["last"] = t.lastLatencyUs;
+  if (t.minLatencyUs != UINT32_MAX) {
+    latency["min"] = t.minLatencyUs;
   }
+  latency["max"] = t.maxLatencyUs;
+  latency["budget"] = (uint32_t)kTriggerBudgetUs;
+  latency["late"] = t.late;
+
+  JsonObject cpu = obj.createNestedObject("cpu");
+  cpu["last_us"] = ch.cpu.lastUs;
+  cpu["avg_us"] = ch.cpu.avgUs;
+  cpu["max_us"] = ch.cpu.maxUs;
 
-  bool freqValid = m_settings.freq > 0.0f || m_settings.type == DC;
+  float freq = settings.freq;
+  if (isLocked(ch)) {
+    freq = m_channels[settings.lockTo].settings.freq;
+  }
+  bool freqValid = freq > 0.0f || settings.type == DC;
   obj["freq_valid"] = freqValid;
 
+  const TimingStats &tm = ch.timing;
+  JsonObject timing = obj.createNestedObject("timing");
+  timing["intervals"] = tm.intervals;
+  if (tm.intervals > 0) {
+    JsonObject interval = timing.createNestedObject("interval_us");
+    interval["min"] = tm.intervalMinUs;
+    interval["mean"] = tm.intervalMeanUs;
+    interval["max"] = tm.intervalMaxUs;
+    // Jitter is the standard deviation of the sample interval.
+    interval["jitter"] =
+        tm.intervals > 1 ? sqrtf(tm.intervalM2 / (float)(tm.intervals - 1))
+                         : 0.0f;
+    if (freq > 0.0f && settings.type != DC && tm.intervalMeanUs > 0.0f) {
+      timing["samples_per_period"] =
+          1000000.0f / (freq * tm.intervalMeanUs);
+    }
+  }
+  JsonArray hist = timing.createNestedArray("histogram");
+  for (size_t i = 0; i < kIntervalBuckets; ++i) {
+    hist.add(tm.histogram[i]);
+  }
+  timing["writes"] = tm.writes;
+  timing["dedupe_skips"] = tm.dedupeSkips;
+  JsonObject write = timing.createNestedObject(
+      ch.target.driver == OutputRegistry::DRIVER_MCP4725 ? "i2c_write_us"
+                                                         : "write_us");
+  write["last"] = tm.writeLastUs;
+  write["avg"] = tm.writeAvgUs;
+  write["max"] = tm.writeMaxUs;
+
   String summary;
   summary.reserve(80);
-  summary += m_settings.enabled ? F("Sortie active") : F("Sortie inactive");
-  if (m_settings.targetId.length()) {
+  summary += settings.enabled ? F("Sortie active") : F("Sortie inactive");
+  if (settings.targetId.length()) {
     summary += F(" (");
-    summary += m_settings.targetId;
+    summary += settings.targetId;
     summary += F(")");
   }
-  if (m_target.available) {
+  if (ch.target.available) {
     summary += F(" via ");
     summary += driverStr;
   } else {
     summary += F(" — cible indisponible");
   }
+  if (isLocked(ch)) {
+    summary += F(", verrouillée sur canal ");
+    summary += String(settings.lockTo);
+  }
   obj["summary"] = summary;
-  obj["message"] = summary;
+}
+
+bool FuncGen::isLocked(const Channel &ch) const {
+  return ch.settings.lockTo >= 0 &&
+         (size_t)ch.settings.lockTo < m_channelCount;
 }
 
 void FuncGen::loop() {
-  if (m_lastEnabledState != m_settings.enabled) {
+  // One shared tick drives every channel so that phase-locked outputs
+  // see exactly the same elapsed time.
+  unsigned long tickStart = micros();
+  unsigned long delta = tickStart - m_lastMicros;
+  m_lastMicros = tickStart;
+  m_tickDeltaUs = (uint32_t)delta;
+
+  // outputs.json was edited: cached handles may point elsewhere now.
+  if (m_outputs) {
+    m_outputs->refresh();
+    if (m_outputs->generation() != m_outputsGeneration) {
+      m_outputsGeneration = m_outputs->generation();
+      if (m_cal.active) {
+        stopCalibration("failed", F("outputs.json modifié"));
+      }
+      for (size_t i = 0; i < m_channelCount; ++i) {
+        Channel &ch = m_channels[i];
+        if (ch.target.available) {
+          ensureOutputDisabled(ch);
+        }
+        ch.target.available = false;
+      }
+      for (size_t i = 0; i < m_channelCount; ++i) {
+        resolveTargetBinding(i);
+        armTrigger(i);
+      }
+    }
+  }
+
+  pollTriggers();
+  advanceRamps((uint32_t)delta);
+  advancePhases(delta);
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    if (m_cal.active && (int)i == m_cal.channel) {
+      continue;
+    }
+    unsigned long start = micros();
+    updateChannel(i);
+    uint32_t cost = (uint32_t)(micros() - start);
+    TriggerState &t = m_channels[i].trig;
+    if (t.measuring && isRunning(m_channels[i])) {
+      // First sample of the burst (or gate opening) has been written.
+      uint32_t latency = (uint32_t)(micros() - t.atUs);
+      t.measuring = false;
+      t.lastLatencyUs = latency;
+      if (latency < t.minLatencyUs) t.minLatencyUs = latency;
+      if (latency > t.maxLatencyUs) t.maxLatencyUs = latency;
+      if (latency > kTriggerBudgetUs) t.late++;
+    }
+    CpuStats &cpu = m_channels[i].cpu;
+    cpu.lastUs = cost;
+    if (cost > cpu.maxUs) cpu.maxUs = cost;
+    // Exponential moving average over roughly 16 ticks.
+    cpu.avgUs += ((float)cost - cpu.avgUs) / 16.0f;
+  }
+  if (m_cal.active) {
+    calibrationStep();
+  }
+  m_lastTickUs = (uint32_t)(micros() - tickStart);
+  if (m_lastTickUs > m_maxTickUs) m_maxTickUs = m_lastTickUs;
+
+  if (m_persistDirty) {
+    unsigned long now = millis();
+    if (now - m_persistLastMs >= kPersistDebounceMs ||
+        now - m_persistFirstMs >= kPersistMaxDelayMs) {
+      flushSettings();
+    }
+  }
+}
+
+void FuncGen::advancePhases(unsigned long deltaUs) {
+  // A master keeps running while one of its followers is enabled, even
+  // if its own output is off.
+  bool drivesFollower[kMaxChannels] = {false};
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    const Channel &ch = m_channels[i];
+    if (isLocked(ch) && ch.settings.enabled) {
+      drivesFollower[ch.settings.lockTo] = true;
+    }
+  }
+
+  // Free-running channels first so that followers can read the sample
+  // phase of their master computed for this tick.
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    Channel &ch = m_channels[i];
+    if (isLocked(ch)) continue;
+    const Settings &s = ch.settings;
+    if (ch.trig.restart) {
+      // A trigger restarts the waveform at phase 0 on this tick.
+      ch.trig.restart = false;
+      ch.phase = 0.0f;
+    } else if ((s.enabled || drivesFollower[i]) && s.type != DC &&
+               s.freq > 0.0f && isRunning(ch)) {
+      // Update phase based on elapsed microseconds. Phase wraps around
+      // 0..1.
+      float next = ch.phase + (float)deltaUs * s.freq / 1000000.0f;
+      if (next >= 1.0f && s.mode == MODE_BURST) {
+        uint32_t wraps = (uint32_t)next;
+        if (wraps >= ch.trig.cyclesLeft) {
+          ch.trig.cyclesLeft = 0;
+          ch.trig.burstActive = false;
+          ch.trig.completed++;
+          next = 0.0f;
+        } else {
+          ch.trig.cyclesLeft -= wraps;
+        }
+      } else if (next >= 1.0f && s.mode == MODE_GATED && !ch.trig.gate) {
+        // Gate closed: stop at the end of the current period.
+        next = 0.0f;
+      }
+      ch.phase = wrapPhase(next);
+    }
+    ch.samplePhase = wrapPhase(ch.phase + s.phaseDeg / 360.0f);
+  }
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    Channel &ch = m_channels[i];
+    if (!isLocked(ch)) continue;
+    const Channel &master = m_channels[ch.settings.lockTo];
+    ch.samplePhase =
+        wrapPhase(master.samplePhase + ch.settings.phaseDeg / 360.0f);
+  }
+}
+
+void FuncGen::updateChannel(size_t index) {
+  Channel &ch = m_channels[index];
+  const Settings &settings = ch.settings;
+  if (ch.lastEnabledState != settings.enabled) {
     if (m_logger) {
-      m_logger->info(String(F("FuncGen loop sees enabled=")) +
-                     (m_settings.enabled ? F("true") : F("false")));
+      m_logger->info(channelTag(index) + F(" loop sees enabled=") +
+                     (settings.enabled ? F("true") : F("false")));
     }
-    m_lastEnabledState = m_settings.enabled;
-    if (!m_settings.enabled) {
-      m_lastDcLevelLogged = -1.0f;
-      ensureOutputDisabled();
+    ch.lastEnabledState = settings.enabled;
+    if (!settings.enabled) {
+      ch.lastDcLevelLogged = -1.0f;
+      if (!ch.slewPerKus) {
+        ensureOutputDisabled(ch);
+      }
+    }
+  }
+  if (!settings.enabled && ch.slewPerKus && ch.slewQ24 > 0 &&
+      ch.target.available) {
+    // Slew down to zero before releasing the output.
+    writeLimited(ch, 0.0f);
+    if (ch.slewQ24 == 0) {
+      ensureOutputDisabled(ch);
     }
+    return;
   }
-  if (!m_settings.enabled) {
-    if (m_logger && !m_disabledLogged) {
-      m_logger->debug(F("FuncGen loop skipped: generator disabled"));
-      m_disabledLogged = true;
+  if (!settings.enabled) {
+    if (m_logger && !ch.disabledLogged) {
+      m_logger->debug(channelTag(index) +
+                      F(" loop skipped: generator disabled"));
+      ch.disabledLogged = true;
     }
+    // The next enabled sample must not count the disabled gap.
+    ch.timing.haveLast = false;
     return;
   }
-  m_disabledLogged = false;
-  // Compute elapsed time since last call
-  unsigned long now = micros();
-  unsigned long delta = now - m_lastMicros;
-  m_lastMicros = now;
+  recordInterval(ch.timing, (uint32_t)micros());
+  ch.disabledLogged = false;
 
-  if (m_settings.type == DC) {
-    m_zeroFreqLogged = false;
-    float value = m_settings.amp;
+  if (settings.type == DC) {
+    ch.zeroFreqLogged = false;
+    float value = settings.amp;
     if (value < 0.0f) value = 0.0f;
     if (value > 1.0f) value = 1.0f;
     if (m_logger) {
-      if (m_lastDcLevelLogged < 0.0f ||
-          fabsf(m_lastDcLevelLogged - value) >= 0.01f) {
-        m_logger->info(String(F("FuncGen DC level => ")) +
+      if (ch.lastDcLevelLogged < 0.0f ||
+          fabsf(ch.lastDcLevelLogged - value) >= 0.01f) {
+        m_logger->info(channelTag(index) + F(" DC level => ") +
                        String(value * 100.0f, 1) + F("% de l'échelle"));
-        m_lastDcLevelLogged = value;
+        ch.lastDcLevelLogged = value;
       }
     }
-    writeOutput(value);
+    writeLimited(ch, value);
     return;
   }
 
-  // If frequency is zero nothing to generate
-  if (m_settings.freq <= 0.0f) {
-    if (m_logger && !m_zeroFreqLogged) {
-      m_logger->warning(F("FuncGen loop skipped: frequency <= 0"));
-      m_zeroFreqLogged = true;
+  // If frequency is zero nothing to generate. Followers run at the
+  // frequency of their master.
+  float freq = isLocked(ch) ? m_channels[settings.lockTo].settings.freq
+                            : settings.freq;
+  if (freq <= 0.0f) {
+    if (m_logger && !ch.zeroFreqLogged) {
+      m_logger->warning(channelTag(index) +
+                        F(" loop skipped: frequency <= 0"));
+      ch.zeroFreqLogged = true;
     }
     return;
   }
-  m_zeroFreqLogged = false;
-  // Update phase based on elapsed microseconds. Phase wraps around
-  // 0..1.
-  float inc = (float)delta * m_settings.freq / 1000000.0f;
-  m_phase += inc;
-  if (m_phase >= 1.0f) m_phase -= 1.0f;
+  ch.zeroFreqLogged = false;
   // Compute waveform sample in range [0,1]
-  float sample = waveformSample(m_phase);
-  // Apply amplitude and offset: final = offset + amp * sample
-  float value = m_settings.offset + m_settings.amp * sample;
+  float sample = waveformSample(settings.type, ch.samplePhase);
+  // Apply amplitude and offset: final = offset + amp * sample. Between
+  // triggers a burst/gated channel rests at phase 0, so it holds the
+  // level its next burst starts from and its last one ended on.
+  float value = settings.offset + settings.amp * sample;
   // Clamp to [0,1]
   if (value < 0.0f) value = 0.0f;
   if (value > 1.0f) value = 1.0f;
-  writeOutput(value);
+  if (!isRunning(ch)) {
+    writeLimited(ch, value);
+    return;
+  }
+  // Limiting the waveform itself would distort it: only its resting
+  // level is limited, but the limiter keeps track of the output.
+  ch.slewQ24 = (int32_t)(value * kQ24);
+  writeOutput(ch, value);
 }
 
-float FuncGen::waveformSample(float phase) {
-  switch (m_settings.type) {
+float FuncGen::waveformSample(Waveform type, float phase) {
+  switch (type) {
   case SINE:
     return 0.5f * (1.0f + sinf(2.0f * PI * phase));
   case SQUARE:
@@ -376,241 +1174,194 @@ float FuncGen::waveformSample(float phase) {
   }
 }
 
-void FuncGen::resolveTargetBinding() {
-  m_target.driver = DRIVER_NONE;
-  m_target.available = false;
-  m_target.id = m_settings.targetId;
-  m_target.gpio = 0xFF;
-  m_target.pwmFreq = 0;
-  m_target.mcpAddress = 0x60;
-  m_noTargetLogged = false;
-  m_lastOutputValue = -1.0f;
-  m_lastLoggedOutput = -1.0f;
-
-  if (!m_config) {
-    return;
-  }
+void FuncGen::resolveTargetBinding(size_t index) {
+  Channel &ch = m_channels[index];
+  const String &targetId = ch.settings.targetId;
+  ch.target.handle = OutputRegistry::kInvalidHandle;
+  ch.target.driver = OutputRegistry::DRIVER_NONE;
+  ch.target.available = false;
+  ch.target.id = targetId;
+  ch.target.gpio = 0xFF;
+  ch.target.pwmFreq = 0;
+  ch.target.mcpAddress = 0x60;
+  ch.target.rcCutoffHz = 0.0f;
+  ch.target.lut = nullptr;
+  ch.noTargetLogged = false;
+  ch.sdErr1 = 0;
+  ch.sdErr2 = 0;
+  ch.lastPwmCode = 0xFFFF;
+  ch.lastOutputValue = -1.0f;
+  ch.lastLoggedOutput = -1.0f;
 
-  JsonDocument &doc = m_config->getConfig("outputs");
-  if (!doc.is<JsonArray>()) {
-    if (m_logger) {
-      m_logger->warning(F("FuncGen: outputs config is not an array"));
-    }
+  if (!m_outputs || !targetId.length()) {
     return;
   }
 
-  JsonArray arr = doc.as<JsonArray>();
-  for (JsonVariant v : arr) {
-    if (!v.is<JsonObject>()) {
-      continue;
-    }
-    JsonObject obj = v.as<JsonObject>();
-    const char *id = obj["id"].as<const char *>();
-    if (!id || !m_settings.targetId.equalsIgnoreCase(id)) {
-      continue;
-    }
-
-    const char *type = obj["type"].as<const char *>();
-    JsonObject cfg = obj["config"].is<JsonObject>()
-                         ? obj["config"].as<JsonObject>()
-                         : JsonObject();
-
-    if (type && strcasecmp(type, "mcp4725") == 0) {
-      uint8_t address = 0x60;
-      if (cfg.containsKey("address")) {
-        if (cfg["address"].is<const char *>()) {
-          const char *addrStr = cfg["address"].as<const char *>();
-          if (addrStr) {
-            address = (uint8_t)strtol(addrStr, nullptr, 0);
-          }
-        } else if (cfg["address"].is<int>()) {
-          address = (uint8_t)cfg["address"].as<int>();
-        }
-      }
-      m_target.driver = DRIVER_MCP4725;
-      m_target.available = true;
-      m_target.mcpAddress = address;
-      m_dac.begin(address);
+  // An output can only be driven by one channel at a time.
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    if (i == index) continue;
+    const Channel &other = m_channels[i];
+    if (other.target.available &&
+        other.settings.targetId.equalsIgnoreCase(targetId)) {
       if (m_logger) {
-        String addrStr = String(address, HEX);
-        addrStr.toUpperCase();
-        if (addrStr.length() < 2) {
-          addrStr = "0" + addrStr;
-        }
-        m_logger->info(String(F("FuncGen target MCP4725 @0x")) + addrStr);
-      }
-      return;
-    }
-
-    if (type && (strcasecmp(type, "pwm_rc") == 0 ||
-                 strcasecmp(type, "pwm_0_10v") == 0 ||
-                 strcasecmp(type, "charge_pump_doubler") == 0)) {
-      String pinLabel;
-      if (cfg["pin"].is<const char *>()) {
-        const char *pinStr = cfg["pin"].as<const char *>();
-        if (pinStr) pinLabel = String(pinStr);
-      } else if (cfg["pin"].is<int>()) {
-        pinLabel = String(cfg["pin"].as<int>());
-      }
-      int gpio = labelToGpio(pinLabel);
-      if (gpio < 0) {
-        if (m_logger) {
-          m_logger->warning(String(F("FuncGen: invalid GPIO for target ")) +
-                            m_settings.targetId);
-        }
-        return;
-      }
-      uint32_t freq = 0;
-      if (cfg["frequency"].is<uint32_t>()) {
-        freq = cfg["frequency"].as<uint32_t>();
-      } else if (cfg["frequency"].is<float>()) {
-        freq = (uint32_t)(cfg["frequency"].as<float>() + 0.5f);
-      } else if (cfg["pwm"].is<JsonObject>()) {
-        JsonObject pwmObj = cfg["pwm"].as<JsonObject>();
-        if (pwmObj["frequency"].is<uint32_t>()) {
-          freq = pwmObj["frequency"].as<uint32_t>();
-        } else if (pwmObj["frequency"].is<float>()) {
-          freq = (uint32_t)(pwmObj["frequency"].as<float>() + 0.5f);
-        }
-      }
-      if (freq == 0) {
-        if (strcasecmp(type, "pwm_rc") == 0) {
-          freq = 5000;
-        } else if (strcasecmp(type, "pwm_0_10v") == 0) {
-          freq = 2000;
-        } else {
-          freq = 4000;
-        }
-      }
-
-      pinMode(gpio, OUTPUT);
-      analogWriteRange(1023);
-      analogWriteFreq(freq);
-      analogWrite(gpio, 0);
-
-      m_target.driver = DRIVER_PWM;
-      m_target.available = true;
-      m_target.gpio = (uint8_t)gpio;
-      m_target.pwmFreq = freq;
-      if (m_logger) {
-        m_logger->info(String(F("FuncGen target PWM sur GPIO")) +
-                       String(gpio) + F(" @") + String(freq) + F("Hz"));
+        m_logger->warning(channelTag(index) + F(": cible ") + targetId +
+                          F(" déjà pilotée par le canal ") + String(i));
       }
       return;
     }
+  }
 
+  int handle = m_outputs->find(targetId);
+  const OutputRegistry::Binding *binding = m_outputs->get(handle);
+  if (!binding) {
     if (m_logger) {
-      m_logger->warning(String(F("FuncGen: unsupported target type ")) +
-                        (type ? type : "?"));
+      m_logger->warning(String(F("FuncGen: cible introuvable ")) + targetId);
     }
     return;
   }
+  ch.target.handle = handle;
+  ch.target.lut = binding->lut;
 
-  if (m_logger) {
-    m_logger->warning(String(F("FuncGen: cible introuvable ")) +
-                      m_settings.targetId);
-  }
-}
-
-int FuncGen::labelToGpio(const String &label) {
-  if (!label.length()) {
-    return -1;
-  }
-  String trimmed = label;
-  trimmed.trim();
-  if (!trimmed.length()) {
-    return -1;
-  }
+  switch (binding->driver) {
+  case OutputRegistry::DRIVER_MCP4725:
+    ch.target.driver = OutputRegistry::DRIVER_MCP4725;
+    ch.target.available = true;
+    ch.target.mcpAddress = binding->i2cAddress;
+    ch.dac.begin(binding->i2cAddress);
+    if (m_logger) {
+      String addrStr = String(binding->i2cAddress, HEX);
+      addrStr.toUpperCase();
+      if (addrStr.length() < 2) {
+        addrStr = "0" + addrStr;
+      }
+      m_logger->info(channelTag(index) + F(" target MCP4725 @0x") + addrStr);
+    }
+    return;
 
-  struct PinMapEntry {
-    const char *label;
-    uint8_t gpio;
-  };
-  static const PinMapEntry map[] = {{"D0", 16}, {"D1", 5},  {"D2", 4},
-                                    {"D3", 0},  {"D4", 2},  {"D5", 14},
-                                    {"D6", 12}, {"D7", 13}, {"D8", 15}};
-  for (const auto &entry : map) {
-    if (trimmed.equalsIgnoreCase(entry.label)) {
-      return entry.gpio;
+  case OutputRegistry::DRIVER_PWM: {
+    uint32_t freq = binding->pwmFreq;
+    // analogWriteFreq() is global on the ESP8266: every PWM pin shares
+    // the last frequency programmed.
+    for (size_t i = 0; i < m_channelCount; ++i) {
+      const Channel &other = m_channels[i];
+      if (i != index && other.target.available &&
+          other.target.driver == OutputRegistry::DRIVER_PWM &&
+          other.target.pwmFreq != freq && m_logger) {
+        m_logger->warning(channelTag(index) + F(": PWM ") + String(freq) +
+                          F("Hz remplace ") + String(other.target.pwmFreq) +
+                          F("Hz du canal ") + String(i) +
+                          F(" (fréquence PWM commune)"));
+      }
     }
-  }
 
-  String upper = trimmed;
-  upper.toUpperCase();
-  if (upper.startsWith("GPIO")) {
-    String numeric = upper.substring(4);
-    if (numeric.length()) {
-      return numeric.toInt();
+    pinMode(binding->gpio, OUTPUT);
+    analogWriteRange(kPwmMaxCode);
+    analogWriteFreq(freq);
+    analogWrite(binding->gpio, 0);
+
+    ch.target.driver = OutputRegistry::DRIVER_PWM;
+    ch.target.available = true;
+    ch.target.gpio = binding->gpio;
+    ch.target.pwmFreq = freq;
+    // The RC filter bounds how much resolution dithering can recover.
+    ch.target.rcCutoffHz = binding->rcCutoffHz;
+    if (m_logger) {
+      m_logger->info(channelTag(index) + F(" target PWM sur GPIO") +
+                     String(binding->gpio) + F(" @") + String(freq) + F("Hz"));
     }
+    return;
   }
 
-  bool digits = true;
-  for (size_t i = 0; i < trimmed.length(); ++i) {
-    char c = trimmed.charAt(i);
-    if (c < '0' || c > '9') {
-      digits = false;
-      break;
+  case OutputRegistry::DRIVER_NONE:
+  default:
+    if (m_logger) {
+      m_logger->warning(String(F("FuncGen: unsupported target type ")) +
+                        (binding->type.length() ? binding->type : String("?")));
     }
+    return;
   }
-  if (digits) {
-    return trimmed.toInt();
-  }
-  return -1;
 }
 
-void FuncGen::writeOutput(float value) {
-  if (!m_target.available || m_target.driver == DRIVER_NONE) {
-    if (m_logger && !m_noTargetLogged) {
+void FuncGen::writeOutput(Channel &ch, float value, bool corrected) {
+  if (!ch.target.available ||
+      ch.target.driver == OutputRegistry::DRIVER_NONE) {
+    if (m_logger && !ch.noTargetLogged) {
       m_logger->warning(String(F("FuncGen: aucune sortie active (")) +
-                        (m_settings.targetId.length() ? m_settings.targetId
-                                                       : String("")) +
-                        F(")"));
-      m_noTargetLogged = true;
+                        ch.settings.targetId + F(")"));
+      ch.noTargetLogged = true;
     }
     return;
   }
-  m_noTargetLogged = false;
+  ch.noTargetLogged = false;
 
   if (value < 0.0f) value = 0.0f;
   if (value > 1.0f) value = 1.0f;
+  if (!corrected) {
+    // Calibration levels bypass the slew limiter: track them so the
+    // generator resumes from the right place.
+    ch.slewQ24 = (int32_t)(value * kQ24);
+  }
+  if (corrected && ch.target.lut) {
+    value = OutputRegistry::applyCorrection(ch.target.lut, value);
+  }
 
-  if (m_lastOutputValue >= 0.0f && fabsf(m_lastOutputValue - value) < 0.0005f) {
+  // Dithered outputs need every sub-LSB change: the modulator only
+  // reads the target, so skipping the hardware write is not a concern.
+  bool dithered = isDithered(ch);
+  if (!dithered && ch.lastOutputValue >= 0.0f &&
+      fabsf(ch.lastOutputValue - value) < 0.0005f) {
+    ch.timing.dedupeSkips++;
     return;
   }
 
   bool shouldLog = false;
   if (m_logger) {
-    if (m_lastLoggedOutput < 0.0f ||
-        fabsf(m_lastLoggedOutput - value) >= 0.05f) {
+    if (ch.lastLoggedOutput < 0.0f ||
+        fabsf(ch.lastLoggedOutput - value) >= 0.05f) {
       shouldLog = true;
     }
   }
 
-  switch (m_target.driver) {
-  case DRIVER_MCP4725: {
+  uint32_t writeStart = (uint32_t)micros();
+  switch (ch.target.driver) {
+  case OutputRegistry::DRIVER_MCP4725: {
     uint16_t dacVal = (uint16_t)(value * 4095.0f + 0.5f);
-    m_dac.setVoltage(dacVal, false);
+    ch.dac.setVoltage(dacVal, false);
     break;
   }
-  case DRIVER_PWM: {
-    uint16_t pwmVal = (uint16_t)(value * 1023.0f + 0.5f);
-    analogWrite(m_target.gpio, pwmVal);
+  case OutputRegistry::DRIVER_PWM: {
+    if (dithered) {
+      // ditherTick() turns the fine target into PWM codes.
+      ch.ditherTarget = (uint32_t)(value * kPwmMaxCode * 65536.0f + 0.5f);
+    } else {
+      uint16_t pwmVal = (uint16_t)(value * (float)kPwmMaxCode + 0.5f);
+      analogWrite(ch.target.gpio, pwmVal);
+      ch.lastPwmCode = pwmVal;
+    }
     break;
   }
-  case DRIVER_NONE:
+  case OutputRegistry::DRIVER_NONE:
   default:
     break;
   }
 
-  m_lastOutputValue = value;
+  TimingStats &timing = ch.timing;
+  timing.writeLastUs = (uint32_t)micros() - writeStart;
+  if (timing.writeLastUs > timing.writeMaxUs) {
+    timing.writeMaxUs = timing.writeLastUs;
+  }
+  timing.writeAvgUs += ((float)timing.writeLastUs - timing.writeAvgUs) / 16.0f;
+  timing.writes++;
+
+  ch.lastOutputValue = value;
   if (shouldLog && m_logger) {
     String msg = String(F("FuncGen sortie -> "));
     msg += String(value * 100.0f, 1);
     msg += F("% (driver=");
-    switch (m_target.driver) {
-    case DRIVER_MCP4725: {
+    switch (ch.target.driver) {
+    case OutputRegistry::DRIVER_MCP4725: {
       msg += F("mcp4725 @0x");
-      String addr = String(m_target.mcpAddress, HEX);
+      String addr = String(ch.target.mcpAddress, HEX);
       addr.toUpperCase();
       if (addr.length() < 2) {
         addr = "0" + addr;
@@ -618,44 +1369,673 @@ void FuncGen::writeOutput(float value) {
       msg += addr;
       break;
     }
-    case DRIVER_PWM:
+    case OutputRegistry::DRIVER_PWM:
       msg += F("pwm,gpio=");
-      msg += String(m_target.gpio);
+      msg += String(ch.target.gpio);
       msg += F(",freq=");
-      msg += String(m_target.pwmFreq);
+      msg += String(ch.target.pwmFreq);
       break;
-    case DRIVER_NONE:
+    case OutputRegistry::DRIVER_NONE:
     default:
       msg += F("none");
       break;
     }
     msg += F(")");
     m_logger->debug(msg);
-    m_lastLoggedOutput = value;
+    ch.lastLoggedOutput = value;
   }
 }
 
-void FuncGen::ensureOutputDisabled() {
-  if (!m_target.available) {
+void FuncGen::ensureOutputDisabled(Channel &ch) {
+  if (!ch.target.available) {
     return;
   }
-  if (m_lastOutputValue >= 0.0f && fabsf(m_lastOutputValue) < 0.0005f) {
+  if (ch.lastOutputValue >= 0.0f && fabsf(ch.lastOutputValue) < 0.0005f) {
     return;
   }
-  switch (m_target.driver) {
-  case DRIVER_MCP4725:
-    m_dac.setVoltage(0, false);
+  switch (ch.target.driver) {
+  case OutputRegistry::DRIVER_MCP4725:
+    ch.dac.setVoltage(0, false);
     break;
-  case DRIVER_PWM:
-    analogWrite(m_target.gpio, 0);
+  case OutputRegistry::DRIVER_PWM:
+    analogWrite(ch.target.gpio, 0);
+    ch.lastPwmCode = 0;
+    ch.ditherTarget = 0;
+    ch.sdErr1 = 0;
+    ch.sdErr2 = 0;
     break;
-  case DRIVER_NONE:
+  case OutputRegistry::DRIVER_NONE:
   default:
     break;
   }
-  m_lastOutputValue = 0.0f;
+  ch.lastOutputValue = 0.0f;
+  ch.slewQ24 = 0;
+  if (m_logger) {
+    m_logger->info(String(F("FuncGen sortie désactivée (niveau 0) ")) +
+                   ch.target.id);
+  }
+  ch.lastLoggedOutput = 0.0f;
+}
+
+bool FuncGen::startCalibration(int channel, const String &inputId,
+                               uint32_t settleMs, uint8_t samples,
+                               bool useRange, String &error) {
+  if (m_cal.active) {
+    error = F("calibration already running");
+    return false;
+  }
+  if (channel < 0 || (size_t)channel >= m_channelCount) {
+    error = F("invalid channel");
+    return false;
+  }
+  if (!m_io || !m_outputs || !inputId.length()) {
+    error = F("missing input");
+    return false;
+  }
+  Channel &ch = m_channels[channel];
+  if (!ch.target.available) {
+    error = F("channel has no output");
+    return false;
+  }
+  if (settleMs == 0) {
+    // Five RC time constants settle within 1% of the step.
+    settleMs = 50;
+    if (ch.target.rcCutoffHz > 0.0f) {
+      float tauMs = 1000.0f / (2.0f * PI * ch.target.rcCutoffHz);
+      settleMs = (uint32_t)(5.0f * tauMs);
+    }
+  }
+  if (settleMs > 5000) settleMs = 5000;
+  if (samples < 1) samples = 1;
+  if (samples > 32) samples = 32;
+
+  m_cal.active = true;
+  m_cal.channel = channel;
+  m_cal.input = inputId;
+  m_cal.useRange = useRange;
+  m_cal.settleMs = settleMs;
+  m_cal.samples = samples;
+  m_cal.step = 0;
+  m_cal.state = "running";
+  m_cal.error = "";
+  m_cal.nonlinearityPct = 0.0f;
   if (m_logger) {
-    m_logger->info(F("FuncGen sortie désactivée (niveau 0)"));
+    m_logger->info(channelTag(channel) + F(" calibration ") + ch.target.id +
+                   F(" via ") + inputId + F(", ") + String(settleMs) +
+                   F(" ms/palier"));
+  }
+  driveCalibrationStep();
+  return true;
+}
+
+void FuncGen::cancelCalibration() {
+  if (m_cal.active) {
+    stopCalibration("cancelled", String());
+  }
+}
+
+bool FuncGen::clearCalibration(int channel) {
+  if (channel < 0 || (size_t)channel >= m_channelCount || !m_outputs) {
+    return false;
+  }
+  if (!m_outputs->clearCorrection(m_channels[channel].target.id)) {
+    return false;
+  }
+  refreshCorrections();
+  persistCalibration();
+  return true;
+}
+
+void FuncGen::driveCalibrationStep() {
+  Channel &ch = m_channels[m_cal.channel];
+  writeOutput(ch, (float)m_cal.step / (float)(kCalSteps - 1), false);
+  m_cal.stepStartMs = millis();
+  m_cal.sampleCount = 0;
+  m_cal.acc = 0.0f;
+}
+
+void FuncGen::calibrationStep() {
+  Channel &ch = m_channels[m_cal.channel];
+  if (!ch.target.available) {
+    stopCalibration("failed", F("output unavailable"));
+    return;
+  }
+  if (millis() - m_cal.stepStartMs < m_cal.settleMs) {
+    return;
+  }
+  // One conversion per loop pass: an ADS1115 read blocks for ~8 ms.
+  m_cal.acc += m_io->readValue(m_cal.input);
+  if (++m_cal.sampleCount < m_cal.samples) {
+    return;
+  }
+  m_cal.measured[m_cal.step] = m_cal.acc / (float)m_cal.samples;
+  m_cal.step++;
+  if (m_cal.step < kCalSteps) {
+    driveCalibrationStep();
+  } else {
+    finishCalibration();
+  }
+}
+
+void FuncGen::finishCalibration() {
+  const size_t n = kCalSteps;
+  float *m = m_cal.measured;
+  float span = m[n - 1] - m[0];
+  if (fabsf(span) < 1e-3f) {
+    stopCalibration("failed", F("no response on input"));
+    return;
   }
-  m_lastLoggedOutput = 0.0f;
+  bool rising = span > 0.0f;
+
+  float worst = 0.0f;
+  for (size_t j = 0; j < n; ++j) {
+    float ideal = m[0] + span * (float)j / (float)(n - 1);
+    float dev = fabsf(m[j] - ideal);
+    if (dev > worst) worst = dev;
+  }
+  m_cal.nonlinearityPct = worst * 100.0f / fabsf(span);
+
+  // Noise can make neighbouring points cross; the inverse needs a
+  // monotonic curve.
+  for (size_t j = 1; j < n; ++j) {
+    if (rising ? m[j] < m[j - 1] : m[j] > m[j - 1]) {
+      m[j] = m[j - 1];
+    }
+  }
+
+  float lo = m[0];
+  float hi = m[n - 1];
+  Channel &ch = m_channels[m_cal.channel];
+  const OutputRegistry::Binding *binding = m_outputs->get(ch.target.handle);
+  if (m_cal.useRange && rising && binding &&
+      binding->rangeMax > binding->rangeMin) {
+    lo = binding->rangeMin;
+    hi = binding->rangeMax;
+  }
+
+  uint16_t lut[OutputRegistry::kCalPoints];
+  for (size_t i = 0; i < OutputRegistry::kCalPoints; ++i) {
+    float target =
+        lo + (hi - lo) * (float)i / (float)(OutputRegistry::kCalPoints - 1);
+    float code;
+    if (rising ? target <= m[0] : target >= m[0]) {
+      code = 0.0f;
+    } else if (rising ? target >= m[n - 1] : target <= m[n - 1]) {
+      code = 1.0f;
+    } else {
+      size_t j = 0;
+      while (j < n - 2 && (rising ? m[j + 1] < target : m[j + 1] > target)) {
+        j++;
+      }
+      float d = m[j + 1] - m[j];
+      float frac = fabsf(d) > 1e-6f ? (target - m[j]) / d : 0.0f;
+      code = ((float)j + frac) / (float)(n - 1);
+    }
+    if (code < 0.0f) code = 0.0f;
+    if (code > 1.0f) code = 1.0f;
+    lut[i] = (uint16_t)(code * 65535.0f + 0.5f);
+  }
+
+  if (!m_outputs->setCorrection(ch.target.id, lut, m_cal.input)) {
+    stopCalibration("failed", F("no free correction slot"));
+    return;
+  }
+  refreshCorrections();
+  persistCalibration();
+  if (m_logger) {
+    m_logger->info(channelTag(m_cal.channel) + F(" calibration terminée, ") +
+                   F("non-linéarité ") + String(m_cal.nonlinearityPct, 2) +
+                   F("%"));
+  }
+  stopCalibration("done", String());
+}
+
+void FuncGen::stopCalibration(const char *state, const String &error) {
+  m_cal.active = false;
+  m_cal.state = state;
+  m_cal.error = error;
+  if (m_cal.channel >= 0 && (size_t)m_cal.channel < m_channelCount) {
+    Channel &ch = m_channels[m_cal.channel];
+    // Let the next tick rewrite the generator level.
+    ch.lastOutputValue = -1.0f;
+    ch.timing.haveLast = false;
+    if (!ch.settings.enabled) {
+      ensureOutputDisabled(ch);
+    }
+  }
+  if (error.length() && m_logger) {
+    m_logger->warning(String(F("FuncGen calibration: ")) + error);
+  }
+}
+
+void FuncGen::refreshCorrections() {
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    Channel &ch = m_channels[i];
+    const OutputRegistry::Binding *binding =
+        m_outputs ? m_outputs->get(ch.target.handle) : nullptr;
+    ch.target.lut = binding ? binding->lut : nullptr;
+    ch.lastOutputValue = -1.0f;
+  }
+}
+
+void FuncGen::persistCalibration() {
+  DynamicJsonDocument doc(2048);
+  m_outputs->serializeCorrections(doc);
+  String out;
+  serializeJson(doc, out);
+  if (m_files) {
+    m_files->enqueue(F("/calibration.json"), out);
+    return;
+  }
+  File f = LittleFS.open("/calibration.json", "w");
+  if (f) {
+    f.print(out);
+    f.close();
+  }
+}
+
+uint32_t FuncGen::slewRateToQ24(float pctPerS) {
+  if (pctPerS <= 0.0f) {
+    return 0;
+  }
+  // Above 1000 %/s the limit is below one tick anyway; capping keeps
+  // rate * 16384 us inside 32 bits.
+  if (pctPerS > 1000.0f) pctPerS = 1000.0f;
+  uint32_t rate = (uint32_t)(pctPerS / 100.0f * kQ24 * 1024.0f / 1e6f + 0.5f);
+  return rate ? rate : 1;
+}
+
+void FuncGen::writeLimited(Channel &ch, float value) {
+  if (!ch.slewPerKus) {
+    ch.slewQ24 = (int32_t)(value * kQ24);
+    writeOutput(ch, value);
+    return;
+  }
+  if (ch.slewQ24 < 0) {
+    // Start from what the output holds: a pin not written since reset
+    // is low.
+    ch.slewQ24 = ch.lastOutputValue > 0.0f
+                     ? (int32_t)(ch.lastOutputValue * kQ24)
+                     : 0;
+  }
+  int32_t target = (int32_t)(value * kQ24);
+  // A stalled loop must not turn into a large step: clamp the time
+  // credited to one tick.
+  uint32_t dt = m_tickDeltaUs > 16384 ? 16384 : m_tickDeltaUs;
+  int32_t maxStep = (int32_t)((ch.slewPerKus * dt) >> 10);
+  if (maxStep < 1) maxStep = 1;
+  int32_t diff = target - ch.slewQ24;
+  if (diff > maxStep) diff = maxStep;
+  if (diff < -maxStep) diff = -maxStep;
+  ch.slewQ24 += diff;
+  writeOutput(ch, ch.slewQ24 / kQ24);
+}
+
+bool FuncGen::startRamp(int channel, float toFraction, uint32_t durationMs,
+                        bool sCurve, String &error) {
+  if (channel < 0 || (size_t)channel >= m_channelCount) {
+    error = F("invalid channel");
+    return false;
+  }
+  if (durationMs == 0 || durationMs > 600000) {
+    error = F("duration_ms must be 1..600000");
+    return false;
+  }
+  if (toFraction < 0.0f) toFraction = 0.0f;
+  if (toFraction > 1.0f) toFraction = 1.0f;
+  Channel &ch = m_channels[channel];
+  Ramp &ramp = ch.ramp;
+  ramp.onOffset = ch.settings.type != DC;
+  float from = ramp.onOffset ? ch.settings.offset : ch.settings.amp;
+  ramp.fromQ24 = (int32_t)(from * kQ24);
+  ramp.toQ24 = (int32_t)(toFraction * kQ24);
+  ramp.elapsedUs = 0;
+  ramp.durationUs = durationMs * 1000UL;
+  ramp.sCurve = sCurve;
+  ramp.active = true;
+  if (m_logger) {
+    m_logger->info(channelTag(channel) + F(" rampe ") +
+                   String(from * 100.0f, 1) + F("% -> ") +
+                   String(toFraction * 100.0f, 1) + F("% en ") +
+                   String(durationMs) + F(" ms"));
+  }
+  return true;
+}
+
+void FuncGen::advanceRamps(uint32_t deltaUs) {
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    Channel &ch = m_channels[i];
+    Ramp &ramp = ch.ramp;
+    if (!ramp.active) {
+      continue;
+    }
+    ramp.elapsedUs += deltaUs;
+    int32_t level = ramp.toQ24;
+    bool done = ramp.elapsedUs >= ramp.durationUs;
+    if (!done) {
+      // Progress in Q16, optionally shaped by smoothstep 3p^2 - 2p^3.
+      uint32_t p =
+          (uint32_t)(((uint64_t)ramp.elapsedUs << 16) / ramp.durationUs);
+      if (ramp.sCurve) {
+        uint32_t p2 = (p * p) >> 16;
+        p = (uint32_t)(((uint64_t)p2 * (3UL * 65536UL - 2UL * p)) >> 16);
+      }
+      level = ramp.fromQ24 +
+              (int32_t)(((int64_t)(ramp.toQ24 - ramp.fromQ24) * p) >> 16);
+    }
+    float value = level / kQ24;
+    if (ramp.onOffset) {
+      ch.settings.offset = value;
+    } else {
+      ch.settings.amp = value;
+    }
+    if (done) {
+      ramp.active = false;
+      persistSettings();
+    }
+  }
+}
+
+void FuncGen::resetTiming(TimingStats &timing) {
+  timing.haveLast = false;
+  timing.lastSampleUs = 0;
+  timing.intervals = 0;
+  timing.intervalMinUs = UINT32_MAX;
+  timing.intervalMaxUs = 0;
+  timing.intervalMeanUs = 0.0f;
+  timing.intervalM2 = 0.0f;
+  for (size_t i = 0; i < kIntervalBuckets; ++i) {
+    timing.histogram[i] = 0;
+  }
+  timing.dedupeSkips = 0;
+  timing.writes = 0;
+  timing.writeLastUs = 0;
+  timing.writeMaxUs = 0;
+  timing.writeAvgUs = 0.0f;
+}
+
+void FuncGen::resetTimingStats() {
+  for (size_t i = 0; i < kMaxChannels; ++i) {
+    resetTiming(m_channels[i].timing);
+  }
+  m_maxTickUs = 0;
+}
+
+void FuncGen::recordInterval(TimingStats &timing, uint32_t nowUs) {
+  if (!timing.haveLast) {
+    timing.haveLast = true;
+    timing.lastSampleUs = nowUs;
+    return;
+  }
+  uint32_t interval = nowUs - timing.lastSampleUs;
+  timing.lastSampleUs = nowUs;
+  timing.intervals++;
+  if (interval < timing.intervalMinUs) timing.intervalMinUs = interval;
+  if (interval > timing.intervalMaxUs) timing.intervalMaxUs = interval;
+  // Welford's running mean/variance: no sample buffer needed.
+  float delta = (float)interval - timing.intervalMeanUs;
+  timing.intervalMeanUs += delta / (float)timing.intervals;
+  timing.intervalM2 += delta * ((float)interval - timing.intervalMeanUs);
+
+  size_t bucket = 0;
+  uint32_t edge = kIntervalBucketUs;
+  while (bucket < kIntervalBuckets - 1 && interval >= edge) {
+    bucket++;
+    edge <<= 1;
+  }
+  timing.histogram[bucket]++;
+}
+
+bool FuncGen::isDithered(const Channel &ch) const {
+  return ch.settings.dither > 0 && ch.target.available &&
+         ch.target.driver == OutputRegistry::DRIVER_PWM;
+}
+
+void FuncGen::updateDitherTimer() {
+  bool needed = false;
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    if (isDithered(m_channels[i])) {
+      needed = true;
+      break;
+    }
+  }
+  if (needed == m_ditherRunning) {
+    return;
+  }
+  if (needed) {
+    // The Ticker callback runs from the SDK timer task between loop()
+    // iterations, so it never interleaves with writeOutput().
+    m_ditherTicker.attach_ms(kDitherPeriodMs, [this]() { ditherTick(); });
+  } else {
+    m_ditherTicker.detach();
+  }
+  m_ditherRunning = needed;
+  if (m_logger) {
+    m_logger->info(needed ? F("FuncGen sigma-delta actif")
+                          : F("FuncGen sigma-delta arrêté"));
+  }
+}
+
+void FuncGen::ditherTick() {
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    Channel &ch = m_channels[i];
+    // A calibration drives its channel even while the channel is off.
+    bool driven =
+        ch.settings.enabled || (m_cal.active && m_cal.channel == (int)i);
+    if (!driven || !isDithered(ch) || ch.lastOutputValue < 0.0f) {
+      continue;
+    }
+    // Error feedback modulator: first order adds the last residue,
+    // second order shapes the noise with (1 - z^-1)^2.
+    int32_t v = (int32_t)ch.ditherTarget;
+    if (ch.settings.dither >= 2) {
+      v += 2 * ch.sdErr1 - ch.sdErr2;
+    } else {
+      v += ch.sdErr1;
+    }
+    int32_t code = (v + 0x8000) >> 16;
+    if (code < 0) code = 0;
+    if (code > kPwmMaxCode) code = kPwmMaxCode;
+    int32_t err = v - (code << 16);
+    if (err > kDitherErrorLimit) err = kDitherErrorLimit;
+    if (err < -kDitherErrorLimit) err = -kDitherErrorLimit;
+    ch.sdErr2 = ch.sdErr1;
+    ch.sdErr1 = err;
+    if ((uint16_t)code != ch.lastPwmCode) {
+      analogWrite(ch.target.gpio, code);
+      ch.lastPwmCode = (uint16_t)code;
+      ch.ditherWrites++;
+    }
+  }
+}
+
+bool FuncGen::isRunning(const Channel &ch) const {
+  const Channel &src = isLocked(ch) ? m_channels[ch.settings.lockTo] : ch;
+  switch (src.settings.mode) {
+  case MODE_BURST:
+    return src.trig.burstActive || src.trig.restart;
+  case MODE_GATED:
+    return src.trig.gate || src.phase > 0.0f;
+  case MODE_CONTINUOUS:
+  default:
+    return true;
+  }
+}
+
+void FuncGen::startBurst(Channel &ch, uint32_t atUs, const char *source) {
+  TriggerState &t = ch.trig;
+  t.restart = true;
+  if (ch.settings.mode == MODE_BURST) {
+    // Retriggering during a burst starts a fresh count.
+    t.burstActive = true;
+    t.cyclesLeft = ch.settings.burstCycles;
+  }
+  t.measuring = true;
+  t.atUs = atUs;
+  t.count++;
+  t.lastSource = source;
+}
+
+void FuncGen::openGate(Channel &ch, bool open, uint32_t atUs,
+                       const char *source) {
+  TriggerState &t = ch.trig;
+  if (open && !t.gate) {
+    t.measuring = true;
+    t.atUs = atUs;
+    t.count++;
+    t.lastSource = source;
+  }
+  t.gate = open;
+}
+
+bool FuncGen::trigger(int channel, const char *source) {
+  if (channel < 0 || (size_t)channel >= m_channelCount) {
+    return false;
+  }
+  Channel *ch = &m_channels[channel];
+  if (isLocked(*ch)) {
+    // Followers run from their master: trigger the master instead.
+    ch = &m_channels[ch->settings.lockTo];
+  }
+  if (!ch->settings.enabled) {
+    return false;
+  }
+  uint32_t now = micros();
+  if (ch->settings.mode == MODE_GATED) {
+    openGate(*ch, true, now, source);
+  } else if (ch->settings.mode == MODE_BURST) {
+    startBurst(*ch, now, source);
+  } else {
+    // A continuous channel has nothing to start.
+    return false;
+  }
+  return true;
+}
+
+bool FuncGen::setGate(int channel, bool open, const char *source) {
+  if (channel < 0 || (size_t)channel >= m_channelCount) {
+    return false;
+  }
+  Channel *ch = &m_channels[channel];
+  if (isLocked(*ch)) {
+    ch = &m_channels[ch->settings.lockTo];
+  }
+  if (ch->settings.mode != MODE_GATED) {
+    return false;
+  }
+  openGate(*ch, open, micros(), source);
+  return true;
+}
+
+void IRAM_ATTR FuncGen::onTriggerEdge(void *arg) {
+  TriggerState *t = static_cast<TriggerState *>(arg);
+  t->isrUs = micros();
+  t->isrEdges = t->isrEdges + 1;
+}
+
+void FuncGen::disarmTrigger(Channel &ch) {
+  if (ch.trig.gpio != 0xFF) {
+    detachInterrupt(digitalPinToInterrupt(ch.trig.gpio));
+    ch.trig.gpio = 0xFF;
+  }
+}
+
+void FuncGen::armTrigger(size_t index) {
+  Channel &ch = m_channels[index];
+  const Settings &s = ch.settings;
+  disarmTrigger(ch);
+  if (s.mode == MODE_CONTINUOUS || s.trigSource != TRIG_GPIO) {
+    return;
+  }
+  int gpio = OutputRegistry::pinLabelToGpio(s.trigPin);
+  // GPIO16 (D0) has no interrupt support on the ESP8266.
+  bool valid = gpio >= 0 && gpio < 16 &&
+               !(ch.target.driver == OutputRegistry::DRIVER_PWM &&
+                 ch.target.gpio == gpio);
+  if (!valid) {
+    if (m_logger) {
+      m_logger->warning(channelTag(index) +
+                        F(": GPIO de déclenchement invalide ") + s.trigPin);
+    }
+    return;
+  }
+  pinMode(gpio, INPUT_PULLUP);
+  int edge = CHANGE;
+  if (s.mode == MODE_BURST) {
+    edge = s.trigFalling ? FALLING : RISING;
+  }
+  ch.trig.seenEdges = ch.trig.isrEdges;
+  attachInterruptArg(digitalPinToInterrupt(gpio), onTriggerEdge, &ch.trig,
+                     edge);
+  ch.trig.gpio = (uint8_t)gpio;
+  if (m_logger) {
+    m_logger->info(channelTag(index) + F(" déclenchement sur GPIO") +
+                   String(gpio));
+  }
+}
+
+void FuncGen::pollTriggers() {
+  unsigned long nowMs = millis();
+  for (size_t i = 0; i < m_channelCount; ++i) {
+    Channel &ch = m_channels[i];
+    const Settings &s = ch.settings;
+    TriggerState &t = ch.trig;
+    if (s.mode == MODE_CONTINUOUS || !s.enabled || isLocked(ch)) {
+      continue;
+    }
+    if (s.trigSource == TRIG_GPIO && t.gpio != 0xFF) {
+      noInterrupts();
+      uint32_t edges = t.isrEdges;
+      uint32_t atUs = t.isrUs;
+      interrupts();
+      if (s.mode == MODE_BURST) {
+        if (edges != t.seenEdges) {
+          t.seenEdges = edges;
+          startBurst(ch, atUs, "gpio");
+        }
+      } else {
+        bool level = digitalRead(t.gpio) == HIGH;
+        bool open = s.trigFalling ? !level : level;
+        // Use the edge timestamp from the ISR when one was seen.
+        if (edges == t.seenEdges) {
+          atUs = micros();
+        }
+        t.seenEdges = edges;
+        openGate(ch, open, atUs, "gpio");
+      }
+    } else if (s.trigSource == TRIG_INPUT && m_io && s.trigInput.length()) {
+      if (nowMs - t.lastPollMs < s.trigPollMs) {
+        continue;
+      }
+      t.lastPollMs = nowMs;
+      uint32_t atUs = micros();
+      float value = m_io->readValue(s.trigInput);
+      // Schmitt trigger around the level so noise near the threshold
+      // does not retrigger.
+      bool high = t.inputHigh;
+      if (!t.inputPrimed) {
+        high = value > s.trigLevel;
+        t.inputPrimed = true;
+        t.inputHigh = high;
+      } else if (!high && value > s.trigLevel + s.trigHyst) {
+        high = true;
+      } else if (high && value < s.trigLevel - s.trigHyst) {
+        high = false;
+      }
+      bool active = s.trigFalling ? !high : high;
+      if (high != t.inputHigh) {
+        t.inputHigh = high;
+        if (s.mode == MODE_BURST && active) {
+          startBurst(ch, atUs, "input");
+        }
+      }
+      if (s.mode == MODE_GATED) {
+        openGate(ch, active, atUs, "input");
+      }
+    }
+  }
+}
+
+String FuncGen::channelTag(size_t index) const {
+  return String(F("FuncGen[")) + String((unsigned)index) + F("]");
 }
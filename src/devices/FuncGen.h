@@ -1,8 +1,48 @@
-// Function generator device. Drives a DAC (MCP4725) to produce
-// periodic waveforms such as sine, square, triangle or DC. The
+// Function generator device. Drives a DAC (MCP4725) or PWM outputs to
+// produce periodic waveforms such as sine, square, triangle or DC. The
 // configuration is read from funcgen.json and can be updated at
 // runtime via the web API. Frequency, amplitude and offset are
 // specified as percentages of full scale.
+//
+// Up to kMaxChannels independent generator channels can run at the same
+// time, each bound to its own output from outputs.json. All channels
+// are advanced from a single scheduler tick in loop(). A channel can be
+// phase-locked to another one: it then follows the master frequency and
+// keeps a fixed phase offset (e.g. 90° between two outputs).
+//
+// PWM outputs are limited to 10 bits by analogWriteRange(1023). A
+// channel can enable sigma-delta dithering ("dither": 1 or 2): the
+// requested level is kept with 16 fractional bits and a first or
+// second order modulator alternates between neighbouring duty codes
+// from a software timer of nominally 1 kHz. The timer only runs
+// between loop() passes, and a code only takes effect at the next PWM
+// period, so the real rate is at most the lower of 1 kHz and the PWM
+// frequency. The RC filter averages the codes back into a finer level
+// as far as that rate allows: with a few Hz of cutoff this gains a few
+// bits, and the carrier ripple the filter lets through bounds the
+// result ("effective_bits" in the status).
+//
+// Besides continuous output a channel can run in "burst" mode (emit
+// burst_cycles periods per trigger) or "gated" mode (run while the gate
+// is open, finishing the current period when it closes). Triggers come
+// from trigger() (HTTP/UDP), an IORegistry input crossing a threshold or
+// a GPIO edge caught by an interrupt. Triggers never touch flash; they
+// are applied on the next scheduler tick and the trigger-to-output
+// latency is recorded per channel.
+//
+// The output of a channel can be calibrated in closed loop: it is
+// stepped through kCalSteps levels which are measured back on an
+// IORegistry input, and the inverse curve is stored in OutputRegistry
+// as a correction table applied by writeOutput().
+//
+// Each channel can limit the slew rate of its output ("slew_pct_s",
+// percent of full scale per second) and run timed ramps of its DC level
+// (or offset for periodic waveforms), linear or S-shaped. Both advance
+// from the scheduler tick with fixed-point arithmetic; a disabled
+// channel with a slew limit ramps down to zero before it is released.
+// The slew limit applies to DC levels and to the level a burst or
+// gated channel rests at, starting from the current output; a running
+// periodic waveform is written as is ("slew_active" in the status).
 
 #ifndef MINILABOESP_FUNCGEN_H
 #define MINILABOESP_FUNCGEN_H
@@ -10,19 +50,72 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <Adafruit_MCP4725.h>
+#include <Ticker.h>
+
+#include "core/OutputRegistry.h"
 
 class Logger;
 class ConfigStore;
+class IORegistry;
+class FileWriteService;
+class OutputTester;
 
 class FuncGen {
 public:
   enum Waveform { SINE, SQUARE, TRIANGLE, DC };
+  enum RunMode { MODE_CONTINUOUS, MODE_BURST, MODE_GATED };
+  enum TriggerSource { TRIG_MANUAL, TRIG_INPUT, TRIG_GPIO };
+
+  // Maximum number of generator channels. outputs.json currently
+  // describes four outputs so one channel per output is possible.
+  static const size_t kMaxChannels = 4;
+
+  // Settings changes are written to flash once they have been stable
+  // for kPersistDebounceMs, and at the latest kPersistMaxDelayMs after
+  // the first pending change.
+  static const uint32_t kPersistDebounceMs = 1500;
+  static const uint32_t kPersistMaxDelayMs = 10000;
+
+  // Histogram of the interval between two samples of a channel. Bucket
+  // i counts intervals below kIntervalBucketUs << i; the last bucket
+  // collects everything slower.
+  static const size_t kIntervalBuckets = 8;
+  static const uint32_t kIntervalBucketUs = 1000;
+
+  // JSON capacity of snapshotStatus(): the shared part, with room for
+  // the few members the web API adds around it, then one channel with
+  // its copied strings (target, output id, summary...).
+  static const size_t kStatusBaseCapacity =
+      JSON_OBJECT_SIZE(16) + JSON_ARRAY_SIZE(kIntervalBuckets) +
+      JSON_OBJECT_SIZE(8) + JSON_OBJECT_SIZE(4) +
+      JSON_ARRAY_SIZE(kMaxChannels) + 256;
+  static const size_t kStatusChannelCapacity =
+      JSON_OBJECT_SIZE(24) + JSON_OBJECT_SIZE(6) + JSON_OBJECT_SIZE(12) +
+      JSON_OBJECT_SIZE(6) + JSON_OBJECT_SIZE(16) + JSON_OBJECT_SIZE(5) +
+      JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(8) + JSON_OBJECT_SIZE(4) +
+      JSON_ARRAY_SIZE(kIntervalBuckets) + JSON_OBJECT_SIZE(3) + 256;
+
+  // Levels measured during an output calibration.
+  static const size_t kCalSteps = 17;
+
+  // Latency above this budget is counted as late. One pass of the main
+  // loop (including its delay(5)) should stay well below it.
+  static const uint32_t kTriggerBudgetUs = 10000;
 
-  FuncGen(Logger *logger, ConfigStore *config);
+  FuncGen(Logger *logger, ConfigStore *config, OutputRegistry *outputs,
+          IORegistry *io = nullptr);
 
   // Initialise the DAC and load initial configuration.
   void begin();
 
+  // Route persistence through the background writer. Without it the
+  // debounced save falls back to ConfigStore::updateConfig().
+  void setFileWriteService(FileWriteService *files) { m_files = files; }
+
+  // Output test jobs: a channel is not enabled on an output a running
+  // job drives.
+  void setOutputTester(const OutputTester *tester) { m_tester = tester; }
+
   // Called in the main loop. Generates samples based on the current
   // waveform settings. Must be called regularly for accurate output.
   void loop();
@@ -31,10 +124,69 @@ public:
   // document should contain keys: type ("sine", "square", "triangle",
   // "dc"),
   // freq (Hz), amp_pct (0–100), offset_pct (0–100), enabled (bool).
+  // Optional keys: channel (index), target (output id), phase_deg,
+  // lock (index of the master channel, -1 to unlock) and sync (bool,
+  // restart every channel at phase 0) and dither (0 = off, 1 or 2 =
+  // sigma-delta order for PWM targets), slew_pct_s (slew limit in % of
+  // full scale per second, 0 = off), mode ("continuous", "burst",
+  // "gated"), burst_cycles and trigger {source: "manual" | "input" |
+  // "gpio", input, level, hyst, gpio, edge: "rising" | "falling",
+  // poll_ms}. Without "channel" the channel currently bound to "target"
+  // is updated, or channel 0 otherwise. Changes apply to the running
+  // generator at once; saving to funcgen.json is debounced.
   void updateSettings(const JsonDocument &doc);
 
-  // Expose the current state into a JSON object for diagnostics.
+  // Fast trigger path used by the web API and UDP commands: starts a
+  // burst, or opens/closes the gate of a gated channel. Nothing is
+  // persisted. Returns false if the channel index is invalid, or the
+  // channel disabled or continuous.
+  bool trigger(int channel, const char *source);
+  bool setGate(int channel, bool open, const char *source);
+
+  // Expose the current state into a JSON object for diagnostics. Every
+  // channel is listed in the "channels" array; "channel" is the index of
+  // the selected one.
   void snapshotStatus(JsonObject obj) const;
+  void snapshotStatus(JsonObject obj, int channel) const;
+  // JSON capacity needed by snapshotStatus() for the configured
+  // channels.
+  size_t statusJsonCapacity() const {
+    return kStatusBaseCapacity + m_channelCount * kStatusChannelCapacity;
+  }
+
+  // Ramp the DC level (offset for periodic waveforms) of a channel to
+  // toFraction (0..1) over durationMs. Any running ramp of the channel
+  // is replaced. Returns false with a reason in error.
+  bool startRamp(int channel, float toFraction, uint32_t durationMs,
+                 bool sCurve, String &error);
+
+  // Clear the timing statistics reported under "timing".
+  void resetTimingStats();
+
+  // Start calibrating the output bound to a channel against an
+  // IORegistry input. settleMs = 0 derives the settling time from the
+  // output RC filter. With useRange the output is mapped onto the range
+  // declared in outputs.json, otherwise the measured end points are
+  // kept and only the linearity is corrected. The generator of that
+  // channel is paused while the calibration runs from loop(). Returns
+  // false with a reason in error if it cannot start.
+  bool startCalibration(int channel, const String &inputId, uint32_t settleMs,
+                        uint8_t samples, bool useRange, String &error);
+  void cancelCalibration();
+  // Drop the correction table of the output bound to a channel.
+  bool clearCalibration(int channel);
+
+  // Index of the channel bound to the given output id, or -1.
+  int findChannelByTarget(const String &targetId) const;
+
+  // True while an enabled channel drives the given output id.
+  bool isOutputActive(const String &targetId) const;
+
+  // True if a channel uses the GPIO: PWM output of an enabled channel
+  // or trigger input with its interrupt attached.
+  bool usesGpio(uint8_t gpio) const;
+
+  size_t channelCount() const { return m_channelCount; }
 
 private:
   struct Settings {
@@ -44,40 +196,214 @@ private:
     float offset; // offset as fraction (0–1)
     bool enabled;
     String targetId;
-  } m_settings;
-
-  enum OutputDriver { DRIVER_NONE, DRIVER_MCP4725, DRIVER_PWM };
+    float phaseDeg; // static offset, or offset from the master if locked
+    int8_t lockTo;  // master channel index, -1 when free-running
+    uint8_t dither; // sigma-delta order for PWM targets (0 = off)
+    RunMode mode;
+    uint16_t burstCycles;
+    TriggerSource trigSource;
+    String trigInput; // IORegistry id for TRIG_INPUT
+    String trigPin;   // pin label for TRIG_GPIO
+    float trigLevel;
+    float trigHyst;
+    bool trigFalling; // falling edge / active-low gate
+    uint16_t trigPollMs;
+    float slewPctPerS; // 0 = no slew limit
+  };
 
+  // Hardware of the bound output, copied from the OutputRegistry entry
+  // so the sample path never looks anything up.
   struct TargetBinding {
-    OutputDriver driver;
+    int handle;
+    OutputRegistry::Driver driver;
     String id;
     uint8_t gpio;
     uint32_t pwmFreq;
     uint8_t mcpAddress;
     bool available;
-  } m_target;
+    float rcCutoffHz; // RC filter cutoff, 0 if unknown
+    const uint16_t *lut; // correction table from OutputRegistry
+  };
+
+  // Per-channel CPU cost of the scheduler tick, in microseconds.
+  struct CpuStats {
+    uint32_t lastUs;
+    uint32_t maxUs;
+    float avgUs;
+  };
+
+  // Trigger runtime state. The isr* fields are written by the GPIO
+  // interrupt handler and read in loop() with interrupts masked.
+  struct TriggerState {
+    volatile uint32_t isrEdges;
+    volatile uint32_t isrUs;
+    uint32_t seenEdges;
+    uint8_t gpio;
+    bool inputHigh;
+    bool inputPrimed;
+    unsigned long lastPollMs;
+    bool gate;
+    bool restart;   // burst start pending for the next tick
+    bool burstActive;
+    uint32_t cyclesLeft;
+    bool measuring; // waiting for the first sample after a trigger
+    uint32_t atUs;
+    uint32_t count;
+    uint32_t completed;
+    uint32_t late;
+    uint32_t lastLatencyUs;
+    uint32_t minLatencyUs;
+    uint32_t maxLatencyUs;
+    const char *lastSource;
+  };
+
+  // Waveform quality statistics: how regularly samples are produced
+  // and how long the hardware write takes.
+  struct TimingStats {
+    bool haveLast;
+    uint32_t lastSampleUs;
+    uint32_t intervals;
+    uint32_t intervalMinUs;
+    uint32_t intervalMaxUs;
+    float intervalMeanUs;
+    float intervalM2; // sum of squared deviations (Welford)
+    uint32_t histogram[kIntervalBuckets];
+    uint32_t dedupeSkips;
+    uint32_t writes;
+    uint32_t writeLastUs;
+    uint32_t writeMaxUs;
+    float writeAvgUs;
+  };
+
+  // Levels below are fractions of full scale in Q24 (1.0 = 1 << 24).
+  struct Ramp {
+    bool active;
+    bool sCurve;
+    bool onOffset; // ramping the offset of a periodic waveform
+    int32_t fromQ24;
+    int32_t toQ24;
+    uint32_t elapsedUs;
+    uint32_t durationUs;
+  };
+
+  struct Channel {
+    Settings settings;
+    TargetBinding target;
+    Adafruit_MCP4725 dac;
+    float phase;       // free-running phase accumulator (0..1)
+    float samplePhase; // phase used for the last sample, offset included
+    bool disabledLogged;
+    bool zeroFreqLogged;
+    bool lastEnabledState;
+    float lastDcLevelLogged;
+    float lastOutputValue;
+    float lastLoggedOutput;
+    bool noTargetLogged;
+    CpuStats cpu;
+    // Sigma-delta state. ditherTarget is the requested duty in 1/65536
+    // of a PWM code; the error terms carry the quantisation residue.
+    uint32_t ditherTarget;
+    int32_t sdErr1;
+    int32_t sdErr2;
+    uint16_t lastPwmCode;
+    uint32_t ditherWrites;
+    TriggerState trig;
+    TimingStats timing;
+    Ramp ramp;
+    int32_t slewQ24;     // current limited level, -1 when unknown
+    uint32_t slewPerKus; // allowed Q24 change per 1024 us
+  };
 
   Logger *m_logger;
   ConfigStore *m_config;
-  Adafruit_MCP4725 m_dac;
-  float m_phase;
+  OutputRegistry *m_outputs;
+  IORegistry *m_io;
+  FileWriteService *m_files;
+  const OutputTester *m_tester;
+  uint32_t m_outputsGeneration;
+  Channel m_channels[kMaxChannels];
+  size_t m_channelCount;
   unsigned long m_lastMicros;
-  bool m_disabledLogged;
-  bool m_zeroFreqLogged;
-  bool m_lastEnabledState;
-  float m_lastDcLevelLogged;
-  float m_lastOutputValue;
-  float m_lastLoggedOutput;
-  bool m_noTargetLogged;
+  uint32_t m_tickDeltaUs;
+  uint32_t m_lastTickUs;
+  uint32_t m_maxTickUs;
+  Ticker m_ditherTicker;
+  bool m_ditherRunning;
+  struct Calibration {
+    bool active;
+    int channel;
+    String input;
+    bool useRange;
+    uint32_t settleMs;
+    uint8_t samples;
+    size_t step;
+    uint8_t sampleCount;
+    float acc;
+    unsigned long stepStartMs;
+    float measured[kCalSteps];
+    const char *state; // idle, running, done, failed, cancelled
+    String error;
+    float nonlinearityPct; // deviation from a straight line before correction
+  };
+  Calibration m_cal;
+
+  // Debounced persistence state.
+  bool m_persistDirty;
+  unsigned long m_persistFirstMs;
+  unsigned long m_persistLastMs;
+  uint32_t m_persistDeferred; // updates merged into a pending save
+  uint32_t m_persistWrites;
 
+  void resetChannel(Channel &ch);
   // Load settings from funcgen.json. Called during begin().
   void loadFromConfig();
+  void loadChannelSettings(JsonObjectConst obj, Settings &settings);
+  void loadTriggerSettings(JsonObjectConst trig, Settings &settings);
+  // Mark settings dirty; the save happens later from loop().
+  void persistSettings();
+  void flushSettings();
+  void writeChannelSettings(const Settings &settings, JsonObject obj) const;
+  void describeChannel(size_t index, JsonObject obj) const;
+  bool isLocked(const Channel &ch) const;
+  // Advance phase accumulators and compute per-channel sample phases.
+  void advancePhases(unsigned long deltaUs);
+  void updateChannel(size_t index);
   // Compute waveform sample at current phase.
-  float waveformSample(float phase);
-  void resolveTargetBinding();
-  int labelToGpio(const String &label);
-  void writeOutput(float value);
-  void ensureOutputDisabled();
+  float waveformSample(Waveform type, float phase);
+  void resolveTargetBinding(size_t index);
+  // Write a level (0..1) to the channel output. The correction table
+  // is bypassed when corrected is false (used by the calibration).
+  void writeOutput(Channel &ch, float value, bool corrected = true);
+  void ensureOutputDisabled(Channel &ch);
+  void calibrationStep();
+  void driveCalibrationStep();
+  void finishCalibration();
+  void stopCalibration(const char *state, const String &error);
+  void refreshCorrections();
+  void persistCalibration();
+  void advanceRamps(uint32_t deltaUs);
+  // Apply the slew limit for the current tick and write the result.
+  void writeLimited(Channel &ch, float value);
+  static uint32_t slewRateToQ24(float pctPerS);
+  void resetTiming(TimingStats &timing);
+  void recordInterval(TimingStats &timing, uint32_t nowUs);
+  bool isDithered(const Channel &ch) const;
+  // Start or stop the modulator timer depending on the channels.
+  void updateDitherTimer();
+  // Run one sigma-delta step on every dithered channel.
+  void ditherTick();
+  String channelTag(size_t index) const;
+  // Attach or release the GPIO interrupt used as trigger source.
+  void armTrigger(size_t index);
+  void disarmTrigger(Channel &ch);
+  // Collect GPIO edges and poll threshold inputs.
+  void pollTriggers();
+  void startBurst(Channel &ch, uint32_t atUs, const char *source);
+  void openGate(Channel &ch, bool open, uint32_t atUs, const char *source);
+  // True when the channel (or its master) currently produces a
+  // waveform rather than holding its idle level.
+  bool isRunning(const Channel &ch) const;
+  static void IRAM_ATTR onTriggerEdge(void *arg);
 };
 
 #endif // MINILABOESP_FUNCGEN_H
@@ -11,12 +11,15 @@
 #include "core/ConfigStore.h"
 #include "core/Logger.h"
 #include "core/IORegistry.h"
+#include "core/OutputRegistry.h"
 #include "devices/Dmm.h"
 #include "devices/Oled.h"
 #include "devices/FuncGen.h"
 #include "services/WebApi.h"
 #include "services/UdpService.h"
 #include "services/FileWriteService.h"
+#include "services/DataLogger.h"
+#include "services/OutputTester.h"
 
 // Prefix for the access point SSID. A unique suffix will be
 // appended based on the chip ID so that multiple boards can be
@@ -37,14 +40,18 @@
 ConfigStore configStore;
 Logger logger;
 IORegistry ioRegistry(&logger);
+OutputRegistry outputRegistry(&configStore, &logger);
 Dmm dmm(&ioRegistry, &logger, &configStore);
 Oled oled(&logger);
-FuncGen funcGen(&logger, &configStore);
+FuncGen funcGen(&logger, &configStore, &outputRegistry, &ioRegistry);
 // Create the file write service. This service will queue file
 // writes to avoid blocking the main loop. See FileWriteService for
 // details.
 FileWriteService fileWriteService;
+DataLogger dataLogger(&logger, &dmm, &ioRegistry);
 UdpService udpService(&configStore, &ioRegistry, &logger);
+// Output test patterns run as background jobs started from the web UI.
+OutputTester outputTester(&outputRegistry, &funcGen, &logger);
 WebApi webApi(&configStore, &ioRegistry, &dmm, &funcGen, &logger,
               &fileWriteService, &udpService);
 
@@ -98,6 +105,7 @@ void setup() {
   // documents and defaults can be applied later.
   configStore.begin();
   ioRegistry.begin(&configStore);
+  outputRegistry.begin();
 
   // Set up networking in AP+STA mode based on the configuration.
   setupWiFi();
@@ -108,8 +116,16 @@ void setup() {
   // reference the configuration and logger as required.
   oled.setConfigStore(&configStore);
   oled.setUdpService(&udpService);
+  udpService.setFuncGen(&funcGen);
+  funcGen.setFileWriteService(&fileWriteService);
+  funcGen.setOutputTester(&outputTester);
+  dataLogger.setFileWriteService(&fileWriteService);
+  webApi.setDataLogger(&dataLogger);
+  webApi.setOutputTester(&outputTester);
+  dmm.setOutputs(&outputRegistry, &funcGen);
   oled.begin();
   dmm.begin();
+  dataLogger.begin();
   funcGen.begin();
   if (g_wifiServicesEnabled) {
     webApi.begin();
@@ -141,7 +157,9 @@ void loop() {
   // Update devices. The DMM reads sensors, the function generator
   // updates its waveform and other periodic tasks can be added here.
   dmm.loop();
+  dataLogger.loop();
   funcGen.loop();
+  outputTester.loop();
 
   // Update the OLED once per second. Rendering takes time and
   // refreshing faster does not improve usability for status messages.
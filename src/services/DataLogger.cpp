@@ -0,0 +1,1025 @@
+// Implementation of the data logger
+
+#include "DataLogger.h"
+
+#include "core/Logger.h"
+#include "core/IORegistry.h"
+#include "devices/Dmm.h"
+#include "services/FileWriteService.h"
+#include <LittleFS.h>
+#include <math.h>
+#include <string.h>
+
+namespace {
+
+const char *kConfigPath = "/logger.json";
+// Directory of a dropped log, until its files are removed.
+const char *kTrashSuffix = ".del";
+// Rings of earlier versions, kept in a single file each.
+const char *const kLegacyPaths[] = {"/log/raw.bin", "/log/1s.bin",
+                                    "/log/1m.bin", "/log/1h.bin"};
+
+struct TierDef {
+  const char *name;
+  const char *path;
+  uint32_t bucketMs;
+  uint16_t blocks;
+};
+
+const TierDef kTiers[DataLogger::kTierCount] = {
+    {"1s", "/log/1s", 1000, DataLogger::kSecondBlocks},
+    {"1m", "/log/1m", 60000, DataLogger::kMinuteBlocks},
+    {"1h", "/log/1h", 3600000, DataLogger::kHourBlocks},
+};
+
+// A block spanning more than this is sealed: dt and span then always
+// fit in their fields (about 12 days).
+const uint64_t kMaxSpanMs = 0x3FFFFFFFUL;
+// Largest quantised value, so that the delta of two values fits in 32
+// bits.
+const float kMaxQuantum = 1e9f;
+
+uint8_t putVarint(uint8_t *out, uint32_t v) {
+  uint8_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+bool getVarint(const uint8_t *&p, const uint8_t *end, uint32_t &v) {
+  v = 0;
+  for (uint8_t shift = 0; p < end && shift < 35; shift += 7) {
+    uint8_t b = *p++;
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// Decimals needed to show one step of the given resolution.
+uint8_t decimalsFor(float resolution) {
+  uint8_t decimals = 0;
+  while (decimals < 6 && resolution < 0.999f) {
+    resolution *= 10.0f;
+    decimals++;
+  }
+  return decimals;
+}
+
+// printf on the ESP8266 has no 64-bit support.
+size_t formatU64(char *out, uint64_t v) {
+  char tmp[20];
+  size_t n = 0;
+  do {
+    tmp[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v);
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = tmp[n - 1 - i];
+  }
+  return n;
+}
+
+} // namespace
+
+DataLogger::DataLogger(Logger *logger, Dmm *dmm, IORegistry *io)
+    : m_logger(logger), m_dmm(dmm), m_io(io), m_files(nullptr),
+      m_enabled(false), m_intervalMs(1000), m_channelCount(0),
+      m_timeBase(0), m_millis64(0), m_lastMillis(0), m_lastSample(0),
+      m_lastFlushMs(0), m_records(0), m_purging(false) {
+  m_raw.name = "raw";
+  m_raw.path = "/log/raw";
+  m_raw.bucketMs = 0;
+  m_raw.width = 1;
+  m_raw.blocks = kRawBlocks;
+  m_raw.index = m_rawIndex;
+  IndexEntry *index = m_tierIndex;
+  for (size_t i = 0; i < kTierCount; ++i) {
+    Ring &ring = m_tiers[i];
+    ring.name = kTiers[i].name;
+    ring.path = kTiers[i].path;
+    ring.bucketMs = kTiers[i].bucketMs;
+    ring.width = 3;
+    ring.blocks = kTiers[i].blocks;
+    ring.index = index;
+    index += ring.blocks;
+  }
+  for (size_t i = 0; i <= kTierCount; ++i) {
+    Ring &ring = ringAt(i);
+    ring.head = 0;
+    ring.count = 0;
+    ring.nextSeq = 1;
+    ring.lastT = 0;
+    ring.dirty = false;
+    ring.acc.open = false;
+  }
+}
+
+void DataLogger::begin() {
+  loadConfig();
+  for (const char *path : kLegacyPaths) {
+    if (LittleFS.exists(path)) {
+      LittleFS.remove(path);
+    }
+  }
+  // A log dropped before the reboot may still have files to remove.
+  char trash[24];
+  for (size_t i = 0; i <= kTierCount; ++i) {
+    trashPath(ringAt(i), trash);
+    if (LittleFS.exists(trash)) {
+      m_purging = true;
+    }
+  }
+  // Continue the clock of the previous run, one second after its last
+  // record.
+  m_timeBase = 0;
+  for (size_t i = 0; i <= kTierCount; ++i) {
+    Ring &ring = ringAt(i);
+    openRing(ring);
+    if (ring.count && ring.lastT + 1000 > m_timeBase) {
+      m_timeBase = ring.lastT + 1000;
+    }
+  }
+  m_lastMillis = millis();
+  m_millis64 = 0;
+  m_lastSample = now();
+  m_lastFlushMs = millis();
+  if (m_logger) {
+    m_logger->info(String(F("DataLogger: ")) + m_raw.count + F("/") +
+                   m_raw.blocks + F(" blocs, ") + m_channelCount +
+                   F(" voies") + (m_enabled ? F("") : F(" (arrêté)")));
+  }
+}
+
+void DataLogger::loop() {
+  uint64_t t = now();
+  if (m_enabled && m_channelCount && t - m_lastSample >= m_intervalMs) {
+    // Keep the cadence, but do not try to catch up after a stall.
+    m_lastSample += m_intervalMs;
+    if (t - m_lastSample >= m_intervalMs) {
+      m_lastSample = t;
+    }
+    int32_t values[kMaxChannels];
+    uint8_t mask;
+    if (sample(values, mask)) {
+      append(m_raw, t, values, mask);
+      rollup(t, values, mask);
+      m_records++;
+    }
+  }
+  if (millis() - m_lastFlushMs >= kFlushMs) {
+    for (size_t i = 0; i <= kTierCount; ++i) {
+      Ring &ring = ringAt(i);
+      if (ring.dirty) {
+        writeBlock(ring, ring.head, ring.buf);
+      }
+    }
+    m_lastFlushMs = millis();
+  }
+  if (m_purging) {
+    m_purging = false;
+    for (size_t i = 0; i <= kTierCount && !m_purging; ++i) {
+      m_purging = purgeStep(ringAt(i));
+    }
+  }
+}
+
+uint64_t DataLogger::now() {
+  uint32_t ms = millis();
+  m_millis64 += (uint32_t)(ms - m_lastMillis);
+  m_lastMillis = ms;
+  return m_timeBase + m_millis64;
+}
+
+bool DataLogger::configure(JsonObjectConst obj, String &error) {
+  bool newLog = false;
+  if (!parseConfig(obj, error, newLog)) {
+    return false;
+  }
+  if (newLog) {
+    resetAll();
+    m_records = 0;
+  }
+  saveConfig();
+  m_lastSample = now();
+  if (m_logger) {
+    m_logger->info(String(F("DataLogger: configuration mise à jour")) +
+                   (newLog ? F(", nouveau journal") : F("")));
+  }
+  return true;
+}
+
+void DataLogger::clear() {
+  resetAll();
+  m_records = 0;
+  if (m_logger) {
+    m_logger->info(F("DataLogger: journal effacé"));
+  }
+}
+
+void DataLogger::describe(JsonObject obj) {
+  obj["enabled"] = m_enabled;
+  obj["interval_ms"] = m_intervalMs;
+  JsonArray channels = obj.createNestedArray("channels");
+  for (uint8_t c = 0; c < m_channelCount; ++c) {
+    JsonObject ch = channels.createNestedObject();
+    ch["source"] = m_channels[c].source;
+    ch["id"] = m_channels[c].id;
+    ch["resolution"] = m_channels[c].resolution;
+  }
+  obj["now_ms"] = now();
+  obj["records"] = m_records;
+  JsonObject storage = obj.createNestedObject("storage");
+  storage["path"] = m_raw.path;
+  storage["blocks"] = m_raw.blocks;
+  storage["block_bytes"] = (uint32_t)kBlockBytes;
+  storage["used_blocks"] = m_raw.count;
+  BlockHeader h;
+  memcpy(&h, m_raw.buf, sizeof(h));
+  storage["head_records"] = h.records;
+  storage["head_bytes"] = h.used;
+  if (m_raw.count) {
+    obj["oldest_ms"] = (uint64_t)m_raw.index[slotOf(m_raw, 0)].t0s * 1000;
+    obj["newest_ms"] = m_raw.lastT;
+  }
+  JsonArray tiers = obj.createNestedArray("tiers");
+  for (size_t i = 0; i <= kTierCount; ++i) {
+    Ring &ring = ringAt(i);
+    JsonObject tier = tiers.createNestedObject();
+    tier["name"] = ring.name;
+    tier["bucket_ms"] = ring.bucketMs;
+    tier["blocks"] = ring.blocks;
+    tier["used_blocks"] = ring.count;
+    if (ring.count) {
+      tier["oldest_ms"] = (uint64_t)ring.index[slotOf(ring, 0)].t0s * 1000;
+    }
+  }
+}
+
+void DataLogger::beginExport(const Query &q, Export &e) {
+  Ring &ring = ringFor(q);
+  e.q = q;
+  e.ring = &ring == &m_raw ? 0 : (uint8_t)(&ring - m_tiers + 1);
+  // Rows of every raw record carry the value itself, merged rows and
+  // tier records carry min, max and mean.
+  e.width = ring.width == 1 && !q.points ? 1 : 3;
+  // Records are merged per bucket, each row stamped with the start of
+  // its bucket.
+  e.bucket = q.points ? (q.to - q.from) / q.points + 1 : 0;
+  e.next = q.from;
+  e.acc.open = false;
+  e.rows = 0;
+  e.started = false;
+  e.done = q.to < q.from;
+}
+
+bool DataLogger::exportStep(Export &e, Print &out) {
+  const Query &q = e.q;
+  if (!e.started) {
+    e.started = true;
+    if (q.format == EXPORT_BINARY) {
+      uint8_t header[8] = {'M', 'L', 'G', '1', m_channelCount, e.width,
+                           0, 0};
+      out.write(header, sizeof(header));
+    } else {
+      out.print(F("t_ms"));
+      for (uint8_t c = 0; c < m_channelCount; ++c) {
+        if (e.width == 1) {
+          out.print(',');
+          out.print(m_channels[c].id);
+          continue;
+        }
+        static const char *const kSuffixes[] = {"_min", "_max", "_mean"};
+        for (const char *suffix : kSuffixes) {
+          out.print(',');
+          out.print(m_channels[c].id);
+          out.print(suffix);
+        }
+      }
+      out.print('\n');
+    }
+    return !e.done;
+  }
+  if (e.done) {
+    return false;
+  }
+
+  Ring &ring = ringAt(e.ring);
+  float values[kMaxChannels * 3];
+  // The first block holding a record not read yet. Blocks written since
+  // the last step are found the same way.
+  bool read = false;
+  bool past = false;
+  for (uint16_t i = firstBlockAfter(ring, e.next);
+       i < ring.count && !read && !past; ++i) {
+    const uint8_t *block;
+    if (!loadBlock(ring, i, block)) {
+      continue;
+    }
+    Cursor c;
+    beginCursor(c, block);
+    if (c.t > q.to) {
+      past = true;
+      break;
+    }
+    uint8_t mask;
+    while (nextRecord(c, mask)) {
+      if (c.t < e.next) {
+        continue;
+      }
+      if (c.t > q.to) {
+        past = true;
+        break;
+      }
+      read = true;
+      e.next = c.t + 1;
+      if (!e.bucket) {
+        for (uint8_t ch = 0; ch < m_channelCount; ++ch) {
+          for (uint8_t k = 0; k < ring.width; ++k) {
+            size_t v = ch * ring.width + k;
+            values[v] = c.prev[v] * m_channels[ch].resolution;
+          }
+        }
+        writeRow(out, q.format, e.width, c.t, values, mask);
+        e.rows++;
+        continue;
+      }
+      uint64_t start = q.from + (c.t - q.from) / e.bucket * e.bucket;
+      if (e.acc.open && start != e.acc.start) {
+        uint8_t empty = takeAggregate(e.acc, values);
+        writeRow(out, q.format, e.width, e.acc.start, values, empty);
+        e.rows++;
+        e.acc.open = false;
+      }
+      if (!e.acc.open) {
+        openAggregate(e.acc, start);
+      }
+      for (uint8_t ch = 0; ch < m_channelCount; ++ch) {
+        if (mask & (1 << ch)) {
+          continue;
+        }
+        float res = m_channels[ch].resolution;
+        if (ring.width == 1) {
+          float v = c.prev[ch] * res;
+          addToAggregate(e.acc, ch, v, v, v);
+        } else {
+          const int32_t *v = c.prev + ch * 3;
+          addToAggregate(e.acc, ch, v[0] * res, v[1] * res, v[2] * res);
+        }
+      }
+    }
+  }
+  if (read && !past) {
+    return true;
+  }
+  // A tier also holds the bucket being rolled up, not in any block yet.
+  if (e.ring && ring.acc.open && ring.acc.start >= e.next &&
+      ring.acc.start <= q.to && ring.acc.start + ring.bucketMs > q.from) {
+    Aggregate open = ring.acc;
+    float bucket[kMaxChannels * 3];
+    uint8_t empty = takeAggregate(open, bucket);
+    uint64_t start = ring.acc.start > q.from ? ring.acc.start : q.from;
+    if (!e.bucket) {
+      writeRow(out, q.format, e.width, start, bucket, empty);
+      e.rows++;
+    } else {
+      start = q.from + (start - q.from) / e.bucket * e.bucket;
+      if (e.acc.open && start != e.acc.start) {
+        uint8_t none = takeAggregate(e.acc, values);
+        writeRow(out, q.format, e.width, e.acc.start, values, none);
+        e.rows++;
+        e.acc.open = false;
+      }
+      if (!e.acc.open) {
+        openAggregate(e.acc, start);
+      }
+      for (uint8_t ch = 0; ch < m_channelCount; ++ch) {
+        if (!(empty & (1 << ch))) {
+          const float *v = bucket + ch * 3;
+          addToAggregate(e.acc, ch, v[0], v[1], v[2]);
+        }
+      }
+    }
+  }
+  if (e.acc.open) {
+    uint8_t empty = takeAggregate(e.acc, values);
+    writeRow(out, q.format, e.width, e.acc.start, values, empty);
+    e.rows++;
+    e.acc.open = false;
+  }
+  e.done = true;
+  return false;
+}
+
+DataLogger::Ring &DataLogger::ringFor(const Query &q) {
+  if (q.tier >= 0) {
+    return ringAt(q.tier < (int)kTierCount ? q.tier : kTierCount);
+  }
+  if (!q.points) {
+    return m_raw;
+  }
+  // The finest ring reaching back to from, its bucket no wider than a
+  // row if one of those does. Otherwise the one holding the oldest data.
+  uint64_t rowMs = q.to > q.from ? (q.to - q.from) / q.points : 0;
+  Ring *best = nullptr;
+  uint64_t bestOldest = 0;
+  for (size_t pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i <= kTierCount; ++i) {
+      Ring &ring = ringAt(i);
+      if (!ring.count || (!pass && ring.bucketMs > rowMs)) {
+        continue;
+      }
+      uint64_t oldest = (uint64_t)ring.index[slotOf(ring, 0)].t0s * 1000;
+      if (oldest <= q.from) {
+        return ring;
+      }
+      if (!best || oldest < bestOldest) {
+        best = &ring;
+        bestOldest = oldest;
+      }
+    }
+  }
+  return best ? *best : m_raw;
+}
+
+void DataLogger::rollup(uint64_t t, const int32_t *values, uint8_t mask) {
+  for (size_t i = 0; i < kTierCount; ++i) {
+    Ring &ring = m_tiers[i];
+    uint64_t start = t - t % ring.bucketMs;
+    if (ring.acc.open && start != ring.acc.start) {
+      closeBucket(ring);
+    }
+    if (!ring.acc.open) {
+      openAggregate(ring.acc, start);
+    }
+    for (uint8_t c = 0; c < m_channelCount; ++c) {
+      if (!(mask & (1 << c))) {
+        float v = values[c] * m_channels[c].resolution;
+        addToAggregate(ring.acc, c, v, v, v);
+      }
+    }
+  }
+}
+
+void DataLogger::closeBucket(Ring &ring) {
+  float values[kMaxChannels * 3];
+  uint8_t mask = takeAggregate(ring.acc, values);
+  ring.acc.open = false;
+  if (mask == (1 << m_channelCount) - 1) {
+    return;
+  }
+  int32_t quantised[kMaxChannels * 3];
+  for (uint8_t c = 0; c < m_channelCount; ++c) {
+    for (uint8_t k = 0; k < 3; ++k) {
+      quantised[c * 3 + k] =
+          (mask & (1 << c))
+              ? 0
+              : (int32_t)lroundf(values[c * 3 + k] / m_channels[c].resolution);
+    }
+  }
+  append(ring, ring.acc.start, quantised, mask);
+}
+
+void DataLogger::openAggregate(Aggregate &a, uint64_t start) {
+  memset(&a, 0, sizeof(a));
+  a.open = true;
+  a.start = start;
+}
+
+void DataLogger::addToAggregate(Aggregate &a, uint8_t channel, float min,
+                                float max, float mean) {
+  if (!a.count[channel] || min < a.min[channel]) {
+    a.min[channel] = min;
+  }
+  if (!a.count[channel] || max > a.max[channel]) {
+    a.max[channel] = max;
+  }
+  a.sum[channel] += mean;
+  a.count[channel]++;
+}
+
+uint8_t DataLogger::takeAggregate(Aggregate &a, float *out) const {
+  uint8_t mask = 0;
+  for (uint8_t c = 0; c < m_channelCount; ++c) {
+    if (!a.count[c]) {
+      mask |= 1 << c;
+      continue;
+    }
+    out[c * 3] = a.min[c];
+    out[c * 3 + 1] = a.max[c];
+    out[c * 3 + 2] = (float)(a.sum[c] / a.count[c]);
+  }
+  return mask;
+}
+
+void DataLogger::loadConfig() {
+  File f = LittleFS.open(kConfigPath, "r");
+  if (!f) {
+    return;
+  }
+  DynamicJsonDocument doc(1024);
+  DeserializationError err = deserializeJson(doc, f);
+  f.close();
+  String error;
+  bool newLog;
+  if (err) {
+    error = err.c_str();
+  } else {
+    parseConfig(doc.as<JsonObjectConst>(), error, newLog);
+  }
+  if (error.length() && m_logger) {
+    m_logger->warning(String(F("DataLogger: logger.json ")) + error);
+  }
+}
+
+bool DataLogger::parseConfig(JsonObjectConst obj, String &error,
+                             bool &newLog) {
+  uint32_t interval = obj["interval_ms"] | m_intervalMs;
+  if (interval < kMinIntervalMs) {
+    error = String(F("interval_ms must be at least ")) + kMinIntervalMs;
+    return false;
+  }
+  ChannelConfig channels[kMaxChannels];
+  uint8_t count = 0;
+  JsonVariantConst list = obj["channels"];
+  if (!list.isNull()) {
+    if (!list.is<JsonArrayConst>() || list.size() > kMaxChannels) {
+      error = String(F("channels must be an array of at most ")) +
+              kMaxChannels + F(" entries");
+      return false;
+    }
+    for (JsonObjectConst entry : list.as<JsonArrayConst>()) {
+      ChannelConfig &c = channels[count];
+      c.source = entry["source"] | "dmm";
+      c.id = entry["id"] | "";
+      c.resolution = entry["resolution"] | 0.001f;
+      c.fromDmm = c.source == "dmm";
+      if (!c.fromDmm && c.source != "io") {
+        error = String(F("unknown source ")) + c.source;
+        return false;
+      }
+      if (!c.id.length()) {
+        error = F("missing channel id");
+        return false;
+      }
+      if (!c.fromDmm && m_io->find(c.id) < 0) {
+        error = String(F("unknown io ")) + c.id;
+        return false;
+      }
+      if (!(c.resolution >= 1e-6f && c.resolution <= 1e6f)) {
+        error = String(F("invalid resolution for ")) + c.id;
+        return false;
+      }
+      c.decimals = decimalsFor(c.resolution);
+      count++;
+    }
+  }
+
+  newLog = false;
+  if (!list.isNull()) {
+    newLog = count != m_channelCount;
+    for (uint8_t c = 0; c < count && !newLog; ++c) {
+      newLog = channels[c].fromDmm != m_channels[c].fromDmm ||
+               channels[c].id != m_channels[c].id ||
+               channels[c].resolution != m_channels[c].resolution;
+    }
+    for (uint8_t c = 0; c < count; ++c) {
+      m_channels[c] = channels[c];
+    }
+    m_channelCount = count;
+  }
+  m_enabled = obj["enabled"] | m_enabled;
+  m_intervalMs = interval;
+  return true;
+}
+
+void DataLogger::saveConfig() {
+  DynamicJsonDocument doc(1024);
+  doc["enabled"] = m_enabled;
+  doc["interval_ms"] = m_intervalMs;
+  JsonArray channels = doc.createNestedArray("channels");
+  for (uint8_t c = 0; c < m_channelCount; ++c) {
+    JsonObject ch = channels.createNestedObject();
+    ch["source"] = m_channels[c].source;
+    ch["id"] = m_channels[c].id;
+    ch["resolution"] = m_channels[c].resolution;
+  }
+  String out;
+  serializeJson(doc, out);
+  if (m_files) {
+    m_files->enqueue(kConfigPath, out);
+    return;
+  }
+  File f = LittleFS.open(kConfigPath, "w");
+  if (f) {
+    f.print(out);
+    f.close();
+  }
+}
+
+void DataLogger::openRing(Ring &ring) {
+  // The head is the valid block with the highest sequence number.
+  BlockHeader h;
+  uint32_t headSeq = 0;
+  Dir dir = LittleFS.openDir(ring.path);
+  while (dir.next()) {
+    int slot = dir.fileName().toInt();
+    if (slot < 0 || slot >= ring.blocks || !readHeader(ring, slot, h)) {
+      continue;
+    }
+    ring.index[slot].t0s = (uint32_t)(h.t0 / 1000);
+    ring.index[slot].t1s = (uint32_t)((h.t0 + h.span) / 1000);
+    if (h.seq > headSeq) {
+      headSeq = h.seq;
+      ring.head = slot;
+    }
+    yield();
+  }
+  if (!headSeq) {
+    resetRing(ring);
+    return;
+  }
+
+  // Walk back from the head while the sequence numbers follow.
+  ring.count = 1;
+  while (ring.count < ring.blocks) {
+    uint16_t slot = (ring.head + ring.blocks - ring.count) % ring.blocks;
+    if (!readHeader(ring, slot, h) || h.seq != headSeq - ring.count) {
+      break;
+    }
+    ring.count++;
+  }
+  if (!readBlock(ring, ring.head, ring.buf)) {
+    resetRing(ring);
+    return;
+  }
+  ring.nextSeq = headSeq + 1;
+  rebuildEncoder(ring);
+  ring.dirty = false;
+}
+
+bool DataLogger::readHeader(const Ring &ring, uint16_t slot,
+                            BlockHeader &h) {
+  char path[24];
+  slotPath(ring, slot, path);
+  File f = LittleFS.open(path, "r");
+  if (!f) {
+    return false;
+  }
+  size_t n = f.read((uint8_t *)&h, sizeof(h));
+  f.close();
+  return n == sizeof(h) && h.magic == kMagic && h.seq &&
+         h.width == ring.width && h.channels == m_channelCount &&
+         h.records && h.used <= kBlockBytes - sizeof(BlockHeader);
+}
+
+void DataLogger::resetRing(Ring &ring) {
+  LittleFS.mkdir("/log");
+  Dir dir = LittleFS.openDir(ring.path);
+  if (dir.next()) {
+    // Finish the removal of a log dropped just before.
+    while (purgeStep(ring)) {
+      yield();
+    }
+    char trash[24];
+    trashPath(ring, trash);
+    if (LittleFS.rename(ring.path, trash)) {
+      m_purging = true;
+    } else if (m_logger) {
+      m_logger->error(String(F("DataLogger: impossible d'effacer ")) +
+                      ring.path);
+    }
+  }
+  LittleFS.mkdir(ring.path);
+  ring.head = 0;
+  ring.count = 0;
+  ring.nextSeq = 1;
+  ring.acc.open = false;
+  startBlock(ring);
+}
+
+void DataLogger::resetAll() {
+  for (size_t i = 0; i <= kTierCount; ++i) {
+    resetRing(ringAt(i));
+  }
+}
+
+bool DataLogger::purgeStep(const Ring &ring) {
+  char path[24];
+  trashPath(ring, path);
+  if (!LittleFS.exists(path)) {
+    return false;
+  }
+  Dir dir = LittleFS.openDir(path);
+  if (!dir.next()) {
+    LittleFS.rmdir(path);
+    return false;
+  }
+  return LittleFS.remove(String(path) + '/' + dir.fileName());
+}
+
+void DataLogger::slotPath(const Ring &ring, uint16_t slot, char *out) {
+  snprintf(out, 24, "%s/%03u", ring.path, (unsigned)slot);
+}
+
+void DataLogger::trashPath(const Ring &ring, char *out) {
+  snprintf(out, 24, "%s%s", ring.path, kTrashSuffix);
+}
+
+void DataLogger::startBlock(Ring &ring) {
+  memset(ring.buf, 0, kBlockBytes);
+  BlockHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = kMagic;
+  h.width = ring.width;
+  h.channels = m_channelCount;
+  h.seq = ring.nextSeq++;
+  memcpy(ring.buf, &h, sizeof(h));
+  ring.lastT = 0;
+  memset(ring.prev, 0, sizeof(ring.prev));
+  ring.dirty = false;
+}
+
+uint8_t DataLogger::encodeRecord(uint8_t *out, const Ring &ring, uint64_t t,
+                                 const int32_t *values, uint8_t mask,
+                                 bool fresh) const {
+  uint32_t dt = fresh ? 0 : (uint32_t)(t - ring.lastT);
+  uint8_t n = putVarint(out, dt << 1 | (mask ? 1 : 0));
+  if (mask) {
+    out[n++] = mask;
+  }
+  for (uint8_t c = 0; c < m_channelCount; ++c) {
+    if (mask & (1 << c)) {
+      continue;
+    }
+    for (uint8_t k = 0; k < ring.width; ++k) {
+      size_t v = c * ring.width + k;
+      n += putVarint(out + n, zigzag(values[v] - ring.prev[v]));
+    }
+  }
+  return n;
+}
+
+void DataLogger::append(Ring &ring, uint64_t t, const int32_t *values,
+                        uint8_t mask) {
+  BlockHeader h;
+  memcpy(&h, ring.buf, sizeof(h));
+  if (h.records && (t < ring.lastT || t - h.t0 > kMaxSpanMs)) {
+    sealBlock(ring);
+    memcpy(&h, ring.buf, sizeof(h));
+  }
+  uint8_t record[kMaxRecordBytes];
+  uint8_t n = encodeRecord(record, ring, t, values, mask, !h.records);
+  if (sizeof(h) + h.used + n > kBlockBytes) {
+    sealBlock(ring);
+    memcpy(&h, ring.buf, sizeof(h));
+    n = encodeRecord(record, ring, t, values, mask, true);
+  }
+  if (!h.records) {
+    h.t0 = t;
+    if (ring.count < ring.blocks) {
+      ring.count++;
+    }
+  }
+  memcpy(ring.buf + sizeof(h) + h.used, record, n);
+  h.used += n;
+  h.records++;
+  h.span = (uint32_t)(t - h.t0);
+  memcpy(ring.buf, &h, sizeof(h));
+  ring.lastT = t;
+  for (uint8_t c = 0; c < m_channelCount; ++c) {
+    if (!(mask & (1 << c))) {
+      for (uint8_t k = 0; k < ring.width; ++k) {
+        ring.prev[c * ring.width + k] = values[c * ring.width + k];
+      }
+    }
+  }
+  ring.dirty = true;
+  updateIndex(ring);
+}
+
+void DataLogger::sealBlock(Ring &ring) {
+  writeBlock(ring, ring.head, ring.buf);
+  ring.head = (ring.head + 1) % ring.blocks;
+  // The slot taken by the new head held the oldest block.
+  if (ring.count >= ring.blocks) {
+    ring.count = ring.blocks - 1;
+  }
+  startBlock(ring);
+}
+
+void DataLogger::writeBlock(Ring &ring, uint16_t slot, const uint8_t *data) {
+  char path[24];
+  slotPath(ring, slot, path);
+  File f = LittleFS.open(path, "w");
+  size_t written = 0;
+  if (f) {
+    written = f.write(data, kBlockBytes);
+    f.close();
+  }
+  if (written != kBlockBytes && m_logger) {
+    m_logger->warning(String(F("DataLogger: écriture du bloc ")) + slot +
+                      F(" échouée"));
+  }
+  if (slot == ring.head) {
+    ring.dirty = false;
+  }
+}
+
+bool DataLogger::readBlock(const Ring &ring, uint16_t slot, uint8_t *out) {
+  char path[24];
+  slotPath(ring, slot, path);
+  File f = LittleFS.open(path, "r");
+  if (!f) {
+    return false;
+  }
+  size_t n = f.read(out, kBlockBytes);
+  f.close();
+  BlockHeader h;
+  memcpy(&h, out, sizeof(h));
+  return n == kBlockBytes && h.magic == kMagic;
+}
+
+bool DataLogger::loadBlock(Ring &ring, uint16_t logical,
+                           const uint8_t *&data) {
+  uint16_t slot = slotOf(ring, logical);
+  if (slot == ring.head) {
+    data = ring.buf;
+    return true;
+  }
+  if (!readBlock(ring, slot, m_scratch)) {
+    return false;
+  }
+  data = m_scratch;
+  return true;
+}
+
+uint16_t DataLogger::slotOf(const Ring &ring, uint16_t logical) const {
+  return (ring.head + ring.blocks - (ring.count - 1) + logical) % ring.blocks;
+}
+
+uint16_t DataLogger::firstBlockAfter(const Ring &ring, uint64_t from) const {
+  uint32_t fromS = (uint32_t)(from / 1000);
+  uint16_t lo = 0;
+  uint16_t hi = ring.count;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if (ring.index[slotOf(ring, mid)].t1s < fromS) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+void DataLogger::beginCursor(Cursor &c, const uint8_t *block) const {
+  BlockHeader h;
+  memcpy(&h, block, sizeof(h));
+  size_t used = h.used;
+  if (used > kBlockBytes - sizeof(h)) {
+    used = kBlockBytes - sizeof(h);
+  }
+  c.p = block + sizeof(h);
+  c.end = c.p + used;
+  c.t = h.t0;
+  c.width = h.width <= 3 ? h.width : 3;
+  memset(c.prev, 0, sizeof(c.prev));
+  c.left = h.records;
+}
+
+bool DataLogger::nextRecord(Cursor &c, uint8_t &mask) const {
+  if (!c.left) {
+    return false;
+  }
+  uint32_t v;
+  if (!getVarint(c.p, c.end, v)) {
+    c.left = 0;
+    return false;
+  }
+  c.t += v >> 1;
+  mask = 0;
+  if (v & 1) {
+    if (c.p >= c.end) {
+      c.left = 0;
+      return false;
+    }
+    mask = *c.p++;
+  }
+  for (uint8_t ch = 0; ch < m_channelCount; ++ch) {
+    if (mask & (1 << ch)) {
+      continue;
+    }
+    for (uint8_t k = 0; k < c.width; ++k) {
+      if (!getVarint(c.p, c.end, v)) {
+        c.left = 0;
+        return false;
+      }
+      c.prev[ch * c.width + k] += unzigzag(v);
+    }
+  }
+  c.left--;
+  return true;
+}
+
+void DataLogger::rebuildEncoder(Ring &ring) {
+  BlockHeader h;
+  memcpy(&h, ring.buf, sizeof(h));
+  Cursor c;
+  beginCursor(c, ring.buf);
+  const uint8_t *start = c.p;
+  const uint8_t *good = c.p;
+  uint16_t records = 0;
+  uint8_t mask;
+  ring.lastT = h.t0;
+  while (nextRecord(c, mask)) {
+    ring.lastT = c.t;
+    good = c.p;
+    records++;
+  }
+  memcpy(ring.prev, c.prev, sizeof(ring.prev));
+  // Drop a damaged tail (power lost during a write).
+  if (records != h.records) {
+    h.records = records;
+    h.used = (uint16_t)(good - start);
+    h.span = (uint32_t)(ring.lastT - h.t0);
+    memcpy(ring.buf, &h, sizeof(h));
+  }
+}
+
+void DataLogger::updateIndex(Ring &ring) {
+  BlockHeader h;
+  memcpy(&h, ring.buf, sizeof(h));
+  ring.index[ring.head].t0s = (uint32_t)(h.t0 / 1000);
+  ring.index[ring.head].t1s = (uint32_t)((h.t0 + h.span) / 1000);
+}
+
+void DataLogger::writeRow(Print &out, ExportFormat format, uint8_t width,
+                          uint64_t t, const float *values,
+                          uint8_t mask) const {
+  if (format == EXPORT_BINARY) {
+    int64_t ts = (int64_t)t;
+    out.write((const uint8_t *)&ts, sizeof(ts));
+    for (uint8_t c = 0; c < m_channelCount; ++c) {
+      for (uint8_t k = 0; k < width; ++k) {
+        float v = (mask & (1 << c)) ? NAN : values[c * width + k];
+        out.write((const uint8_t *)&v, sizeof(v));
+      }
+    }
+    return;
+  }
+  char line[24 + kMaxChannels * 3 * 20];
+  size_t n = formatU64(line, t);
+  for (uint8_t c = 0; c < m_channelCount; ++c) {
+    for (uint8_t k = 0; k < width; ++k) {
+      line[n++] = ',';
+      if (!(mask & (1 << c))) {
+        dtostrf(values[c * width + k], 0, m_channels[c].decimals, line + n);
+        n += strlen(line + n);
+      }
+    }
+  }
+  line[n++] = '\n';
+  out.write((const uint8_t *)line, n);
+}
+
+bool DataLogger::sample(int32_t *values, uint8_t &mask) {
+  mask = 0;
+  for (uint8_t c = 0; c < m_channelCount; ++c) {
+    const ChannelConfig &cfg = m_channels[c];
+    // Resolved on every sample: DMM and IO indexes change when their
+    // configuration is reloaded.
+    float v = NAN;
+    bool ok;
+    if (cfg.fromDmm) {
+      ok = m_dmm->latest(m_dmm->findChannel(cfg.id), v);
+    } else {
+      int handle = m_io->find(cfg.id);
+      ok = handle >= 0;
+      if (ok) {
+        v = m_io->convertAt(handle, m_io->readRawAt(handle));
+      }
+    }
+    float q = v / cfg.resolution;
+    if (!ok || isnan(q) || fabsf(q) > kMaxQuantum) {
+      mask |= 1 << c;
+      values[c] = 0;
+      continue;
+    }
+    values[c] = (int32_t)lroundf(q);
+  }
+  return mask != (1 << m_channelCount) - 1;
+}
@@ -0,0 +1,274 @@
+// DataLogger records selected DMM or IORegistry channels at a fixed
+// interval into a ring of block files on LittleFS.
+//
+// The ring (/log/raw) holds up to kRawBlocks blocks of kBlockBytes,
+// one file per slot (/log/raw/017). A block is always written whole,
+// replacing its file: LittleFS copies a file from the point of a write
+// to its end, so rewriting a block inside one large file would copy
+// the rest of the ring on every flush. Each block starts with a header
+// (sequence number, time of its first record, time span, record count)
+// followed by records:
+//
+//   varint(dt_ms << 1 | has_mask) [mask byte] zigzag varint(delta)...
+//
+// dt is the time since the previous record of the block and each value
+// is stored as the difference with the previous value of its channel,
+// quantised to the channel "resolution". The first record of a block
+// is relative to zero, so every block can be decoded on its own and
+// the oldest one can be overwritten without touching the others. The
+// block being filled lives in RAM and is written back every
+// kFlushMs and when it is full.
+//
+// Every sample also updates rollup tiers of 1 s, 1 min and 1 h
+// buckets (/log/1s, /log/1m, /log/1h). They use the same
+// ring format with three values per channel (min, max, mean) and a
+// record per bucket, written when the next bucket starts; a bucket
+// still open at reboot is lost. The coarser the tier, the longer the
+// history it holds.
+//
+// Time is "logger time": milliseconds, monotonic across reboots (the
+// time spent powered off is not counted). A RAM index holds the time
+// range of every block so a query only reads the blocks it needs.
+// An export streams CSV or binary rows to any Print one block at a
+// time (exportStep()), merging records into at most "points" rows of
+// min/max/mean, so hours of data can be downloaded without loading them
+// into RAM or holding loop() for the whole transfer. Unless a tier is
+// requested, it reads the finest ring that reaches back to the start of
+// the query, preferring those whose bucket fits the span divided by the
+// points, so a chart is as detailed as the history allows. The bucket
+// a tier is still rolling up is included.
+//
+// The configuration is kept in /logger.json:
+//   {"enabled": true, "interval_ms": 1000,
+//    "channels": [{"source": "dmm" | "io", "id": "ADS0",
+//                  "resolution": 0.001}]}
+// Changing the list of channels starts a new log. A log is dropped by
+// renaming its directories (/log/raw.del...), which is immediate; the
+// files are then removed one per pass of loop().
+
+#ifndef MINILABOESP_DATALOGGER_H
+#define MINILABOESP_DATALOGGER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+class Logger;
+class Dmm;
+class IORegistry;
+class FileWriteService;
+
+class DataLogger {
+public:
+  static const size_t kMaxChannels = 4;
+  static const size_t kBlockBytes = 512;
+  static const uint16_t kRawBlocks = 128;
+  static const uint16_t kSecondBlocks = 64;
+  static const uint16_t kMinuteBlocks = 32;
+  static const uint16_t kHourBlocks = 16;
+  static const size_t kTierCount = 3;
+  static const uint32_t kMinIntervalMs = 100;
+  static const uint32_t kFlushMs = 60000;
+
+  enum ExportFormat { EXPORT_CSV, EXPORT_BINARY };
+
+  struct Query {
+    uint64_t from; // logger time (ms), inclusive
+    uint64_t to;   // logger time (ms), inclusive
+    uint32_t points; // maximum number of rows, 0 = every record
+    int tier;        // -1 = automatic, 0 = raw, 1..3 = 1 s, 1 min, 1 h
+    ExportFormat format;
+  };
+
+  DataLogger(Logger *logger, Dmm *dmm, IORegistry *io);
+
+  // Used to save /logger.json without blocking the caller.
+  void setFileWriteService(FileWriteService *files) { m_files = files; }
+
+  // Load /logger.json, open the rings and rebuild the block index.
+  // Call after LittleFS is mounted and the DMM started.
+  void begin();
+
+  // Take a sample when the interval has elapsed, flush the current
+  // block when needed and remove a file of a dropped log.
+  void loop();
+
+  // Replace the configuration (layout above) and save it. Returns false
+  // with a reason in error if it is invalid.
+  bool configure(JsonObjectConst obj, String &error);
+
+  // Drop every recorded block.
+  void clear();
+
+  // Current logger time in milliseconds.
+  uint64_t now();
+
+  // Configuration, storage usage and time range of the log.
+  void describe(JsonObject obj);
+
+  struct Export;
+
+  // Start an export of the records between q.from and q.to. Rows hold
+  // one value per channel when every raw record is requested, otherwise
+  // min, max and mean per channel for the bucket starting at the row
+  // time. CSV rows are "t_ms,<value>..." after a header line; binary
+  // output starts with "MLG1", the channel count, the values per
+  // channel and two reserved bytes, then rows of an int64 time and one
+  // float per value (NaN when missing), little endian.
+  void beginExport(const Query &q, Export &e);
+
+  // Write the header or the rows of the next block to out. Returns
+  // false once the export is complete. Records logged between two
+  // steps are included if they fall in the range.
+  bool exportStep(Export &e, Print &out);
+
+private:
+  struct ChannelConfig {
+    String source;
+    String id;
+    bool fromDmm;
+    float resolution;
+    uint8_t decimals; // CSV decimals, from the resolution
+  };
+
+  // On-flash block header, followed by the encoded records.
+  struct BlockHeader {
+    uint16_t magic;
+    uint8_t width;    // values per channel in a record
+    uint8_t channels;
+    uint32_t seq;     // 0 for an empty slot
+    uint64_t t0;      // time of the first record
+    uint32_t span;    // time from t0 to the last record
+    uint16_t records;
+    uint16_t used;    // bytes of records after the header
+  };
+
+  struct IndexEntry {
+    uint32_t t0s; // first and last record time, in seconds
+    uint32_t t1s;
+  };
+
+  // Min, max and mean per channel over a bucket of time.
+  struct Aggregate {
+    bool open;
+    uint64_t start;
+    float min[kMaxChannels];
+    float max[kMaxChannels];
+    double sum[kMaxChannels];
+    uint32_t count[kMaxChannels];
+  };
+
+public:
+  // State of an export between two steps.
+  struct Export {
+    Query q;
+    uint8_t ring;     // ringAt() index
+    uint8_t width;    // values per channel in a row
+    uint64_t bucket;  // row width (ms), 0 = every record
+    uint64_t next;    // time of the next record to read
+    Aggregate acc;
+    size_t rows;
+    bool started;
+    bool done;
+  };
+
+private:
+  // One ring directory with its RAM index and the block being filled.
+  struct Ring {
+    const char *name;
+    const char *path; // directory of the block files
+    uint32_t bucketMs; // 0 for raw samples
+    uint8_t width;     // values per channel: 1 raw, 3 rollups
+    uint16_t blocks;
+    IndexEntry *index;
+    uint16_t head;  // slot of the block being filled
+    uint16_t count; // slots holding data, head included
+    uint32_t nextSeq;
+    uint8_t buf[kBlockBytes];
+    // Encoder state of the head block.
+    uint64_t lastT;
+    int32_t prev[kMaxChannels * 3];
+    bool dirty;
+    Aggregate acc; // bucket being rolled up (tiers only)
+  };
+
+  // Decoder over one block.
+  struct Cursor {
+    const uint8_t *p;
+    const uint8_t *end;
+    uint64_t t;
+    int32_t prev[kMaxChannels * 3];
+    uint8_t width;
+    uint16_t left;
+  };
+
+  static const uint16_t kMagic = 0x474C; // "LG"
+  // Worst case record: dt, mask and one 5-byte varint per channel.
+  static const size_t kMaxRecordBytes = 6 + kMaxChannels * 3 * 5;
+
+  void loadConfig();
+  bool parseConfig(JsonObjectConst obj, String &error, bool &newLog);
+  void saveConfig();
+  void openRing(Ring &ring);
+  // Set the files of the ring aside for removal and start an empty log.
+  void resetRing(Ring &ring);
+  void startBlock(Ring &ring);
+  void resetAll();
+  // Remove one file of a dropped log; returns false when none is left.
+  bool purgeStep(const Ring &ring);
+  static void slotPath(const Ring &ring, uint16_t slot, char *out);
+  static void trashPath(const Ring &ring, char *out);
+  bool readHeader(const Ring &ring, uint16_t slot, BlockHeader &h);
+  // Ring i: 0 is raw, then the tiers from the finest.
+  Ring &ringAt(size_t i) { return i ? m_tiers[i - 1] : m_raw; }
+  Ring &ringFor(const Query &q);
+  // Feed a sample to the tiers, closing the buckets it ends.
+  void rollup(uint64_t t, const int32_t *values, uint8_t mask);
+  void closeBucket(Ring &ring);
+  static void openAggregate(Aggregate &a, uint64_t start);
+  static void addToAggregate(Aggregate &a, uint8_t channel, float min,
+                             float max, float mean);
+  // Write min, max and mean per channel to out; returns the mask of
+  // channels without data.
+  uint8_t takeAggregate(Aggregate &a, float *out) const;
+  void append(Ring &ring, uint64_t t, const int32_t *values, uint8_t mask);
+  void sealBlock(Ring &ring);
+  void writeBlock(Ring &ring, uint16_t slot, const uint8_t *data);
+  bool readBlock(const Ring &ring, uint16_t slot, uint8_t *out);
+  bool loadBlock(Ring &ring, uint16_t logical, const uint8_t *&data);
+  uint16_t slotOf(const Ring &ring, uint16_t logical) const;
+  uint16_t firstBlockAfter(const Ring &ring, uint64_t from) const;
+  void beginCursor(Cursor &c, const uint8_t *block) const;
+  bool nextRecord(Cursor &c, uint8_t &mask) const;
+  void rebuildEncoder(Ring &ring);
+  void updateIndex(Ring &ring);
+  void writeRow(Print &out, ExportFormat format, uint8_t width,
+                uint64_t t, const float *values, uint8_t mask) const;
+  bool sample(int32_t *values, uint8_t &mask);
+  uint8_t encodeRecord(uint8_t *out, const Ring &ring, uint64_t t,
+                       const int32_t *values, uint8_t mask,
+                       bool fresh) const;
+
+  Logger *m_logger;
+  Dmm *m_dmm;
+  IORegistry *m_io;
+  FileWriteService *m_files;
+  bool m_enabled;
+  uint32_t m_intervalMs;
+  ChannelConfig m_channels[kMaxChannels];
+  uint8_t m_channelCount;
+  // Logger clock: 64-bit milliseconds continued across reboots.
+  uint64_t m_timeBase;
+  uint64_t m_millis64;
+  uint32_t m_lastMillis;
+  uint64_t m_lastSample;
+  uint32_t m_lastFlushMs;
+  uint32_t m_records;
+  bool m_purging; // files of a dropped log are left to remove
+  Ring m_raw;
+  Ring m_tiers[kTierCount];
+  IndexEntry m_rawIndex[kRawBlocks];
+  IndexEntry m_tierIndex[kSecondBlocks + kMinuteBlocks + kHourBlocks];
+  uint8_t m_scratch[kBlockBytes];
+};
+
+#endif // MINILABOESP_DATALOGGER_H
@@ -71,10 +71,22 @@ void FileWriteService::loop() {
   }
   // Task complete
   Serial.println(String(F("[FS] Write complete: ")) + task.path);
+  m_completed++;
   m_busy = false;
 }
 
 void FileWriteService::enqueue(const String &path, const String &contents) {
+  // A write for the same file that has not started yet would be
+  // overwritten anyway: replace its contents instead of queueing.
+  for (size_t i = 0; i < m_count; ++i) {
+    Task &task = m_tasks[(m_head + i) % kMaxQueueLength];
+    if (task.path == path) {
+      task.contents = contents;
+      m_coalesced++;
+      Serial.println(String(F("[FS] Coalesced write for ")) + path);
+      return;
+    }
+  }
   if (m_count >= kMaxQueueLength) {
     Serial.println(String(F("[FS] Queue full, dropping write for ")) + path);
     return;
@@ -8,6 +8,10 @@
 // could trigger the watchdog or cause reboots.  The service writes to
 // a temporary file and renames it to ensure atomicity.  Pending
 // entries can be queried via a web API to aid debugging.
+//
+// Requests for a path that is already waiting in the queue are
+// coalesced: the queued contents are replaced so only the latest
+// state reaches the flash.
 
 #pragma once
 
@@ -21,12 +25,16 @@ public:
   void loop();
   // Add a new write request. The contents string will be written to
   // the specified path. If a previous request for the same path is
-  // pending it is not deduplicated – both writes will happen in
-  // order. The caller must ensure the contents persist until the
+  // still pending its contents are replaced and the queue position is
+  // kept. The caller must ensure the contents persist until the
   // write occurs (String is copied by value here).
   void enqueue(const String &path, const String &contents);
   // Number of pending write requests.
   size_t pending() const;
+  // Number of requests merged into an already queued write.
+  uint32_t coalesced() const { return m_coalesced; }
+  // Number of files written since boot.
+  uint32_t completed() const { return m_completed; }
 
 private:
   static constexpr size_t kMaxQueueLength = 8;
@@ -39,4 +47,6 @@ private:
   size_t m_tail{0};
   size_t m_count{0};
   bool m_busy{false};
+  uint32_t m_coalesced{0};
+  uint32_t m_completed{0};
 };
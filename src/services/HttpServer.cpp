@@ -0,0 +1,1106 @@
+// Implementation of the polled HTTP server
+
+#include "HttpServer.h"
+
+#include <Hash.h>
+#include <base64.h>
+
+namespace {
+
+// Bytes moved per read or file chunk. Larger writes are split by the
+// room left in the TCP send buffer anyway.
+const size_t kChunkBytes = 512;
+
+const char kEmptyString[] = "";
+
+// A chunk source is asked for more once less than this waits.
+const size_t kChunkLowWater = 1024;
+
+void appendChunk(String &out, const char *data, size_t length) {
+  char size[12];
+  snprintf(size, sizeof(size), "%X\r\n", (unsigned)length);
+  out += size;
+  out.concat(data, length);
+  out += F("\r\n");
+}
+
+// Print framing what is written as chunks appended to a connection's
+// output buffer.
+class ChunkWriter : public Print {
+public:
+  explicit ChunkWriter(String &out) : m_out(out) {}
+  ~ChunkWriter() { flush(); }
+
+  size_t write(uint8_t c) override {
+    m_buf[m_len++] = (char)c;
+    if (m_len == sizeof(m_buf)) {
+      flush();
+    }
+    return 1;
+  }
+
+  void flush() override {
+    if (m_len) {
+      appendChunk(m_out, m_buf, m_len);
+      m_len = 0;
+    }
+  }
+
+private:
+  String &m_out;
+  char m_buf[kChunkBytes];
+  size_t m_len = 0;
+};
+
+const char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+enum {
+  WS_OP_TEXT = 0x1,
+  WS_OP_CLOSE = 0x8,
+  WS_OP_PING = 0x9,
+  WS_OP_PONG = 0xA,
+};
+
+// Header of an unmasked server frame; returns its size.
+size_t frameHeader(uint8_t *out, uint8_t opcode, size_t length) {
+  out[0] = 0x80 | opcode;
+  if (length < 126) {
+    out[1] = (uint8_t)length;
+    return 2;
+  }
+  if (length < 65536) {
+    out[1] = 126;
+    out[2] = (uint8_t)(length >> 8);
+    out[3] = (uint8_t)length;
+    return 4;
+  }
+  out[1] = 127;
+  for (int i = 0; i < 8; ++i) {
+    out[2 + i] = (uint8_t)((uint64_t)length >> (56 - 8 * i));
+  }
+  return 10;
+}
+
+} // namespace
+
+HttpServer::HttpServer(uint16_t port)
+    : m_server(port), m_routeCount(0), m_staticFs(nullptr),
+      m_flashLookup(nullptr), m_wsUri(nullptr), m_current(nullptr),
+      m_contentLength(kLengthNotSet) {
+  for (size_t i = 0; i < kMaxClients; ++i) {
+    m_connections[i].state = STATE_FREE;
+  }
+  resetStats();
+}
+
+void HttpServer::on(const char *uri, HTTPMethod method, Handler handler) {
+  if (m_routeCount >= kMaxRoutes) {
+    Serial.println(String(F("[HTTP] Too many routes, ignoring ")) + uri);
+    return;
+  }
+  Route &route = m_routes[m_routeCount++];
+  route.uri = uri;
+  route.method = method;
+  route.handler = handler;
+}
+
+void HttpServer::serveStatic(const char *uri, fs::FS &fs, const char *path) {
+  m_staticFs = &fs;
+  m_staticUri = uri;
+  m_staticPath = path;
+}
+
+void HttpServer::onWebSocket(const char *uri, WebSocketHandler handler) {
+  m_wsUri = uri;
+  m_wsHandler = handler;
+}
+
+bool HttpServer::sendText(uint8_t client, const String &text) {
+  if (client >= kMaxClients) {
+    return false;
+  }
+  Connection &conn = m_connections[client];
+  if (conn.state != STATE_WEBSOCKET || conn.outPos < conn.out.length()) {
+    return false;
+  }
+  // The header goes out now, the payload is drained like a response.
+  uint8_t header[10];
+  size_t n = frameHeader(header, WS_OP_TEXT, text.length());
+  if ((size_t)conn.client.availableForWrite() < n) {
+    return false;
+  }
+  conn.client.write(header, n);
+  conn.out = text;
+  conn.outPos = 0;
+  drain(conn);
+  return true;
+}
+
+int HttpServer::beginEventStream() {
+  Connection *conn = m_current;
+  if (!conn || conn->responded || conn->method != HTTP_GET) {
+    return -1;
+  }
+  conn->responded = true;
+  conn->keepAlive = false;
+  conn->out = F("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                "Cache-Control: no-cache\r\nConnection: close\r\n");
+  conn->out += m_headers;
+  conn->out += F("\r\n");
+  m_headers = String();
+  m_contentLength = kLengthNotSet;
+  conn->state = STATE_STREAM;
+  return conn - m_connections;
+}
+
+bool HttpServer::sendEvent(uint8_t client, const char *event,
+                           const String &data) {
+  if (client >= kMaxClients) {
+    return false;
+  }
+  Connection &conn = m_connections[client];
+  if (conn.state != STATE_STREAM) {
+    return false;
+  }
+  if (conn.outPos) {
+    conn.out.remove(0, conn.outPos);
+    conn.outPos = 0;
+  }
+  size_t length = strlen(event) + data.length() + 16;
+  if (conn.out.length() && conn.out.length() + length > kMaxStreamBytes) {
+    // Too slow for the rate of events: drop it rather than buffer more.
+    m_stats.dropped++;
+    close(conn);
+    return false;
+  }
+  conn.out.reserve(conn.out.length() + length);
+  conn.out += F("event: ");
+  conn.out += event;
+  conn.out += F("\ndata: ");
+  conn.out += data;
+  conn.out += F("\n\n");
+  drain(conn);
+  return true;
+}
+
+void HttpServer::begin() {
+  m_server.begin();
+  m_server.setNoDelay(true);
+}
+
+void HttpServer::handleClient() {
+  unsigned long start = micros();
+  accept();
+  for (size_t i = 0; i < kMaxClients; ++i) {
+    if (m_connections[i].state != STATE_FREE) {
+      service(m_connections[i]);
+    }
+  }
+  uint32_t elapsed = micros() - start;
+  if (elapsed > m_stats.maxPassUs) {
+    m_stats.maxPassUs = elapsed;
+  }
+}
+
+size_t HttpServer::activeClients() const {
+  size_t active = 0;
+  for (size_t i = 0; i < kMaxClients; ++i) {
+    if (m_connections[i].state != STATE_FREE) {
+      active++;
+    }
+  }
+  return active;
+}
+
+void HttpServer::resetStats() {
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void HttpServer::accept() {
+  while (m_server.hasClient()) {
+    WiFiClient client = m_server.accept();
+    Connection *conn = nullptr;
+    Connection *idle = nullptr;
+    for (size_t i = 0; i < kMaxClients && !conn; ++i) {
+      Connection &c = m_connections[i];
+      if (c.state == STATE_FREE) {
+        conn = &c;
+      } else if (isIdle(c) && (!idle || c.lastMs < idle->lastMs)) {
+        idle = &c;
+      }
+    }
+    if (!conn && idle) {
+      // A waiting keep-alive connection gives way to a new client.
+      close(*idle);
+      m_stats.evicted++;
+      conn = idle;
+    }
+    if (!conn) {
+      client.print(F("HTTP/1.1 503 Service Unavailable\r\n"
+                     "Content-Length: 0\r\nConnection: close\r\n\r\n"));
+      client.stop();
+      m_stats.rejected++;
+      continue;
+    }
+    m_stats.connections++;
+    conn->client = client;
+    conn->client.setNoDelay(true);
+    conn->state = STATE_READ_HEAD;
+    conn->lastMs = millis();
+    conn->head = String();
+    conn->uri = String();
+    conn->argCount = 0;
+    conn->body = String();
+    conn->bodyLength = 0;
+    conn->wsKey = String();
+    conn->ifNoneMatch = String();
+    conn->keepAlive = false;
+    conn->served = 0;
+    conn->rxLength = 0;
+    conn->responded = false;
+    conn->chunked = false;
+    conn->chunkEnded = false;
+    conn->source = nullptr;
+    conn->out = String();
+    conn->outPos = 0;
+    conn->flashLeft = 0;
+  }
+}
+
+void HttpServer::service(Connection &conn) {
+  if (conn.state == STATE_WEBSOCKET) {
+    bool idle = drain(conn);
+    readFrames(conn);
+    if (conn.state != STATE_WEBSOCKET) {
+      return;
+    }
+    if (idle && millis() - conn.pingMs >= kPingMs) {
+      writeFrame(conn, WS_OP_PING, nullptr, 0);
+      conn.pingMs = millis();
+    }
+    if (!conn.client.connected()) {
+      close(conn);
+    } else if (!idle && millis() - conn.lastMs > kTimeoutMs) {
+      // The client stopped reading.
+      m_stats.timeouts++;
+      close(conn);
+    }
+    return;
+  }
+  if (conn.state == STATE_STREAM) {
+    bool idle = drain(conn);
+    // Nothing is expected from the client.
+    uint8_t discard[32];
+    while (conn.client.available() > 0) {
+      conn.client.read(discard, sizeof(discard));
+    }
+    if (!conn.client.connected()) {
+      close(conn);
+    } else if (!idle && millis() - conn.lastMs > kTimeoutMs) {
+      m_stats.dropped++;
+      close(conn);
+    }
+    return;
+  }
+  if (conn.state == STATE_READ_HEAD || conn.state == STATE_READ_BODY) {
+    readRequest(conn);
+  }
+  if (conn.state == STATE_WRITE) {
+    writeResponse(conn);
+  }
+  if (conn.state == STATE_FREE) {
+    return;
+  }
+  if (!conn.client.connected() && !conn.client.available()) {
+    close(conn);
+  } else if (isIdle(conn)) {
+    if (millis() - conn.lastMs > kIdleMs) {
+      close(conn);
+    }
+  } else if (millis() - conn.lastMs > kTimeoutMs) {
+    m_stats.timeouts++;
+    close(conn);
+  }
+}
+
+void HttpServer::readRequest(Connection &conn) {
+  char buf[kChunkBytes];
+  for (;;) {
+    // What is already buffered comes first: a pipelined request may be
+    // complete without reading anything.
+    if (conn.state == STATE_READ_HEAD) {
+      int end = conn.head.indexOf("\r\n\r\n");
+      if (end >= 0) {
+        // Bytes after the blank line already belong to the body.
+        conn.body = conn.head.substring(end + 4);
+        conn.head.remove(end + 2);
+        if (!parseHead(conn)) {
+          return;
+        }
+        conn.state = STATE_READ_BODY;
+      } else if (conn.head.length() > kMaxHeadBytes) {
+        fail(conn, 431);
+        return;
+      }
+    }
+    if (conn.state == STATE_READ_BODY &&
+        conn.body.length() >= conn.bodyLength) {
+      // Anything past the body is the next request.
+      conn.head = conn.body.substring(conn.bodyLength);
+      conn.body.remove(conn.bodyLength);
+      dispatch(conn);
+      return;
+    }
+    int avail = conn.client.available();
+    if (avail <= 0) {
+      return;
+    }
+    size_t n = conn.client.read(
+        (uint8_t *)buf, (size_t)avail < kChunkBytes ? avail : kChunkBytes);
+    if (!n) {
+      return;
+    }
+    conn.lastMs = millis();
+    if (conn.state == STATE_READ_BODY) {
+      conn.body.concat(buf, n);
+    } else {
+      conn.head.concat(buf, n);
+    }
+  }
+}
+
+bool HttpServer::parseHead(Connection &conn) {
+  const String &head = conn.head;
+  int lineEnd = head.indexOf("\r\n");
+  int sp1 = head.indexOf(' ');
+  int sp2 = sp1 < 0 ? -1 : head.indexOf(' ', sp1 + 1);
+  if (sp1 <= 0 || sp2 < 0 || sp2 > lineEnd) {
+    fail(conn, 400);
+    return false;
+  }
+  String method = head.substring(0, sp1);
+  if (method == "GET") {
+    conn.method = HTTP_GET;
+  } else if (method == "POST") {
+    conn.method = HTTP_POST;
+  } else if (method == "PUT") {
+    conn.method = HTTP_PUT;
+  } else if (method == "DELETE") {
+    conn.method = HTTP_DELETE;
+  } else if (method == "PATCH") {
+    conn.method = HTTP_PATCH;
+  } else if (method == "OPTIONS") {
+    conn.method = HTTP_OPTIONS;
+  } else if (method == "HEAD") {
+    conn.method = HTTP_HEAD;
+  } else {
+    fail(conn, 405);
+    return false;
+  }
+
+  // HTTP/1.1 keeps the connection unless told otherwise, 1.0 closes it.
+  conn.keepAlive = head.substring(sp2 + 1, lineEnd) == "HTTP/1.1";
+
+  String target = head.substring(sp1 + 1, sp2);
+  int query = target.indexOf('?');
+  conn.uri = urlDecode(query < 0 ? target : target.substring(0, query));
+  conn.argCount = 0;
+  if (query >= 0) {
+    int pos = query + 1;
+    while (pos < (int)target.length() && conn.argCount < kMaxArgs) {
+      int amp = target.indexOf('&', pos);
+      if (amp < 0) {
+        amp = target.length();
+      }
+      int eq = target.indexOf('=', pos);
+      Arg &a = conn.args[conn.argCount++];
+      if (eq >= 0 && eq < amp) {
+        a.name = urlDecode(target.substring(pos, eq));
+        a.value = urlDecode(target.substring(eq + 1, amp));
+      } else {
+        a.name = urlDecode(target.substring(pos, amp));
+        a.value = String();
+      }
+      pos = amp + 1;
+    }
+  }
+
+  // Only the body length, the connection option, the WebSocket key and
+  // the cache validator matter to us.
+  conn.bodyLength = 0;
+  int pos = lineEnd + 2;
+  while (pos < (int)head.length()) {
+    int end = head.indexOf("\r\n", pos);
+    if (end < 0) {
+      break;
+    }
+    int colon = head.indexOf(':', pos);
+    if (colon > pos && colon < end) {
+      String name = head.substring(pos, colon);
+      String value = head.substring(colon + 1, end);
+      value.trim();
+      if (name.equalsIgnoreCase("Content-Length")) {
+        conn.bodyLength = value.toInt();
+      } else if (name.equalsIgnoreCase("Sec-WebSocket-Key")) {
+        conn.wsKey = value;
+      } else if (name.equalsIgnoreCase("If-None-Match")) {
+        conn.ifNoneMatch = value;
+      } else if (name.equalsIgnoreCase("Connection")) {
+        value.toLowerCase();
+        if (value.indexOf("close") >= 0) {
+          conn.keepAlive = false;
+        } else if (value.indexOf("keep-alive") >= 0) {
+          conn.keepAlive = true;
+        }
+      }
+    }
+    pos = end + 2;
+  }
+  if (conn.bodyLength > kMaxBodyBytes) {
+    fail(conn, 413);
+    return false;
+  }
+  conn.body.reserve(conn.bodyLength);
+  return true;
+}
+
+void HttpServer::dispatch(Connection &conn) {
+  if (conn.wsKey.length() && m_wsHandler && conn.method == HTTP_GET &&
+      conn.uri == m_wsUri) {
+    acceptWebSocket(conn);
+    return;
+  }
+  if (conn.served) {
+    m_stats.reused++;
+  }
+  conn.served++;
+  conn.keepAlive = conn.keepAlive && idleClients() < kMaxIdleClients;
+  m_current = &conn;
+  m_headers = String();
+  m_contentLength = kLengthNotSet;
+  unsigned long start = micros();
+
+  bool handled = false;
+  for (size_t i = 0; i < m_routeCount && !handled; ++i) {
+    const Route &route = m_routes[i];
+    if ((route.method == HTTP_ANY || route.method == conn.method) &&
+        conn.uri == route.uri) {
+      route.handler();
+      handled = true;
+    }
+  }
+  if (!handled && !sendFlash(conn) && !serveFile(conn)) {
+    send(404, "text/plain", String(F("Not found: ")) + conn.uri);
+  }
+  if (!conn.responded) {
+    send(500, "text/plain", F("No response"));
+  }
+  if (conn.chunked && !conn.chunkEnded && !conn.source) {
+    sendContent(kEmptyString, 0);
+  }
+  uint32_t elapsed = micros() - start;
+  if (elapsed > m_stats.maxHandlerUs) {
+    m_stats.maxHandlerUs = elapsed;
+  }
+  m_stats.requests++;
+  m_current = nullptr;
+  conn.body = String();
+  if (conn.state != STATE_STREAM) {
+    conn.state = STATE_WRITE;
+  }
+  conn.lastMs = millis();
+}
+
+bool HttpServer::serveFile(Connection &conn) {
+  if (!m_staticFs ||
+      (conn.method != HTTP_GET && conn.method != HTTP_HEAD) ||
+      !conn.uri.startsWith(m_staticUri)) {
+    return false;
+  }
+  String path = m_staticPath;
+  if (path.endsWith("/")) {
+    path.remove(path.length() - 1);
+  }
+  String rest = conn.uri.substring(m_staticUri.length());
+  if (!rest.startsWith("/")) {
+    path += '/';
+  }
+  path += rest;
+  if (path.endsWith("/")) {
+    path += F("index.html");
+  }
+  const char *type = contentTypeFor(path);
+  bool gzipped = false;
+  if (!m_staticFs->exists(path) && m_staticFs->exists(path + ".gz")) {
+    path += F(".gz");
+    gzipped = true;
+  }
+  File file = m_staticFs->open(path, "r");
+  if (!file || file.isDirectory()) {
+    return false;
+  }
+  String etag = gzipped ? gzipEtag(file) : String();
+  if (etag.length()) {
+    sendHeader(F("ETag"), etag);
+    sendCacheHeaders();
+    if (conn.ifNoneMatch.indexOf(etag) >= 0) {
+      file.close();
+      send(304, type, String());
+      return true;
+    }
+  }
+  streamFile(file, type);
+  return true;
+}
+
+bool HttpServer::sendFlash(Connection &conn) {
+  if (!m_flashLookup ||
+      (conn.method != HTTP_GET && conn.method != HTTP_HEAD)) {
+    return false;
+  }
+  FlashAsset asset;
+  bool found = conn.uri.endsWith("/")
+                   ? m_flashLookup((conn.uri + F("index.html")).c_str(), asset)
+                   : m_flashLookup(conn.uri.c_str(), asset);
+  if (!found) {
+    return false;
+  }
+  char etag[24];
+  strncpy_P(etag, asset.etag, sizeof(etag) - 1);
+  etag[sizeof(etag) - 1] = '\0';
+  bool notModified = conn.ifNoneMatch.indexOf(etag) >= 0;
+  // The header lines are stored whole, send() is not used.
+  sendCacheHeaders();
+  conn.responded = true;
+  conn.out.reserve(160 + strlen_P(asset.head) + m_headers.length());
+  conn.out = notModified ? F("HTTP/1.1 304 Not Modified\r\n")
+                         : F("HTTP/1.1 200 OK\r\n");
+  conn.out += FPSTR(asset.head);
+  conn.out += m_headers;
+  conn.out += conn.keepAlive ? F("Connection: keep-alive\r\n\r\n")
+                             : F("Connection: close\r\n\r\n");
+  m_headers = String();
+  if (!notModified && conn.method != HTTP_HEAD) {
+    conn.flash = asset.body;
+    conn.flashLeft = asset.length;
+  }
+  return true;
+}
+
+void HttpServer::sendCacheHeaders() {
+  if (hasArg("v")) {
+    sendHeader(F("Cache-Control"), F("public, max-age=31536000, immutable"));
+  } else {
+    sendHeader(F("Cache-Control"), F("no-cache"));
+  }
+}
+
+String HttpServer::gzipEtag(File &file) {
+  // The last 8 bytes of a gzip file are the CRC-32 and the length of
+  // the uncompressed content.
+  size_t size = file.size();
+  uint8_t trailer[8];
+  bool ok = size >= 18 && file.seek(size - sizeof(trailer)) &&
+            file.read(trailer, sizeof(trailer)) == sizeof(trailer);
+  file.seek(0);
+  if (!ok) {
+    return String();
+  }
+  uint32_t crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 |
+                 (uint32_t)trailer[3] << 24;
+  uint32_t length = trailer[4] | trailer[5] << 8 | trailer[6] << 16 |
+                    (uint32_t)trailer[7] << 24;
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%08x-%x\"", (unsigned)crc,
+           (unsigned)length);
+  return String(etag);
+}
+
+void HttpServer::acceptWebSocket(Connection &conn) {
+  uint8_t digest[20];
+  sha1(conn.wsKey + kWebSocketGuid, digest);
+  conn.out = F("HTTP/1.1 101 Switching Protocols\r\n"
+               "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+               "Sec-WebSocket-Accept: ");
+  conn.out += base64::encode(digest, sizeof(digest), false);
+  conn.out += F("\r\n\r\n");
+  conn.outPos = 0;
+  conn.wsKey = String();
+  conn.body = String();
+  conn.rxLength = 0;
+  conn.pingMs = millis();
+  conn.lastMs = millis();
+  conn.state = STATE_WEBSOCKET;
+  m_stats.requests++;
+  drain(conn);
+  m_wsHandler(WS_CONNECT, &conn - m_connections, String());
+}
+
+void HttpServer::readFrames(Connection &conn) {
+  int avail = conn.client.available();
+  size_t room = sizeof(conn.rx) - conn.rxLength;
+  if (avail > 0 && room) {
+    conn.rxLength += conn.client.read(conn.rx + conn.rxLength,
+                                      (size_t)avail < room ? avail : room);
+  }
+  uint8_t client = &conn - m_connections;
+  while (conn.rxLength >= 2) {
+    uint8_t opcode = conn.rx[0] & 0x0F;
+    bool fin = conn.rx[0] & 0x80;
+    bool masked = conn.rx[1] & 0x80;
+    size_t length = conn.rx[1] & 0x7F;
+    size_t header = 2;
+    if (length == 126) {
+      if (conn.rxLength < 4) {
+        return;
+      }
+      length = (size_t)conn.rx[2] << 8 | conn.rx[3];
+      header = 4;
+    }
+    // Client frames are always masked; fragmented and oversized ones
+    // are not supported.
+    if (!masked || !fin || length > kMaxFrameBytes) {
+      close(conn);
+      return;
+    }
+    if (conn.rxLength < header + 4 + length) {
+      return;
+    }
+    const uint8_t *mask = conn.rx + header;
+    uint8_t *payload = conn.rx + header + 4;
+    for (size_t i = 0; i < length; ++i) {
+      payload[i] ^= mask[i & 3];
+    }
+    conn.lastMs = millis();
+    bool idle = conn.outPos >= conn.out.length();
+    if (opcode == WS_OP_TEXT) {
+      String text;
+      text.concat((const char *)payload, length);
+      m_wsHandler(WS_TEXT, client, text);
+      if (conn.state != STATE_WEBSOCKET) {
+        return;
+      }
+    } else if (opcode == WS_OP_CLOSE) {
+      if (idle) {
+        writeFrame(conn, WS_OP_CLOSE, payload, length < 2 ? length : 2);
+      }
+      close(conn);
+      return;
+    } else if (opcode == WS_OP_PING && idle) {
+      writeFrame(conn, WS_OP_PONG, payload, length);
+    }
+    size_t used = header + 4 + length;
+    memmove(conn.rx, conn.rx + used, conn.rxLength - used);
+    conn.rxLength -= used;
+  }
+}
+
+bool HttpServer::writeFrame(Connection &conn, uint8_t opcode,
+                            const uint8_t *payload, size_t length) {
+  uint8_t header[10];
+  size_t n = frameHeader(header, opcode, length);
+  if ((size_t)conn.client.availableForWrite() < n + length) {
+    return false;
+  }
+  conn.client.write(header, n);
+  if (length) {
+    conn.client.write(payload, length);
+  }
+  return true;
+}
+
+bool HttpServer::drain(Connection &conn) {
+  uint8_t buf[kChunkBytes];
+  size_t room = conn.client.availableForWrite();
+  while (room) {
+    size_t pending = conn.out.length() - conn.outPos;
+    if (pending) {
+      size_t n = pending < room ? pending : room;
+      size_t written = conn.client.write(
+          (const uint8_t *)conn.out.c_str() + conn.outPos, n);
+      if (!written) {
+        break;
+      }
+      conn.outPos += written;
+      room -= written;
+      conn.lastMs = millis();
+      continue;
+    }
+    if (conn.flashLeft) {
+      size_t n = conn.flashLeft < room ? conn.flashLeft : room;
+      if (n > sizeof(buf)) {
+        n = sizeof(buf);
+      }
+      memcpy_P(buf, conn.flash, n);
+      size_t written = conn.client.write(buf, n);
+      if (!written) {
+        break;
+      }
+      conn.flash += written;
+      conn.flashLeft -= written;
+      room -= written;
+      conn.lastMs = millis();
+      continue;
+    }
+    if (!conn.file) {
+      break;
+    }
+    size_t n = conn.file.read(buf, room < sizeof(buf) ? room : sizeof(buf));
+    if (!n) {
+      conn.file.close();
+      break;
+    }
+    size_t written = conn.client.write(buf, n);
+    if (written < n) {
+      conn.file.seek(conn.file.position() - (n - written));
+    }
+    if (!written) {
+      break;
+    }
+    room -= written;
+    conn.lastMs = millis();
+  }
+  if (conn.outPos < conn.out.length() || conn.file || conn.flashLeft) {
+    return false;
+  }
+  if (conn.outPos) {
+    conn.out = String();
+    conn.outPos = 0;
+  }
+  return true;
+}
+
+void HttpServer::fillChunks(Connection &conn) {
+  if (!conn.source || conn.out.length() - conn.outPos >= kChunkLowWater) {
+    return;
+  }
+  if (conn.outPos) {
+    conn.out.remove(0, conn.outPos);
+    conn.outPos = 0;
+  }
+  bool more;
+  {
+    ChunkWriter writer(conn.out);
+    more = conn.source(writer);
+  }
+  if (!more) {
+    conn.source = nullptr;
+    conn.out += F("0\r\n\r\n");
+    conn.chunkEnded = true;
+  }
+  conn.lastMs = millis();
+}
+
+void HttpServer::writeResponse(Connection &conn) {
+  fillChunks(conn);
+  if (!drain(conn) || conn.source) {
+    return;
+  }
+  if (conn.keepAlive) {
+    nextRequest(conn);
+  } else {
+    close(conn);
+  }
+}
+
+void HttpServer::nextRequest(Connection &conn) {
+  // conn.head keeps what was read of the next request.
+  conn.state = STATE_READ_HEAD;
+  conn.lastMs = millis();
+  conn.uri = String();
+  for (uint8_t i = 0; i < conn.argCount; ++i) {
+    conn.args[i].name = String();
+    conn.args[i].value = String();
+  }
+  conn.argCount = 0;
+  conn.body = String();
+  conn.bodyLength = 0;
+  conn.wsKey = String();
+  conn.ifNoneMatch = String();
+  conn.keepAlive = false;
+  conn.responded = false;
+  conn.chunked = false;
+  conn.chunkEnded = false;
+  conn.source = nullptr;
+}
+
+bool HttpServer::isIdle(const Connection &conn) const {
+  return conn.state == STATE_READ_HEAD && conn.served &&
+         !conn.head.length();
+}
+
+size_t HttpServer::idleClients() const {
+  size_t idle = 0;
+  for (size_t i = 0; i < kMaxClients; ++i) {
+    if (isIdle(m_connections[i])) {
+      idle++;
+    }
+  }
+  return idle;
+}
+
+void HttpServer::close(Connection &conn) {
+  bool webSocket = conn.state == STATE_WEBSOCKET;
+  if (conn.file) {
+    conn.file.close();
+  }
+  conn.client.stop();
+  conn.head = String();
+  conn.body = String();
+  conn.out = String();
+  conn.source = nullptr;
+  conn.flashLeft = 0;
+  for (uint8_t i = 0; i < conn.argCount; ++i) {
+    conn.args[i].name = String();
+    conn.args[i].value = String();
+  }
+  conn.argCount = 0;
+  conn.state = STATE_FREE;
+  if (webSocket) {
+    m_wsHandler(WS_DISCONNECT, &conn - m_connections, String());
+  }
+}
+
+void HttpServer::fail(Connection &conn, int code) {
+  // The rest of the stream cannot be trusted: close after the answer.
+  conn.keepAlive = false;
+  m_current = &conn;
+  m_headers = String();
+  m_contentLength = kLengthNotSet;
+  send(code, "text/plain", statusText(code));
+  m_current = nullptr;
+  conn.state = STATE_WRITE;
+  conn.lastMs = millis();
+}
+
+bool HttpServer::hasArg(const String &name) const {
+  if (!m_current) {
+    return false;
+  }
+  if (name == "plain") {
+    return m_current->bodyLength > 0;
+  }
+  for (uint8_t i = 0; i < m_current->argCount; ++i) {
+    if (m_current->args[i].name == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+String HttpServer::arg(const String &name) const {
+  if (!m_current) {
+    return String();
+  }
+  if (name == "plain") {
+    return m_current->body;
+  }
+  for (uint8_t i = 0; i < m_current->argCount; ++i) {
+    if (m_current->args[i].name == name) {
+      return m_current->args[i].value;
+    }
+  }
+  return String();
+}
+
+const String &HttpServer::uri() const {
+  static const String empty;
+  return m_current ? m_current->uri : empty;
+}
+
+HTTPMethod HttpServer::method() const {
+  return m_current ? m_current->method : HTTP_ANY;
+}
+
+void HttpServer::sendHeader(const String &name, const String &value) {
+  m_headers += name;
+  m_headers += F(": ");
+  m_headers += value;
+  m_headers += F("\r\n");
+}
+
+void HttpServer::setContentLength(size_t length) {
+  m_contentLength = length;
+}
+
+void HttpServer::send(int code, const char *contentType,
+                      const String &content) {
+  Connection *conn = m_current;
+  if (!conn || conn->responded) {
+    return;
+  }
+  conn->responded = true;
+  bool withBody = conn->method != HTTP_HEAD;
+  String &out = conn->out;
+  out.reserve(128 + m_headers.length() + (withBody ? content.length() : 0));
+  out = F("HTTP/1.1 ");
+  out += code;
+  out += ' ';
+  out += statusText(code);
+  out += F("\r\nContent-Type: ");
+  out += contentType;
+  if (m_contentLength == CONTENT_LENGTH_UNKNOWN) {
+    conn->chunked = withBody;
+    out += F("\r\nTransfer-Encoding: chunked");
+  } else {
+    out += F("\r\nContent-Length: ");
+    out += (unsigned long)(m_contentLength == kLengthNotSet
+                               ? content.length()
+                               : m_contentLength);
+  }
+  out += conn->keepAlive ? F("\r\nConnection: keep-alive\r\n")
+                         : F("\r\nConnection: close\r\n");
+  out += m_headers;
+  out += F("\r\n");
+  m_headers = String();
+  m_contentLength = kLengthNotSet;
+
+  if (conn->chunked) {
+    // Chunks follow the headers in the buffer.
+    if (content.length()) {
+      appendChunk(out, content.c_str(), content.length());
+    }
+    return;
+  }
+  if (withBody) {
+    out += content;
+  } else if (conn->file) {
+    conn->file.close();
+  }
+}
+
+bool HttpServer::sendContent(const String &content) {
+  return sendContent(content.c_str(), content.length());
+}
+
+bool HttpServer::sendContent(const char *content, size_t length) {
+  Connection *conn = m_current;
+  if (!conn || conn->method == HTTP_HEAD) {
+    return false;
+  }
+  if (!conn->chunked) {
+    conn->out.concat(content, length);
+    return true;
+  }
+  if (conn->chunkEnded || conn->source) {
+    return false;
+  }
+  // The handler runs before anything is written: the whole response
+  // waits in the buffer until it returns.
+  if (length && conn->out.length() + length + 12 > kMaxChunkedBytes) {
+    return false;
+  }
+  if (length) {
+    appendChunk(conn->out, content, length);
+  } else {
+    conn->out += F("0\r\n\r\n");
+    conn->chunkEnded = true;
+  }
+  return true;
+}
+
+void HttpServer::sendChunked(int code, const char *contentType,
+                             ChunkSource source) {
+  Connection *conn = m_current;
+  if (!conn || conn->responded) {
+    return;
+  }
+  setContentLength(CONTENT_LENGTH_UNKNOWN);
+  send(code, contentType, String());
+  if (conn->chunked) {
+    conn->source = source;
+  }
+}
+
+void HttpServer::streamFile(File &file, const String &contentType) {
+  if (!m_current) {
+    return;
+  }
+  String name = file.name();
+  if (name.endsWith(".gz") && contentType != "application/x-gzip") {
+    sendHeader(F("Content-Encoding"), F("gzip"));
+  }
+  m_current->file = file;
+  setContentLength(file.size());
+  send(200, contentType.c_str(), String());
+}
+
+String HttpServer::urlDecode(const String &text) {
+  String decoded;
+  decoded.reserve(text.length());
+  for (size_t i = 0; i < text.length(); ++i) {
+    char c = text[i];
+    if (c == '+') {
+      c = ' ';
+    } else if (c == '%' && i + 2 < text.length()) {
+      char hex[3] = {text[i + 1], text[i + 2], 0};
+      c = (char)strtol(hex, nullptr, 16);
+      i += 2;
+    }
+    decoded += c;
+  }
+  return decoded;
+}
+
+const char *HttpServer::statusText(int code) {
+  switch (code) {
+  case 200:
+    return "OK";
+  case 202:
+    return "Accepted";
+  case 204:
+    return "No Content";
+  case 304:
+    return "Not Modified";
+  case 400:
+    return "Bad Request";
+  case 401:
+    return "Unauthorized";
+  case 403:
+    return "Forbidden";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 409:
+    return "Conflict";
+  case 413:
+    return "Payload Too Large";
+  case 431:
+    return "Request Header Fields Too Large";
+  case 500:
+    return "Internal Server Error";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return kEmptyString;
+  }
+}
+
+const char *HttpServer::contentTypeFor(const String &path) {
+  if (path.endsWith(".html") || path.endsWith(".htm")) {
+    return "text/html";
+  }
+  if (path.endsWith(".css")) {
+    return "text/css";
+  }
+  if (path.endsWith(".js")) {
+    return "application/javascript";
+  }
+  if (path.endsWith(".json")) {
+    return "application/json";
+  }
+  if (path.endsWith(".png")) {
+    return "image/png";
+  }
+  if (path.endsWith(".ico")) {
+    return "image/x-icon";
+  }
+  if (path.endsWith(".svg")) {
+    return "image/svg+xml";
+  }
+  if (path.endsWith(".txt")) {
+    return "text/plain";
+  }
+  return "application/octet-stream";
+}
@@ -0,0 +1,290 @@
+// HttpServer is a small HTTP/1.1 server polled from loop() that keeps
+// several connections open at once and never waits for a client.
+//
+// ESP8266WebServer serves one client at a time: handleClient() reads
+// the request, runs the handler and writes the whole response before
+// returning, so a slow client or a large file (devices.html is about
+// 150 KB) holds the main loop for the whole transfer. Here every
+// connection is a small state machine advanced by handleClient():
+// request bytes are consumed as they arrive, the handler runs once the
+// request is complete and the response is then written as the socket
+// accepts it (availableForWrite()), files included. Up to kMaxClients
+// connections progress in parallel; further ones get a 503.
+//
+// The handler interface mirrors ESP8266WebServer (on, arg, hasArg,
+// send, sendHeader, setContentLength, sendContent, streamFile,
+// serveStatic) so the WebApi handlers are unchanged. A response given
+// to send() is buffered and a file passed to streamFile() is read as
+// the socket drains, after the handler has returned. Responses started
+// with CONTENT_LENGTH_UNKNOWN are chunked: each sendContent() call
+// queues a chunk in the same buffer, and is refused once
+// kMaxChunkedBytes wait for the client. Generated data larger than
+// that, such as logger exports, is produced by a ChunkSource given to
+// sendChunked(), which handleClient() calls for more as the client
+// reads.
+//
+// Request bodies are available as arg("plain"). Connections are kept
+// open after a response when the client asks for it (HTTP/1.1 default)
+// so dashboards polling every second do not pay a TCP handshake per
+// request. At most kMaxIdleClients of them may wait idle, for up to
+// kIdleMs; when every slot is taken, a new client takes the slot of
+// the idle one that has waited longest. Requests pipelined on a
+// connection are answered in order: bytes read past a request are kept
+// as the start of the next one. Stats tell how many requests reused a
+// connection.
+//
+// WebSocket upgrades (RFC 6455) on the path given to onWebSocket()
+// keep their slot as well: text frames from
+// the client are passed to the WebSocket handler and sendText() queues
+// frames that are written like any other response. A client that has
+// not drained its previous frame is not given a new one, so a slow
+// client makes its sender skip updates instead of filling the heap.
+// Pings go out every kPingMs so dead peers are noticed.
+//
+// A handler may also turn its response into a Server-Sent Events
+// stream with beginEventStream(); events are then queued with
+// sendEvent() for as long as the client stays. Up to kMaxStreamBytes
+// may wait in the buffer of a stream: a client that falls further
+// behind, or stops reading for kTimeoutMs, is dropped (counted in
+// Stats::dropped) so it cannot use up the heap.
+
+#ifndef MINILABOESP_HTTPSERVER_H
+#define MINILABOESP_HTTPSERVER_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <FS.h>
+#include <functional>
+// For HTTPMethod and CONTENT_LENGTH_UNKNOWN, shared with the handlers.
+#include <ESP8266WebServer.h>
+
+class HttpServer {
+public:
+  typedef std::function<void()> Handler;
+  // Producer of a chunked body: writes the next part to out and returns
+  // false once it has written the last one. Called from handleClient()
+  // after the handler has returned, so request arguments are gone.
+  typedef std::function<bool(Print &out)> ChunkSource;
+
+  enum WebSocketEvent { WS_CONNECT, WS_DISCONNECT, WS_TEXT };
+  // client identifies the connection in sendText().
+  typedef std::function<void(WebSocketEvent event, uint8_t client,
+                             const String &text)>
+      WebSocketHandler;
+
+  static const size_t kMaxClients = 4;
+  static const size_t kMaxRoutes = 40;
+  static const size_t kMaxArgs = 12;
+  static const size_t kMaxHeadBytes = 2048;
+  static const size_t kMaxBodyBytes = 16384;
+  // A connection making no progress for this long is dropped.
+  static const uint32_t kTimeoutMs = 5000;
+  // Keep-alive connections waiting for their next request.
+  static const size_t kMaxIdleClients = 2;
+  static const uint32_t kIdleMs = 10000;
+  // Largest frame accepted from a WebSocket client.
+  static const size_t kMaxFrameBytes = 256;
+  static const uint32_t kPingMs = 15000;
+  // Output allowed to wait for a Server-Sent Events client.
+  static const size_t kMaxStreamBytes = 4096;
+  // Output allowed to wait for a chunked response.
+  static const size_t kMaxChunkedBytes = 4096;
+
+  // Counters to measure the server from /api/http.
+  struct Stats {
+    uint32_t connections; // accepted
+    uint32_t requests;
+    uint32_t reused;  // requests on an already used connection
+    uint32_t evicted; // idle connections closed for a new client
+    uint32_t rejected; // refused with 503, every slot busy
+    uint32_t timeouts;
+    uint32_t dropped; // event streams that fell behind
+    uint32_t maxPassUs;    // longest handleClient() call
+    uint32_t maxHandlerUs; // longest handler
+  };
+
+  explicit HttpServer(uint16_t port);
+
+  // Register a handler for an exact path. HTTP_ANY matches every
+  // method.
+  void on(const char *uri, HTTPMethod method, Handler handler);
+
+  // Serve GET requests under uri from fs, below path, when no handler
+  // matches; a directory serves its index.html. A file.gz is sent
+  // compressed when the file itself is missing, with a strong ETag
+  // from its gzip trailer (CRC-32 and length of the content); an
+  // If-None-Match with that tag is answered 304. Such files are
+  // revalidated on every use ("no-cache") unless the URL carries a "v"
+  // argument, which scripts/web_assets.py adds with the content hash:
+  // those are cached for a year.
+  void serveStatic(const char *uri, fs::FS &fs, const char *path);
+
+  // A response compiled into the firmware: its header lines and gzip
+  // body, in PROGMEM (see WebAssets).
+  struct FlashAsset {
+    const char *head; // Content-Type ... ETag, each ending in CRLF
+    const char *etag;
+    const uint8_t *body;
+    uint32_t length;
+  };
+  typedef bool (*FlashLookup)(const char *path, FlashAsset &asset);
+
+  // Serve GET requests from flash for the paths lookup knows, before
+  // trying the filesystem. Caching works as for .gz files above.
+  void serveFlash(FlashLookup lookup) { m_flashLookup = lookup; }
+
+  // Accept WebSocket upgrades on uri.
+  void onWebSocket(const char *uri, WebSocketHandler handler);
+
+  // Queue a text frame for a WebSocket client. Returns false, queueing
+  // nothing, while its previous frame is still being written or when
+  // the client is gone.
+  bool sendText(uint8_t client, const String &text);
+
+  // Inside a handler: answer with a text/event-stream response that
+  // stays open. Returns the client to pass to sendEvent(), or -1.
+  int beginEventStream();
+
+  // Queue "event: <event>" with data (a single line) for an event
+  // stream client. Returns false when the client is gone, including
+  // when this event would overflow its buffer and it is dropped.
+  bool sendEvent(uint8_t client, const char *event, const String &data);
+
+  void begin();
+
+  // Accept new connections and advance every open one. Never waits for
+  // a client.
+  void handleClient();
+
+  // Request being handled. Only valid inside a handler.
+  bool hasArg(const String &name) const;
+  String arg(const String &name) const;
+  const String &uri() const;
+  HTTPMethod method() const;
+
+  // Response of the request being handled.
+  void sendHeader(const String &name, const String &value);
+  void setContentLength(size_t length);
+  void send(int code, const char *contentType, const String &content);
+  // Queue a chunk (or, after send(), append to the body). Returns false,
+  // queueing nothing, when the chunk would not fit in kMaxChunkedBytes:
+  // the handler should stop or use sendChunked(). An empty chunk ends
+  // the response.
+  bool sendContent(const String &content);
+  bool sendContent(const char *content, size_t length);
+  // Answer with a chunked body taken from source as the client reads.
+  void sendChunked(int code, const char *contentType, ChunkSource source);
+  // Send file as the body. The server keeps its own handle on the
+  // file: the caller must not close it.
+  void streamFile(File &file, const String &contentType);
+
+  const Stats &stats() const { return m_stats; }
+  size_t activeClients() const;
+  void resetStats();
+
+private:
+  enum State {
+    STATE_FREE,
+    STATE_READ_HEAD,
+    STATE_READ_BODY,
+    STATE_WRITE,
+    STATE_WEBSOCKET,
+    STATE_STREAM
+  };
+
+  struct Arg {
+    String name;
+    String value;
+  };
+
+  struct Connection {
+    WiFiClient client;
+    State state;
+    unsigned long lastMs; // last progress
+    String head;
+    HTTPMethod method;
+    String uri;
+    Arg args[kMaxArgs];
+    uint8_t argCount;
+    String body;
+    size_t bodyLength;
+    String wsKey; // Sec-WebSocket-Key of an upgrade request
+    String ifNoneMatch;
+    bool keepAlive; // keep the connection after this response
+    uint16_t served; // requests received on this connection
+    // WebSocket frames received and not yet complete.
+    uint8_t rx[kMaxFrameBytes + 8];
+    size_t rxLength;
+    unsigned long pingMs;
+    // Response: buffered bytes, then the file or flash body if any.
+    bool responded;
+    bool chunked;
+    bool chunkEnded; // last chunk sent
+    ChunkSource source; // rest of a chunked body
+    String out;
+    size_t outPos;
+    File file;
+    const uint8_t *flash;
+    size_t flashLeft;
+  };
+
+  struct Route {
+    const char *uri;
+    HTTPMethod method;
+    Handler handler;
+  };
+
+  // No Content-Length given: use the length of the content.
+  static const size_t kLengthNotSet = (size_t)-2;
+
+  void accept();
+  void service(Connection &conn);
+  void readRequest(Connection &conn);
+  bool parseHead(Connection &conn);
+  void dispatch(Connection &conn);
+  bool serveFile(Connection &conn);
+  bool sendFlash(Connection &conn);
+  // Cache-Control for an asset with an ETag: see serveStatic().
+  void sendCacheHeaders();
+  // ETag of a gzip file from its trailer, or an empty string.
+  static String gzipEtag(File &file);
+  void acceptWebSocket(Connection &conn);
+  void readFrames(Connection &conn);
+  // Write a frame header and payload now, if the socket has room.
+  bool writeFrame(Connection &conn, uint8_t opcode, const uint8_t *payload,
+                  size_t length);
+  // Write buffered output and file data as far as the socket accepts.
+  // Returns true once everything is written.
+  bool drain(Connection &conn);
+  // Ask the chunk source of a response for more once its output has
+  // nearly been written.
+  void fillChunks(Connection &conn);
+  void writeResponse(Connection &conn);
+  // Wait for the next request on a kept-alive connection.
+  void nextRequest(Connection &conn);
+  bool isIdle(const Connection &conn) const;
+  size_t idleClients() const;
+  void close(Connection &conn);
+  void fail(Connection &conn, int code);
+  static String urlDecode(const String &text);
+  static const char *statusText(int code);
+  static const char *contentTypeFor(const String &path);
+
+  WiFiServer m_server;
+  Connection m_connections[kMaxClients];
+  Route m_routes[kMaxRoutes];
+  size_t m_routeCount;
+  fs::FS *m_staticFs;
+  String m_staticUri;
+  String m_staticPath;
+  FlashLookup m_flashLookup;
+  const char *m_wsUri;
+  WebSocketHandler m_wsHandler;
+  // Response being built by the current handler.
+  Connection *m_current;
+  String m_headers;
+  size_t m_contentLength;
+  Stats m_stats;
+};
+
+#endif // MINILABOESP_HTTPSERVER_H
@@ -0,0 +1,405 @@
+// Implementation of the OutputTester class
+
+#include "OutputTester.h"
+
+#include "core/Logger.h"
+#include "devices/FuncGen.h"
+
+namespace {
+
+// Same PWM range as FuncGen.
+const uint16_t kPwmMaxCode = 1023;
+const uint16_t kDacMaxCode = 4095;
+
+float clampPct(float pct) {
+  return pct < 0.0f ? 0.0f : (pct > 100.0f ? 100.0f : pct);
+}
+
+} // namespace
+
+OutputTester::OutputTester(OutputRegistry *outputs, FuncGen *funcGen,
+                           Logger *logger)
+    : m_outputs(outputs), m_funcGen(funcGen), m_logger(logger),
+      m_nextId(1) {
+  for (size_t i = 0; i < kMaxJobs; ++i) {
+    m_jobs[i].id = 0;
+    m_jobs[i].state = JOB_FREE;
+  }
+}
+
+uint32_t OutputTester::start(JsonObjectConst request, String &error) {
+  const char *name = request["pattern"] | "blink";
+  Pattern pattern;
+  if (strcmp(name, "blink") == 0) {
+    pattern = PATTERN_BLINK;
+  } else if (strcmp(name, "pwm_sweep") == 0) {
+    pattern = PATTERN_PWM_SWEEP;
+  } else if (strcmp(name, "dac_staircase") == 0) {
+    pattern = PATTERN_DAC_STAIRCASE;
+  } else {
+    error = F("unknown pattern");
+    return 0;
+  }
+
+  Job *job = freeSlot();
+  if (!job) {
+    error = F("too many jobs");
+    return 0;
+  }
+  Job next;
+  next.pattern = pattern;
+  if (!resolveTarget(request, next, error)) {
+    return 0;
+  }
+  if (targetBusy(next)) {
+    error = F("output busy");
+    return 0;
+  }
+
+  uint32_t steps;
+  float stepMs;
+  if (pattern == PATTERN_BLINK) {
+    float freq = request["freq_hz"] | 5.0f;
+    uint32_t cycles = request["cycles"] | 10;
+    if (!(freq > 0.0f) || cycles == 0) {
+      error = F("invalid freq_hz or cycles");
+      return 0;
+    }
+    if (cycles > kMaxSteps / 2) {
+      error = F("too many steps");
+      return 0;
+    }
+    // One step per half period: high, then low.
+    steps = cycles * 2;
+    stepMs = 500.0f / freq;
+    next.fromPct = 100.0f;
+    next.toPct = 0.0f;
+  } else {
+    bool sweep = pattern == PATTERN_PWM_SWEEP;
+    steps = request["steps"] | (sweep ? 21 : 5);
+    stepMs = request["step_ms"] | (sweep ? 100.0f : 1000.0f);
+    next.fromPct = clampPct(request["from_pct"] | 0.0f);
+    next.toPct = clampPct(request["to_pct"] | 100.0f);
+    if (steps < 2) {
+      error = F("steps must be at least 2");
+      return 0;
+    }
+  }
+  if (steps > kMaxSteps) {
+    error = F("too many steps");
+    return 0;
+  }
+  if (!(stepMs * 1000.0f >= kMinStepUs)) {
+    error = F("steps too short");
+    return 0;
+  }
+  if (stepMs * steps > kMaxDurationMs) {
+    error = F("test too long");
+    return 0;
+  }
+
+  // Replaces a finished job: keep the new state only once it is valid.
+  job->id = m_nextId++;
+  job->state = JOB_RUNNING;
+  job->pattern = pattern;
+  job->target = next.target;
+  job->driver = next.driver;
+  job->gpio = next.gpio;
+  job->i2cAddress = next.i2cAddress;
+  job->outputId = next.outputId;
+  job->fromPct = next.fromPct;
+  job->toPct = next.toPct;
+  job->steps = steps;
+  job->step = 0;
+  job->stepUs = (uint32_t)(stepMs * 1000.0f + 0.5f);
+  job->maxLateUs = 0;
+  job->skipped = 0;
+  job->levelPct = 0.0f;
+  job->endMs = 0;
+
+  switch (job->driver) {
+  case OutputRegistry::DRIVER_MCP4725:
+    job->dac.begin(job->i2cAddress);
+    break;
+  case OutputRegistry::DRIVER_PWM:
+    pinMode(job->gpio, OUTPUT);
+    analogWriteRange(kPwmMaxCode);
+    break;
+  default:
+    pinMode(job->gpio, OUTPUT);
+    break;
+  }
+  if (m_logger) {
+    m_logger->info(String(F("Test ")) + patternName(pattern) + F(" sur ") +
+                   job->target + F(" (job ") + String(job->id) + F(", ") +
+                   String(steps) + F(" pas de ") + String(stepMs, 1) +
+                   F(" ms)"));
+  }
+  job->startUs = micros();
+  job->startMs = millis();
+  apply(*job, 0);
+  job->step = 1;
+  return job->id;
+}
+
+bool OutputTester::cancel(uint32_t id) {
+  Job *job = const_cast<Job *>(findJob(id));
+  if (!job || job->state != JOB_RUNNING) {
+    return false;
+  }
+  finish(*job, JOB_CANCELLED);
+  return true;
+}
+
+bool OutputTester::describe(uint32_t id, JsonObject obj) const {
+  const Job *job = findJob(id);
+  if (!job) {
+    return false;
+  }
+  describeJob(*job, obj);
+  return true;
+}
+
+void OutputTester::list(JsonArray arr) const {
+  // Ids only grow: walk them from the newest.
+  uint32_t below = UINT32_MAX;
+  for (size_t n = 0; n < kMaxJobs; ++n) {
+    const Job *newest = nullptr;
+    for (size_t i = 0; i < kMaxJobs; ++i) {
+      const Job &job = m_jobs[i];
+      if (job.state != JOB_FREE && job.id < below &&
+          (!newest || job.id > newest->id)) {
+        newest = &job;
+      }
+    }
+    if (!newest) {
+      return;
+    }
+    describeJob(*newest, arr.createNestedObject());
+    below = newest->id;
+  }
+}
+
+void OutputTester::loop() {
+  uint32_t now = micros();
+  for (size_t i = 0; i < kMaxJobs; ++i) {
+    Job &job = m_jobs[i];
+    if (job.state != JOB_RUNNING) {
+      continue;
+    }
+    uint32_t elapsed = now - job.startUs;
+    if (elapsed < job.step * job.stepUs) {
+      continue;
+    }
+    // Latest step due; the ones before it are already out of date.
+    uint32_t due = elapsed / job.stepUs;
+    if (due > job.steps) {
+      due = job.steps;
+    }
+    uint32_t late = elapsed - due * job.stepUs;
+    if (late > job.maxLateUs) {
+      job.maxLateUs = late;
+    }
+    job.skipped += due - job.step;
+    job.step = due + 1;
+    if (due == job.steps) {
+      finish(job, JOB_DONE);
+    } else {
+      apply(job, due);
+    }
+  }
+}
+
+bool OutputTester::resolveTarget(JsonObjectConst request, Job &job,
+                                 String &error) {
+  job.gpio = 0xFF;
+  job.i2cAddress = 0;
+  job.outputId = "";
+  const char *outputId = request["output"] | "";
+  if (outputId[0]) {
+    int handle = m_outputs ? m_outputs->find(outputId) : -1;
+    const OutputRegistry::Binding *binding =
+        m_outputs ? m_outputs->get(handle) : nullptr;
+    if (!binding) {
+      error = F("unknown output");
+      return false;
+    }
+    job.target = binding->id;
+    job.outputId = binding->id;
+    job.driver = binding->driver;
+    job.gpio = binding->gpio;
+    job.i2cAddress = binding->i2cAddress;
+  } else {
+    String label = request["pin"] | "";
+    label.trim();
+    if (!label.length()) {
+      error = F("missing pin or output");
+      return false;
+    }
+    int gpio = OutputRegistry::pinLabelToGpio(label);
+    if (gpio < 0) {
+      error = F("unsupported pin");
+      return false;
+    }
+    job.target = label;
+    job.driver = OutputRegistry::DRIVER_PWM;
+    job.gpio = gpio;
+    // The generator knows its outputs by id: find the one on this pin.
+    for (size_t i = 0; m_outputs && i < m_outputs->count(); ++i) {
+      const OutputRegistry::Binding *binding = m_outputs->get(i);
+      if (binding && binding->driver == OutputRegistry::DRIVER_PWM &&
+          binding->gpio == gpio) {
+        job.outputId = binding->id;
+        break;
+      }
+    }
+  }
+
+  switch (job.pattern) {
+  case PATTERN_BLINK:
+    if (job.driver != OutputRegistry::DRIVER_PWM) {
+      error = F("blink needs a GPIO output");
+      return false;
+    }
+    job.driver = OutputRegistry::DRIVER_NONE;
+    return true;
+  case PATTERN_PWM_SWEEP:
+    if (job.driver != OutputRegistry::DRIVER_PWM) {
+      error = F("pwm_sweep needs a PWM output");
+      return false;
+    }
+    return true;
+  case PATTERN_DAC_STAIRCASE:
+  default:
+    if (job.driver != OutputRegistry::DRIVER_MCP4725) {
+      error = F("dac_staircase needs an MCP4725 output");
+      return false;
+    }
+    return true;
+  }
+}
+
+bool OutputTester::busy(OutputRegistry::Driver driver, uint8_t gpio,
+                        uint8_t i2cAddress) const {
+  bool i2c = driver == OutputRegistry::DRIVER_MCP4725;
+  for (size_t i = 0; i < kMaxJobs; ++i) {
+    const Job &other = m_jobs[i];
+    if (other.state != JOB_RUNNING ||
+        (other.driver == OutputRegistry::DRIVER_MCP4725) != i2c) {
+      continue;
+    }
+    if (i2c ? other.i2cAddress == i2cAddress : other.gpio == gpio) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool OutputTester::targetBusy(const Job &job) const {
+  if (busy(job.driver, job.gpio, job.i2cAddress)) {
+    return true;
+  }
+  return m_funcGen && job.outputId.length() &&
+         m_funcGen->isOutputActive(job.outputId);
+}
+
+OutputTester::Job *OutputTester::freeSlot() {
+  Job *oldest = nullptr;
+  for (size_t i = 0; i < kMaxJobs; ++i) {
+    Job &job = m_jobs[i];
+    if (job.state == JOB_FREE) {
+      return &job;
+    }
+    if (job.state != JOB_RUNNING && (!oldest || job.id < oldest->id)) {
+      oldest = &job;
+    }
+  }
+  return oldest;
+}
+
+const OutputTester::Job *OutputTester::findJob(uint32_t id) const {
+  for (size_t i = 0; i < kMaxJobs; ++i) {
+    if (m_jobs[i].state != JOB_FREE && m_jobs[i].id == id) {
+      return &m_jobs[i];
+    }
+  }
+  return nullptr;
+}
+
+void OutputTester::apply(Job &job, uint32_t step) {
+  float pct;
+  if (job.pattern == PATTERN_BLINK) {
+    pct = step % 2 == 0 ? job.fromPct : job.toPct;
+  } else {
+    pct = job.fromPct + (job.toPct - job.fromPct) * step / (job.steps - 1);
+  }
+  write(job, pct);
+}
+
+void OutputTester::write(Job &job, float pct) {
+  job.levelPct = pct;
+  switch (job.driver) {
+  case OutputRegistry::DRIVER_MCP4725:
+    job.dac.setVoltage((uint16_t)(pct * kDacMaxCode / 100.0f + 0.5f), false);
+    break;
+  case OutputRegistry::DRIVER_PWM:
+    analogWrite(job.gpio, (int)(pct * kPwmMaxCode / 100.0f + 0.5f));
+    break;
+  default:
+    digitalWrite(job.gpio, pct >= 50.0f ? HIGH : LOW);
+    break;
+  }
+}
+
+void OutputTester::finish(Job &job, State state) {
+  write(job, 0.0f);
+  job.state = state;
+  job.endMs = millis();
+  if (m_logger) {
+    m_logger->info(String(F("Test ")) + patternName(job.pattern) + F(" sur ") +
+                   job.target + (state == JOB_DONE ? F(" terminé")
+                                                   : F(" annulé")) +
+                   F(" (retard max ") + String(job.maxLateUs) + F(" us)"));
+  }
+}
+
+void OutputTester::describeJob(const Job &job, JsonObject obj) const {
+  obj["id"] = job.id;
+  obj["pattern"] = patternName(job.pattern);
+  obj["target"] = job.target;
+  obj["state"] = stateName(job.state);
+  obj["step"] = job.step > job.steps ? job.steps : job.step;
+  obj["steps"] = job.steps;
+  obj["step_ms"] = job.stepUs / 1000.0f;
+  obj["level_pct"] = job.levelPct;
+  unsigned long end = job.state == JOB_RUNNING ? millis() : job.endMs;
+  obj["elapsed_ms"] = (uint32_t)(end - job.startMs);
+  obj["max_late_us"] = job.maxLateUs;
+  obj["skipped"] = job.skipped;
+}
+
+const char *OutputTester::patternName(Pattern pattern) {
+  switch (pattern) {
+  case PATTERN_PWM_SWEEP:
+    return "pwm_sweep";
+  case PATTERN_DAC_STAIRCASE:
+    return "dac_staircase";
+  case PATTERN_BLINK:
+  default:
+    return "blink";
+  }
+}
+
+const char *OutputTester::stateName(State state) {
+  switch (state) {
+  case JOB_RUNNING:
+    return "running";
+  case JOB_DONE:
+    return "done";
+  case JOB_CANCELLED:
+    return "cancelled";
+  case JOB_FREE:
+  default:
+    return "free";
+  }
+}
@@ -0,0 +1,116 @@
+// OutputTester runs output test patterns as background jobs. A request
+// only validates the pattern and returns a job id; the pattern is then
+// played from loop(), so HTTP clients, UDP and the function generator
+// keep running while a pin blinks or a DAC steps through its levels.
+//
+// Patterns:
+//   blink          square wave on a GPIO ("pin": "D5"), "freq_hz"
+//                  (default 5) for "cycles" periods (default 10).
+//   pwm_sweep      PWM duty from "from_pct" to "to_pct" in "steps"
+//                  linear steps of "step_ms", on a pin or a PWM output
+//                  of outputs.json ("output": id).
+//   dac_staircase  the same levels on an MCP4725 output ("output": id),
+//                  with fewer and longer steps by default.
+// The output is driven low (level 0) when a job ends or is cancelled.
+//
+// Step k of a job is due at start + k * step, computed from the start
+// time rather than from the previous step, so late passes of loop() do
+// not add up: the pattern keeps its overall duration and the lateness
+// of each step is reported as "max_late_us". A pass late by several
+// steps applies only the latest one.
+//
+// A target is refused while another job or an enabled generator
+// channel drives it. The last kMaxJobs jobs are kept for status
+// queries; a new job takes the slot of the oldest finished one.
+
+#ifndef MINILABOESP_OUTPUTTESTER_H
+#define MINILABOESP_OUTPUTTESTER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Adafruit_MCP4725.h>
+
+#include "core/OutputRegistry.h"
+
+class FuncGen;
+class Logger;
+
+class OutputTester {
+public:
+  enum Pattern { PATTERN_BLINK, PATTERN_PWM_SWEEP, PATTERN_DAC_STAIRCASE };
+  enum State { JOB_FREE, JOB_RUNNING, JOB_DONE, JOB_CANCELLED };
+
+  static const size_t kMaxJobs = 4;
+  static const uint32_t kMaxSteps = 1000;
+  // Shortest step: one pass of the main loop takes a few milliseconds.
+  static const uint32_t kMinStepUs = 5000;
+  // Longest job, so that step times stay within 32-bit micros().
+  static const uint32_t kMaxDurationMs = 30UL * 60UL * 1000UL;
+
+  OutputTester(OutputRegistry *outputs, FuncGen *funcGen, Logger *logger);
+
+  // Validate a request and start its job. Returns the job id, or 0 with
+  // a reason in error.
+  uint32_t start(JsonObjectConst request, String &error);
+
+  // Stop a running job. Returns false if the job is unknown or already
+  // finished.
+  bool cancel(uint32_t id);
+
+  // Status of one job. Returns false if the job is unknown.
+  bool describe(uint32_t id, JsonObject obj) const;
+
+  // Status of every remembered job, newest first.
+  void list(JsonArray arr) const;
+
+  // Apply the steps that are due. Call from loop().
+  void loop();
+
+  // Whether a running job drives the GPIO (PWM and digital outputs) or
+  // the MCP4725 at i2cAddress.
+  bool busy(OutputRegistry::Driver driver, uint8_t gpio,
+            uint8_t i2cAddress) const;
+
+private:
+  struct Job {
+    uint32_t id;
+    State state;
+    Pattern pattern;
+    String target; // pin label or output id, as requested
+    OutputRegistry::Driver driver;
+    uint8_t gpio;       // DRIVER_NONE (digital) and DRIVER_PWM
+    uint8_t i2cAddress; // DRIVER_MCP4725
+    String outputId;    // output of outputs.json on that hardware, if any
+    Adafruit_MCP4725 dac;
+    float fromPct;
+    float toPct;
+    uint32_t steps;
+    uint32_t step; // next step to apply
+    uint32_t stepUs;
+    uint32_t startUs;
+    unsigned long startMs;
+    unsigned long endMs;
+    uint32_t maxLateUs;
+    uint32_t skipped; // steps replaced by a later one
+    float levelPct; // last level written
+  };
+
+  bool resolveTarget(JsonObjectConst request, Job &job, String &error);
+  bool targetBusy(const Job &job) const;
+  Job *freeSlot();
+  const Job *findJob(uint32_t id) const;
+  void apply(Job &job, uint32_t step);
+  void write(Job &job, float pct);
+  void finish(Job &job, State state);
+  void describeJob(const Job &job, JsonObject obj) const;
+  static const char *patternName(Pattern pattern);
+  static const char *stateName(State state);
+
+  OutputRegistry *m_outputs;
+  FuncGen *m_funcGen;
+  Logger *m_logger;
+  Job m_jobs[kMaxJobs];
+  uint32_t m_nextId;
+};
+
+#endif // MINILABOESP_OUTPUTTESTER_H
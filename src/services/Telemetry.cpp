@@ -0,0 +1,413 @@
+// Implementation of the Telemetry class
+
+#include "Telemetry.h"
+
+#include "core/IORegistry.h"
+#include "core/Logger.h"
+#include "devices/Dmm.h"
+#include "devices/FuncGen.h"
+
+namespace {
+
+const char *const kTopicNames[] = {"io", "dmm", "funcgen", "logs"};
+
+const size_t kIoJsonCapacity = 4096;
+const size_t kDeltaJsonCapacity = 2048;
+// Every entry of the Logger ring, messages at their longest.
+const size_t kLogsJsonCapacity =
+    JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(Logger::kRecentEntries) +
+    Logger::kRecentEntries *
+        (JSON_OBJECT_SIZE(4) + Logger::kRecentMsgChars + 1) +
+    64;
+
+// FNV-1a, 32 bits.
+const uint32_t kFnvBasis = 2166136261u;
+
+uint32_t fnv(uint32_t hash, const char *data, size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+} // namespace
+
+Telemetry::Telemetry(HttpServer *server, IORegistry *io, Dmm *dmm,
+                     FuncGen *funcGen, Logger *logger)
+    : m_server(server), m_io(io), m_dmm(dmm), m_funcGen(funcGen),
+      m_logger(logger), m_nextTopic(0), m_overflowed(0) {
+  for (size_t c = 0; c < HttpServer::kMaxClients; ++c) {
+    for (size_t t = 0; t < kTopicCount; ++t) {
+      m_subs[c][t].leaves = nullptr;
+    }
+    drop(c);
+  }
+}
+
+Telemetry::~Telemetry() {
+  for (size_t c = 0; c < HttpServer::kMaxClients; ++c) {
+    for (size_t t = 0; t < kTopicCount; ++t) {
+      reset(m_subs[c][t]);
+    }
+  }
+}
+
+void Telemetry::begin() {
+  m_server->onWebSocket(
+      "/ws", [this](HttpServer::WebSocketEvent event, uint8_t client,
+                    const String &text) { onEvent(event, client, text); });
+  m_server->on("/api/events", HTTP_GET, [this]() { handleEventStream(); });
+}
+
+void Telemetry::loop() {
+  unsigned long now = millis();
+  for (size_t n = 0; n < kTopicCount; ++n) {
+    Topic topic = (Topic)((m_nextTopic + n) % kTopicCount);
+    bool wanted = false;
+    for (size_t c = 0; c < HttpServer::kMaxClients; ++c) {
+      wanted = wanted || due(m_subs[c][topic], now);
+    }
+    if (!wanted) {
+      continue;
+    }
+    m_nextTopic = (topic + 1) % kTopicCount;
+    if (topic == TOPIC_LOGS) {
+      for (uint8_t c = 0; c < HttpServer::kMaxClients; ++c) {
+        if (due(m_subs[c][topic], now)) {
+          publishLogs(c);
+        }
+      }
+      return;
+    }
+    // One document for every client due for the topic.
+    DynamicJsonDocument doc(capacityFor(topic));
+    bool built = build(topic, doc);
+    for (uint8_t c = 0; c < HttpServer::kMaxClients; ++c) {
+      Subscription &sub = m_subs[c][topic];
+      if (!due(sub, now)) {
+        continue;
+      }
+      if (built) {
+        publish(c, topic, doc.as<JsonVariantConst>());
+      } else {
+        sub.lastMs = now;
+      }
+    }
+    return;
+  }
+}
+
+void Telemetry::onEvent(HttpServer::WebSocketEvent event, uint8_t client,
+                        const String &text) {
+  if (client >= HttpServer::kMaxClients) {
+    return;
+  }
+  if (event == HttpServer::WS_TEXT) {
+    handleMessage(client, text);
+    return;
+  }
+  // A new connection starts without subscriptions, a closed one frees
+  // its state.
+  drop(client);
+}
+
+void Telemetry::handleMessage(uint8_t client, const String &text) {
+  StaticJsonDocument<256> msg;
+  if (deserializeJson(msg, text)) {
+    m_server->sendText(client, F("{\"error\":\"invalid json\"}"));
+    return;
+  }
+  bool unsubscribe = msg.containsKey("unsubscribe");
+  const char *key = unsubscribe ? "unsubscribe" : "subscribe";
+  int topic = topicFromName(msg[key] | "");
+  if (topic < 0) {
+    m_server->sendText(client, F("{\"error\":\"unknown topic\"}"));
+    return;
+  }
+  if (unsubscribe) {
+    reset(m_subs[client][topic]);
+    return;
+  }
+  subscribe(client, topic, msg["interval_ms"] | (uint32_t)kDefaultIntervalMs);
+}
+
+void Telemetry::handleEventStream() {
+  String topics = m_server->hasArg("topics") ? m_server->arg("topics")
+                                             : String(F("io,dmm"));
+  uint32_t interval = kDefaultIntervalMs;
+  if (m_server->hasArg("interval_ms")) {
+    interval = m_server->arg("interval_ms").toInt();
+  }
+  // Validate the whole list before taking over the connection.
+  uint8_t wanted = 0;
+  int start = 0;
+  while (start <= (int)topics.length()) {
+    int end = topics.indexOf(',', start);
+    if (end < 0) {
+      end = topics.length();
+    }
+    String name = topics.substring(start, end);
+    name.trim();
+    int topic = topicFromName(name.c_str());
+    if (topic < 0) {
+      m_server->send(400, "application/json",
+                     "{\"error\":\"unknown topic\"}");
+      return;
+    }
+    wanted |= 1 << topic;
+    start = end + 1;
+  }
+  int client = m_server->beginEventStream();
+  if (client < 0) {
+    m_server->send(400, "application/json",
+                   "{\"error\":\"cannot stream\"}");
+    return;
+  }
+  drop(client);
+  m_stream[client] = true;
+  for (int t = 0; t < kTopicCount; ++t) {
+    if (wanted & (1 << t)) {
+      subscribe(client, t, interval);
+    }
+  }
+}
+
+void Telemetry::subscribe(uint8_t client, int topic, uint32_t intervalMs) {
+  Subscription &sub = m_subs[client][topic];
+  reset(sub);
+  sub.active = true;
+  sub.intervalMs = intervalMs < kMinIntervalMs ? (uint32_t)kMinIntervalMs
+                                               : intervalMs;
+  // Due right away.
+  sub.lastMs = millis() - sub.intervalMs;
+}
+
+void Telemetry::drop(uint8_t client) {
+  for (size_t t = 0; t < kTopicCount; ++t) {
+    reset(m_subs[client][t]);
+  }
+  m_stream[client] = false;
+}
+
+void Telemetry::reset(Subscription &sub) {
+  delete[] sub.leaves;
+  sub.active = false;
+  sub.intervalMs = kDefaultIntervalMs;
+  sub.lastMs = 0;
+  sub.fullMs = 0;
+  sub.seq = 0;
+  sub.leaves = nullptr;
+  sub.leafCount = 0;
+  sub.shape = 0;
+  sub.logSeq = 0;
+}
+
+bool Telemetry::due(const Subscription &sub, unsigned long now) const {
+  return sub.active && now - sub.lastMs >= sub.intervalMs;
+}
+
+size_t Telemetry::capacityFor(Topic topic) const {
+  switch (topic) {
+  case TOPIC_DMM:
+    return m_dmm ? m_dmm->snapshotJsonCapacity() : 0;
+  case TOPIC_FUNCGEN:
+    return m_funcGen ? m_funcGen->statusJsonCapacity() : 0;
+  default:
+    return kIoJsonCapacity;
+  }
+}
+
+bool Telemetry::build(Topic topic, JsonDocument &doc) {
+  switch (topic) {
+  case TOPIC_IO:
+    if (!m_io) {
+      return false;
+    }
+    m_io->snapshot(doc);
+    break;
+  case TOPIC_DMM:
+    if (!m_dmm) {
+      return false;
+    }
+    m_dmm->getSnapshot(doc);
+    break;
+  case TOPIC_FUNCGEN:
+    if (!m_funcGen) {
+      return false;
+    }
+    m_funcGen->snapshotStatus(doc.to<JsonObject>());
+    break;
+  default:
+    return false;
+  }
+  // A truncated document would look like a change of structure: the
+  // topic is skipped, which is logged once until it fits again.
+  uint8_t bit = 1 << topic;
+  if (!doc.overflowed()) {
+    m_overflowed &= ~bit;
+    return true;
+  }
+  if (!(m_overflowed & bit) && m_logger) {
+    m_logger->error(String(F("Telemetry: document ")) + kTopicNames[topic] +
+                    F(" tronqué, sujet non publié"));
+  }
+  m_overflowed |= bit;
+  return false;
+}
+
+void Telemetry::publish(uint8_t client, Topic topic, JsonVariantConst doc) {
+  Subscription &sub = m_subs[client][topic];
+  unsigned long now = millis();
+  sub.lastMs = now;
+
+  if (m_stream[client]) {
+    String text;
+    serializeJson(doc, text);
+    if (!m_server->sendEvent(client, kTopicNames[topic], text)) {
+      drop(client);
+    }
+    return;
+  }
+
+  String path;
+  Walk count = {};
+  count.shape = kFnvBasis;
+  walk(doc, path, count);
+  bool keyframe = sub.seq == 0 || count.count != sub.leafCount ||
+                  count.shape != sub.shape || now - sub.fullMs >= kKeyframeMs;
+
+  DynamicJsonDocument delta(kDeltaJsonCapacity);
+  Walk diff = {};
+  diff.shape = kFnvBasis;
+  diff.hashes = count.count ? new uint32_t[count.count] : nullptr;
+  if (!keyframe) {
+    delta["topic"] = kTopicNames[topic];
+    delta["seq"] = sub.seq;
+    diff.previous = sub.leaves;
+    diff.set = delta.createNestedObject("set");
+  }
+  walk(doc, path, diff);
+  bool full = keyframe || diff.changed * 2 > diff.count || delta.overflowed();
+  if (!full && diff.changed == 0) {
+    delete[] diff.hashes;
+    return;
+  }
+
+  String text;
+  if (full) {
+    text = F("{\"topic\":\"");
+    text += kTopicNames[topic];
+    text += F("\",\"seq\":");
+    text += sub.seq;
+    text += F(",\"full\":");
+    serializeJson(doc, text);
+    text += '}';
+  } else {
+    serializeJson(delta, text);
+  }
+  if (!m_server->sendText(client, text)) {
+    // Still busy with the previous message: the changes are sent at the
+    // next interval, against what the client already has.
+    delete[] diff.hashes;
+    return;
+  }
+  delete[] sub.leaves;
+  sub.leaves = diff.hashes;
+  sub.leafCount = diff.count;
+  sub.shape = diff.shape;
+  sub.seq++;
+  if (full) {
+    sub.fullMs = now;
+  }
+}
+
+void Telemetry::publishLogs(uint8_t client) {
+  Subscription &sub = m_subs[client][TOPIC_LOGS];
+  sub.lastMs = millis();
+  if (!m_logger || m_logger->sequence() == sub.logSeq) {
+    return;
+  }
+  DynamicJsonDocument doc(kLogsJsonCapacity);
+  doc["topic"] = kTopicNames[TOPIC_LOGS];
+  JsonArray entries = doc.createNestedArray("entries");
+  m_logger->recent(sub.logSeq, entries);
+  uint32_t sent = m_logger->sequence();
+  if (doc.overflowed()) {
+    // Send the entries stored whole; the others go at the next interval.
+    size_t whole = 0;
+    while (whole < entries.size() &&
+           entries[whole]["msg"].is<const char *>()) {
+      whole++;
+    }
+    if (whole == 0) {
+      return;
+    }
+    while (entries.size() > whole) {
+      entries.remove(whole);
+    }
+    sent = entries[whole - 1]["seq"];
+  }
+  String text;
+  serializeJson(doc, text);
+  if (m_stream[client]) {
+    if (!m_server->sendEvent(client, kTopicNames[TOPIC_LOGS], text)) {
+      drop(client);
+      return;
+    }
+  } else if (!m_server->sendText(client, text)) {
+    return;
+  }
+  sub.logSeq = sent;
+}
+
+void Telemetry::walk(JsonVariantConst value, String &path, Walk &w) const {
+  size_t length = path.length();
+  if (value.is<JsonObjectConst>()) {
+    for (JsonPairConst kv : value.as<JsonObjectConst>()) {
+      if (length) {
+        path += '.';
+      }
+      path += kv.key().c_str();
+      walk(kv.value(), path, w);
+      path.remove(length);
+    }
+    return;
+  }
+  if (value.is<JsonArrayConst>()) {
+    size_t i = 0;
+    for (JsonVariantConst item : value.as<JsonArrayConst>()) {
+      if (length) {
+        path += '.';
+      }
+      path += i++;
+      walk(item, path, w);
+      path.remove(length);
+    }
+    return;
+  }
+  if (path == "age_ms" || path.endsWith(".age_ms")) {
+    return;
+  }
+  char text[64];
+  size_t n = serializeJson(value, text, sizeof(text));
+  uint32_t pathHash = fnv(kFnvBasis, path.c_str(), path.length());
+  uint32_t hash = fnv(pathHash, text, n);
+  w.shape = fnv(w.shape, (const char *)&pathHash, sizeof(pathHash));
+  if (w.hashes) {
+    w.hashes[w.count] = hash;
+  }
+  if (w.previous && w.previous[w.count] != hash) {
+    w.changed++;
+    w.set[path] = value;
+  }
+  w.count++;
+}
+
+int Telemetry::topicFromName(const char *name) {
+  for (size_t t = 0; t < kTopicCount; ++t) {
+    if (strcmp(name, kTopicNames[t]) == 0) {
+      return t;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,123 @@
+// Telemetry pushes live state to WebSocket clients on /ws, and to
+// Server-Sent Events clients on /api/events, so pages and tools do not
+// have to poll the REST endpoints.
+//
+// A client subscribes to topics by sending text frames:
+//   {"subscribe": "dmm", "interval_ms": 250}
+//   {"unsubscribe": "dmm"}
+// Topics are "io" (IORegistry snapshot), "dmm" (DMM snapshot),
+// "funcgen" (generator status) and "logs" (new log entries). The
+// interval defaults to kDefaultIntervalMs and is at least
+// kMinIntervalMs.
+//
+// The first message of a topic carries the whole document:
+//   {"topic": "dmm", "seq": 0, "full": {...}}
+// Later ones only list the leaves that changed since the previous
+// message sent to that client, by dotted path:
+//   {"topic": "dmm", "seq": 1, "set": {"channels.0.value": 1.234}}
+// and nothing is sent while nothing changes. Each leaf is remembered
+// as a 32-bit hash of its path and value, so a client costs 4 bytes
+// per leaf rather than a copy of the document. A full document is sent
+// again when the structure changes, when more than half the leaves
+// changed and every kKeyframeMs. "age_ms" leaves change on every
+// snapshot and are left out of the comparison: they are only up to
+// date in full documents. Log entries are sent as they come:
+//   {"topic": "logs", "entries": [{seq, ts, level, msg}...]}
+//
+// Tools that cannot use WebSockets open a single stream instead:
+//   GET /api/events?topics=io,dmm&interval_ms=500
+// (topics default to "io,dmm"). Each event is named after its topic
+// and its data is the whole document, on one line:
+//   event: dmm
+//   data: {"channels": [...]}
+// Logs events carry {"topic": "logs", "entries": [...]} as above.
+// HttpServer bounds what may wait for such a client and drops it if it
+// falls behind.
+//
+// loop() builds at most one topic per call, shared by every client
+// due for it. A WebSocket client still receiving its previous message
+// skips the update and gets the changes at its next interval.
+
+#ifndef MINILABOESP_TELEMETRY_H
+#define MINILABOESP_TELEMETRY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "services/HttpServer.h"
+
+class IORegistry;
+class Dmm;
+class FuncGen;
+class Logger;
+
+class Telemetry {
+public:
+  static const uint32_t kMinIntervalMs = 100;
+  static const uint32_t kDefaultIntervalMs = 1000;
+  static const uint32_t kKeyframeMs = 30000;
+
+  Telemetry(HttpServer *server, IORegistry *io, Dmm *dmm, FuncGen *funcGen,
+            Logger *logger);
+  ~Telemetry();
+
+  // Register the /ws endpoint. Call before HttpServer::begin().
+  void begin();
+
+  // Push the topic that is due next. Call from loop().
+  void loop();
+
+private:
+  enum Topic { TOPIC_IO, TOPIC_DMM, TOPIC_FUNCGEN, TOPIC_LOGS, kTopicCount };
+
+  struct Subscription {
+    bool active;
+    uint32_t intervalMs;
+    unsigned long lastMs;
+    unsigned long fullMs; // last full document
+    uint32_t seq;
+    // Leaves of the last document sent: hash of path and value, in
+    // document order, plus a hash of the paths alone.
+    uint32_t *leaves;
+    size_t leafCount;
+    uint32_t shape;
+    uint32_t logSeq; // last log entry sent
+  };
+
+  // State of a walk over the leaves of a document.
+  struct Walk {
+    const uint32_t *previous; // nullptr: no comparison
+    uint32_t *hashes;         // nullptr: only count
+    size_t count;
+    uint32_t shape;
+    size_t changed;
+    JsonObject set; // receives the changed leaves
+  };
+
+  void onEvent(HttpServer::WebSocketEvent event, uint8_t client,
+               const String &text);
+  void handleMessage(uint8_t client, const String &text);
+  void handleEventStream();
+  void subscribe(uint8_t client, int topic, uint32_t intervalMs);
+  // Forget every subscription of a client.
+  void drop(uint8_t client);
+  void reset(Subscription &sub);
+  bool due(const Subscription &sub, unsigned long now) const;
+  bool build(Topic topic, JsonDocument &doc);
+  void publish(uint8_t client, Topic topic, JsonVariantConst doc);
+  void publishLogs(uint8_t client);
+  void walk(JsonVariantConst value, String &path, Walk &w) const;
+  static int topicFromName(const char *name);
+  size_t capacityFor(Topic topic) const;
+
+  HttpServer *m_server;
+  IORegistry *m_io;
+  Dmm *m_dmm;
+  FuncGen *m_funcGen;
+  Logger *m_logger;
+  Subscription m_subs[HttpServer::kMaxClients][kTopicCount];
+  bool m_stream[HttpServer::kMaxClients]; // Server-Sent Events client
+  uint8_t m_nextTopic;
+  uint8_t m_overflowed; // topics whose last document was truncated
+};
+
+#endif // MINILABOESP_TELEMETRY_H
@@ -5,6 +5,7 @@
 #include "core/ConfigStore.h"
 #include "core/IORegistry.h"
 #include "core/Logger.h"
+#include "devices/FuncGen.h"
 #include <ESP8266WiFi.h>
 #include <ArduinoJson.h>
 #include <math.h>
@@ -77,7 +78,13 @@ bool extractFloat(JsonVariantConst value, float &out) {
 
 UdpService::UdpService(ConfigStore *config, IORegistry *ioReg, Logger *logger)
     : m_rxPort(50000), m_txPort(50001), m_config(config), m_io(ioReg),
-      m_logger(logger), m_lastSend(0), m_enabled(true), m_running(false) {}
+      m_logger(logger), m_funcGen(nullptr), m_lastSend(0),
+      m_lastDiscoverMs(0), m_discoverSent(false), m_enabled(true),
+      m_running(false) {
+  for (size_t i = 0; i < kMaxPeers; ++i) {
+    m_peers[i].used = false;
+  }
+}
 
 void UdpService::begin() {
   if (m_config) {
@@ -120,7 +127,7 @@ void UdpService::loop() {
   int packetSize = m_udp.parsePacket();
   if (packetSize > 0) {
     // Read incoming packet
-    const int bufSize = 384;
+    const int bufSize = kMaxPacketBytes;
     char buf[bufSize];
     int len = m_udp.read(buf, bufSize - 1);
     if (len < 0) len = 0;
@@ -145,11 +152,19 @@ void UdpService::loop() {
     m_udp.write((const uint8_t *)payload.c_str(), payload.length());
     m_udp.endPacket();
   }
+
+  // Keep the peer table fresh: replies are handled as they arrive.
+  if (!m_discoverSent || now - m_lastDiscoverMs >= kDiscoverIntervalMs) {
+    broadcastDiscover();
+  }
+  expirePeers();
 }
 
 void UdpService::handleIncomingPacket(const char *buf, int len,
                                       const IPAddress &ip, uint16_t port) {
-  StaticJsonDocument<512> doc;
+  // Discovery replies list every input of the peer: too large for the
+  // stack.
+  DynamicJsonDocument doc(1024);
   DeserializationError err = deserializeJson(doc, buf, len);
   if (err) {
     if (m_logger) {
@@ -163,6 +178,23 @@ void UdpService::handleIncomingPacket(const char *buf, int len,
     return;
   }
 
+  // Generator triggers are latency sensitive: handle them before the
+  // source fields are parsed.
+  if (strcmp(cmd, "trigger") == 0 || strcmp(cmd, "funcgen_trigger") == 0) {
+    handleTrigger(doc, ip, port);
+    return;
+  }
+
+  // Our own broadcasts may come back to us.
+  const char *mac = doc["mac"] | "";
+  if (mac[0] && WiFi.macAddress().equalsIgnoreCase(mac)) {
+    return;
+  }
+  if (strcmp(cmd, "discover_reply") == 0) {
+    updatePeer(doc, ip);
+    return;
+  }
+
   String sourceMac = trimmedVariant(doc["mac"]);
   if (!hasText(sourceMac)) {
     sourceMac = trimmedVariant(doc["source_mac"]);
@@ -358,108 +390,160 @@ void UdpService::sendDiscoveryReply(const IPAddress &ip, uint16_t port) {
   }
 }
 
-bool UdpService::discoverPeers(JsonDocument &doc, unsigned long timeoutMs) {
+void UdpService::handleTrigger(JsonDocument &doc, const IPAddress &ip,
+                               uint16_t port) {
+  // {"cmd":"trigger","channel":0} starts a burst; adding "gate":true or
+  // false opens or closes the gate of a gated channel. "target" may be
+  // given instead of the channel index.
+  bool ok = false;
+  int channel = doc["channel"] | -1;
+  if (m_funcGen) {
+    if (channel < 0 && doc["target"].is<const char *>()) {
+      channel = m_funcGen->findChannelByTarget(
+          String(doc["target"].as<const char *>()));
+    }
+    if (doc.containsKey("gate")) {
+      ok = m_funcGen->setGate(channel, doc["gate"].as<bool>(), "udp");
+    } else {
+      ok = m_funcGen->trigger(channel, "udp");
+    }
+  }
+  if (!(doc["ack"] | true)) {
+    return;
+  }
+  StaticJsonDocument<96> reply;
+  reply["type"] = "trigger_ack";
+  reply["channel"] = channel;
+  reply["ok"] = ok;
+  String payload;
+  serializeJson(reply, payload);
+  m_udp.beginPacket(ip, port);
+  m_udp.write(reinterpret_cast<const uint8_t *>(payload.c_str()),
+              payload.length());
+  m_udp.endPacket();
+}
+
+bool UdpService::describePeers(JsonDocument &doc, bool refresh) {
   doc.clear();
   JsonArray devices = doc.createNestedArray("devices");
   if (!m_running) {
     doc["status"] = "udp_disabled";
     return false;
   }
+  if (refresh) {
+    broadcastDiscover();
+  }
+  expirePeers();
 
+  unsigned long now = millis();
+  for (size_t i = 0; i < kMaxPeers; ++i) {
+    const Peer &peer = m_peers[i];
+    if (!peer.used) {
+      continue;
+    }
+    JsonObject dest = devices.createNestedObject();
+    dest["mac"] = peer.mac;
+    dest["hostname"] = peer.hostname;
+    dest["ip"] = peer.ip;
+    dest["rx_port"] = peer.rxPort;
+    dest["tx_port"] = peer.txPort;
+    dest["inputs"] = serialized(peer.inputs);
+    dest["age_ms"] = (uint32_t)(now - peer.lastSeenMs);
+  }
+  doc["status"] = devices.size() ? "ok" : "no_devices";
+  doc["discovering"] =
+      m_discoverSent && now - m_lastDiscoverMs < kReplyWindowMs;
+  if (m_discoverSent) {
+    doc["last_discover_ms"] = (uint32_t)(now - m_lastDiscoverMs);
+  }
+  return devices.size() > 0;
+}
+
+void UdpService::broadcastDiscover() {
+  m_lastDiscoverMs = millis();
+  m_discoverSent = true;
   StaticJsonDocument<128> request;
   request["cmd"] = "discover";
   request["mac"] = WiFi.macAddress();
   String payload;
   serializeJson(request, payload);
-
-  if (m_logger) {
-    m_logger->info("Starting UDP discovery broadcast");
-  }
   m_udp.beginPacket(IPAddress(255, 255, 255, 255), m_rxPort);
   m_udp.write(reinterpret_cast<const uint8_t *>(payload.c_str()),
               payload.length());
   m_udp.endPacket();
+  if (m_logger) {
+    m_logger->debug("UDP discovery broadcast");
+  }
+}
 
-  unsigned long start = millis();
-  unsigned long elapsed = 0;
-  while ((elapsed = millis() - start) <= timeoutMs) {
-    int packetSize = m_udp.parsePacket();
-    if (packetSize > 0) {
-      const int bufSize = 512;
-      char buf[bufSize];
-      int len = m_udp.read(buf, bufSize - 1);
-      if (len < 0)
-        len = 0;
-      if (len >= bufSize)
-        len = bufSize - 1;
-      buf[len] = '\0';
-
-      StaticJsonDocument<1024> reply;
-      DeserializationError err = deserializeJson(reply, buf, len);
-      if (err) {
-        if (m_logger) {
-          m_logger->warning(String("UDP discovery parse error: ") +
-                            err.f_str());
-        }
-        continue;
+void UdpService::updatePeer(JsonDocument &reply, const IPAddress &ip) {
+  String mac = reply["mac"] | String();
+  String address = reply["ip"] | ip.toString();
+
+  // Same peer: same MAC, or same address when it gives none.
+  Peer *dest = nullptr;
+  for (size_t i = 0; i < kMaxPeers && !dest; ++i) {
+    Peer &peer = m_peers[i];
+    if (peer.used && (mac.length() ? mac.equalsIgnoreCase(peer.mac)
+                                   : (!peer.mac.length() &&
+                                      peer.ip == address))) {
+      dest = &peer;
+    }
+  }
+  if (!dest) {
+    // A free slot, or the peer heard from longest ago.
+    unsigned long now = millis();
+    for (size_t i = 0; i < kMaxPeers; ++i) {
+      Peer &peer = m_peers[i];
+      if (!peer.used) {
+        dest = &peer;
+        break;
       }
-
-      const char *type = reply["type"] | reply["cmd"] | "";
-      if (strcmp(type, "discover_reply") != 0) {
-        // Let the regular loop handler process other message types.
-        handleIncomingPacket(buf, len, m_udp.remoteIP(), m_udp.remotePort());
-        continue;
+      if (!dest || now - peer.lastSeenMs > now - dest->lastSeenMs) {
+        dest = &peer;
       }
+    }
+    if (m_logger) {
+      m_logger->info(String("UDP peer found: ") + address);
+    }
+  }
 
-      String mac = reply["mac"] | String();
-      String hostname = reply["hostname"] | String();
-      String ip = reply["ip"] | m_udp.remoteIP().toString();
-      uint16_t rxPort = reply["rx_port"] | m_rxPort;
-      uint16_t txPort = reply["tx_port"] | m_txPort;
-
-      JsonObject dest;
-      if (mac.length()) {
-        for (JsonVariant existingVar : devices) {
-          JsonObject existing = existingVar.as<JsonObject>();
-          const char *existingMac = existing["mac"] | "";
-          if (existingMac && mac.equalsIgnoreCase(existingMac)) {
-            dest = existing;
-            break;
-          }
-        }
-      }
-      if (!dest.isNull()) {
-        dest.clear();
-      } else {
-        dest = devices.createNestedObject();
-      }
-      dest["mac"] = mac;
-      dest["hostname"] = hostname;
-      dest["ip"] = ip;
-      dest["rx_port"] = rxPort;
-      dest["tx_port"] = txPort;
-      JsonArray inputs = dest.createNestedArray("inputs");
-      JsonArray payloadInputs = reply["inputs"].as<JsonArray>();
-      if (!payloadInputs.isNull()) {
-        for (JsonVariant entry : payloadInputs) {
-          if (!entry.is<JsonObject>())
-            continue;
-          JsonObject src = entry.as<JsonObject>();
-          JsonObject target = inputs.createNestedObject();
-          target["id"] = src["id"] | "";
-          target["type"] = src["type"] | "";
-          target["index"] = src["index"] | 0;
-          target["unit"] = src["unit"] | "";
-          target["k"] = src["k"] | 0.0f;
-          target["b"] = src["b"] | 0.0f;
-        }
+  dest->used = true;
+  dest->mac = mac;
+  dest->hostname = reply["hostname"] | String();
+  dest->ip = address;
+  dest->rxPort = reply["rx_port"] | m_rxPort;
+  dest->txPort = reply["tx_port"] | m_txPort;
+  dest->lastSeenMs = millis();
+
+  // Keep only what the input editor uses of each advertised input.
+  DynamicJsonDocument inputs(768);
+  JsonArray arr = inputs.to<JsonArray>();
+  for (JsonVariantConst entry : reply["inputs"].as<JsonArrayConst>()) {
+    if (!entry.is<JsonObjectConst>())
+      continue;
+    JsonObject target = arr.createNestedObject();
+    target["id"] = entry["id"] | "";
+    target["type"] = entry["type"] | "";
+    target["index"] = entry["index"] | 0;
+    target["unit"] = entry["unit"] | "";
+    target["k"] = entry["k"] | 0.0f;
+    target["b"] = entry["b"] | 0.0f;
+  }
+  dest->inputs = "";
+  serializeJson(arr, dest->inputs);
+}
+
+void UdpService::expirePeers() {
+  unsigned long now = millis();
+  for (size_t i = 0; i < kMaxPeers; ++i) {
+    Peer &peer = m_peers[i];
+    if (peer.used && now - peer.lastSeenMs >= kPeerTimeoutMs) {
+      peer.used = false;
+      peer.inputs = "";
+      if (m_logger) {
+        m_logger->info(String("UDP peer lost: ") + peer.ip);
       }
-      dest["lastSeenMs"] = elapsed;
     }
-    delay(10);
   }
-
-  doc["status"] = devices.size() ? "ok" : "no_devices";
-  doc["elapsed_ms"] = elapsed;
-  return devices.size() > 0;
-}
\ No newline at end of file
+}
@@ -3,6 +3,13 @@
 // binds to a configurable port and logs incoming packets. In the
 // future it can broadcast values to other MiniLabo devices or PCs
 // and execute commands received over the network.
+//
+// Other MiniLabo modules are discovered in the background: loop()
+// broadcasts a "discover" request every kDiscoverIntervalMs and the
+// "discover_reply" packets that come back, at any time, update a table
+// of up to kMaxPeers peers (address, ports, advertised inputs and when
+// they were last heard). A peer silent for kPeerTimeoutMs is dropped.
+// describePeers() reads the table and never waits for the network.
 
 #ifndef MINILABOESP_UDPSERVICE_H
 #define MINILABOESP_UDPSERVICE_H
@@ -14,6 +21,7 @@
 class ConfigStore;
 class IORegistry;
 class Logger;
+class FuncGen;
 
 class UdpService {
 public:
@@ -22,21 +30,50 @@ public:
   void loop();
   bool isRunning() const { return m_running; }
 
-  // Perform a discovery cycle to find other MiniLabo devices on the
-  // network. Results are written to the provided JSON document as an
-  // object containing a "devices" array. The function returns true if at
-  // least one device responded. When the service is disabled the
-  // document contains {"status":"udp_disabled","devices":[]}. The
-  // timeout controls how long the scan waits for responses.
-  bool discoverPeers(JsonDocument &doc, unsigned long timeoutMs = 600);
+  // Attach the function generator so that "trigger" packets can start
+  // bursts or drive the gate of a generator channel.
+  void setFuncGen(FuncGen *funcGen) { m_funcGen = funcGen; }
+
+  static const size_t kMaxPeers = 8;
+  static const uint32_t kDiscoverIntervalMs = 30000;
+  static const uint32_t kPeerTimeoutMs = 3 * kDiscoverIntervalMs;
+  // Replies to a discovery request are expected within this delay.
+  static const uint32_t kReplyWindowMs = 1000;
+  // Largest packet read; discovery replies list every input.
+  static const size_t kMaxPacketBytes = 768;
+
+  // Write the peer table to the document as an object containing a
+  // "devices" array (mac, hostname, ip, rx_port, tx_port, inputs,
+  // age_ms) and "discovering" while replies to the last request may
+  // still arrive. With refresh a discovery request is broadcast now,
+  // its replies show up in later calls. Returns true if the table has
+  // at least one peer. When the service is disabled the document
+  // contains {"status":"udp_disabled","devices":[]}.
+  bool describePeers(JsonDocument &doc, bool refresh = false);
 
 private:
+  struct Peer {
+    String mac;
+    String hostname;
+    String ip;
+    uint16_t rxPort;
+    uint16_t txPort;
+    String inputs; // JSON array of the advertised inputs
+    unsigned long lastSeenMs;
+    bool used;
+  };
+
+  void broadcastDiscover();
+  void updatePeer(JsonDocument &reply, const IPAddress &ip);
+  void expirePeers();
+
   void handleIncomingPacket(const char *buf, int len, const IPAddress &ip,
                             uint16_t port);
   size_t applyRemoteValue(JsonVariantConst payload, const String &mac,
                           const String &hostname, const String &ip);
   void appendLocalInputs(JsonArray &arr);
   void sendDiscoveryReply(const IPAddress &ip, uint16_t port);
+  void handleTrigger(JsonDocument &doc, const IPAddress &ip, uint16_t port);
 
   WiFiUDP m_udp;
   uint16_t m_rxPort;
@@ -44,7 +81,11 @@ private:
   ConfigStore *m_config;
   IORegistry *m_io;
   Logger *m_logger;
+  FuncGen *m_funcGen;
   unsigned long m_lastSend;
+  unsigned long m_lastDiscoverMs;
+  bool m_discoverSent; // a request went out since begin()
+  Peer m_peers[kMaxPeers];
   bool m_enabled;
   bool m_running;
 };
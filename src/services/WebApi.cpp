@@ -7,62 +7,60 @@
 #include "core/Logger.h"
 #include "devices/Dmm.h"
 #include "devices/FuncGen.h"
+#include "services/DataLogger.h"
 #include "services/FileWriteService.h"
+#include "services/OutputTester.h"
 #include "services/UdpService.h"
+#include "services/WebAssets.h"
 #include <FS.h>
 #include <LittleFS.h>
 #include <ArduinoJson.h>
 #include <ESP8266WiFi.h>
+#include <memory>
+#include <stdlib.h>
 
 namespace {
-struct PinMapEntry {
-  const char *label;
-  uint8_t gpio;
-};
-
-const PinMapEntry kPinMap[] = {
-    {"D0", 16}, {"D1", 5},  {"D2", 4},  {"D3", 0}, {"D4", 2},
-    {"D5", 14}, {"D6", 12}, {"D7", 13}, {"D8", 15},
-};
 
-int pinLabelToGpio(const String &label) {
-  for (const auto &entry : kPinMap) {
-    if (label.equalsIgnoreCase(entry.label)) {
-      return entry.gpio;
-    }
-  }
+// Print appending to a String up to a size limit.
+class BoundedPrint : public Print {
+public:
+  BoundedPrint(String &out, size_t limit) : m_out(out), m_limit(limit) {}
 
-  String trimmed = label;
-  trimmed.trim();
-  if (!trimmed.length()) return -1;
+  size_t write(uint8_t c) override { return write(&c, 1); }
 
-  String upper = trimmed;
-  upper.toUpperCase();
-  if (upper.startsWith("GPIO")) {
-    String numeric = upper.substring(4);
-    bool digits = numeric.length() > 0;
-    for (size_t i = 0; i < numeric.length() && digits; ++i) {
-      char c = numeric.charAt(i);
-      if (c < '0' || c > '9') digits = false;
-    }
-    if (digits) {
-      int value = numeric.toInt();
-      if (value >= 0 && value <= 16) return value;
+  size_t write(const uint8_t *data, size_t length) override {
+    if (m_out.length() + length > m_limit) {
+      m_overflowed = true;
+      return 0;
     }
+    m_out.concat((const char *)data, length);
+    return length;
   }
 
-  bool digits = true;
-  for (size_t i = 0; i < trimmed.length() && digits; ++i) {
-    char c = trimmed.charAt(i);
-    if (c < '0' || c > '9') digits = false;
-  }
-  if (digits) {
-    int value = trimmed.toInt();
-    if (value >= 0 && value <= 16) return value;
+  bool overflowed() const { return m_overflowed; }
+  // Drop what was written after length.
+  void rewind(size_t length) {
+    m_out.remove(length);
+    m_overflowed = false;
   }
 
-  return -1;
+private:
+  String &m_out;
+  size_t m_limit;
+  bool m_overflowed = false;
+};
+
+// Request bodies are logged at most this long: Logger writes to Serial
+// synchronously, at about 7.5 KB/s.
+const size_t kMaxLoggedBody = 96;
+
+String clipped(const String &text) {
+  if (text.length() <= kMaxLoggedBody) {
+    return text;
+  }
+  return text.substring(0, kMaxLoggedBody) + F("...");
 }
+
 } // namespace
 
 WebApi::WebApi(ConfigStore *config, IORegistry *ioReg, Dmm *dmm,
@@ -70,7 +68,9 @@ WebApi::WebApi(ConfigStore *config, IORegistry *ioReg, Dmm *dmm,
                FileWriteService *fileService, UdpService *udp)
     : m_config(config), m_io(ioReg), m_dmm(dmm), m_funcGen(funcGen),
       m_logger(logger), m_fileService(fileService), m_udp(udp),
-      m_server(80) {}
+      m_dataLogger(nullptr), m_outputTester(nullptr), m_server(80),
+      m_telemetry(&m_server, ioReg, dmm, funcGen, logger),
+      m_wifiScanner(logger) {}
 
 void WebApi::begin() {
   // Register handlers for API endpoints
@@ -99,11 +99,26 @@ void WebApi::begin() {
       [this]() {
         handleOutputsTest();
       });
+  m_server.on(
+      "/api/outputs/test", HTTP_GET,
+      [this]() {
+        handleOutputsTestStatus();
+      });
+  m_server.on(
+      "/api/outputs/test/cancel", HTTP_POST,
+      [this]() {
+        handleOutputsTestCancel();
+      });
   m_server.on(
       "/api/dmm", HTTP_GET,
       [this]() {
         handleDmm();
       });
+  m_server.on(
+      "/api/dmm", HTTP_POST,
+      [this]() {
+        handleDmmPost();
+      });
   m_server.on(
       "/api/scope", HTTP_GET,
       [this]() {
@@ -119,11 +134,46 @@ void WebApi::begin() {
       [this]() {
         handleFuncGenPost();
       });
+  m_server.on(
+      "/api/funcgen/trigger", HTTP_POST,
+      [this]() {
+        handleFuncGenTrigger();
+      });
+  m_server.on(
+      "/api/funcgen/calibrate", HTTP_POST,
+      [this]() {
+        handleFuncGenCalibrate();
+      });
+  m_server.on(
+      "/api/funcgen/ramp", HTTP_POST,
+      [this]() {
+        handleFuncGenRamp();
+      });
   m_server.on(
       "/api/logs/tail", HTTP_GET,
       [this]() {
         handleLogsTail();
       });
+  m_server.on(
+      "/api/logger", HTTP_GET,
+      [this]() {
+        handleLoggerGet();
+      });
+  m_server.on(
+      "/api/logger/config", HTTP_POST,
+      [this]() {
+        handleLoggerConfig();
+      });
+  m_server.on(
+      "/api/logger/clear", HTTP_POST,
+      [this]() {
+        handleLoggerClear();
+      });
+  m_server.on(
+      "/api/logger/data", HTTP_GET,
+      [this]() {
+        handleLoggerData();
+      });
 
   // Endpoint to get the number of pending file writes. Returns JSON
   // {"pending": <number>}
@@ -152,37 +202,30 @@ void WebApi::begin() {
       [this]() {
         handleLogin();
       });
-  // Serve the main web application from LittleFS. Register an explicit
-  // handler for the root path so we can return index.html while still
-  // exposing the rest of the files in the LittleFS filesystem via
-  // serveStatic. The explicit handler is necessary because
-  // ESP8266WebServer::serveStatic returns void and therefore does not
-  // support chaining setDefaultFile like AsyncWebServer does.
   m_server.on(
-      "/", HTTP_GET,
+      "/api/batch", HTTP_POST,
       [this]() {
-        if (!LittleFS.exists("/index.html")) {
-          m_server.send(500, "text/plain",
-                        "index.html not found in LittleFS");
-          return;
-        }
-        fs::File file = LittleFS.open("/index.html", "r");
-        if (!file) {
-          m_server.send(500, "text/plain",
-                        "Failed to open index.html");
-          return;
-        }
-        m_server.streamFile(file, "text/html");
-        file.close();
+        handleBatch();
       });
+  m_server.on(
+      "/api/http", HTTP_GET,
+      [this]() {
+        handleHttpStats();
+      });
+  // Serve the web application from flash, then any other file from
+  // LittleFS. "/" returns index.html.
+  m_server.serveFlash(WebAssets::find);
   m_server.serveStatic("/", LittleFS, "/");
   // Start the server
+  m_telemetry.begin();
   m_server.begin();
   if (m_logger) m_logger->info("HTTP server started");
 }
 
 void WebApi::loop() {
   m_server.handleClient();
+  m_telemetry.loop();
+  m_wifiScanner.loop();
 }
 
 void WebApi::handleGetConfig() {
@@ -234,6 +277,11 @@ void WebApi::handleIoSnapshot() {
 }
 
 void WebApi::handleOutputsTest() {
+  if (!m_outputTester) {
+    m_server.send(500, "application/json",
+                  "{\"error\":\"output tests unavailable\"}");
+    return;
+  }
   String body = m_server.arg("plain");
   if (!body.length()) {
     m_server.send(400, "application/json",
@@ -241,7 +289,7 @@ void WebApi::handleOutputsTest() {
     return;
   }
 
-  StaticJsonDocument<256> doc;
+  StaticJsonDocument<512> doc;
   DeserializationError err = deserializeJson(doc, body);
   if (err) {
     m_server.send(400, "application/json",
@@ -249,51 +297,72 @@ void WebApi::handleOutputsTest() {
     return;
   }
 
-  const char *pinRaw = doc["pin"];
-  if (!pinRaw || pinRaw[0] == '\0') {
-    m_server.send(400, "application/json",
-                  "{\"error\":\"missing pin\"}");
+  // The pattern is played from loop(): answer before it starts.
+  String error;
+  uint32_t id = m_outputTester->start(doc.as<JsonObjectConst>(), error);
+  StaticJsonDocument<512> responseDoc;
+  if (!id) {
+    responseDoc["error"] = error;
+    String response;
+    serializeJson(responseDoc, response);
+    m_server.send(error == F("output busy") ? 409 : 400, "application/json",
+                  response);
     return;
   }
+  responseDoc["ok"] = true;
+  responseDoc["job"] = id;
+  m_outputTester->describe(id, responseDoc.createNestedObject("status"));
+  String response;
+  serializeJson(responseDoc, response);
+  m_server.send(202, "application/json", response);
+}
 
-  String pinLabel = String(pinRaw);
-  pinLabel.trim();
-  int gpio = pinLabelToGpio(pinLabel);
-  if (gpio < 0) {
-    m_server.send(400, "application/json",
-                  "{\"error\":\"unsupported pin\"}");
+void WebApi::handleOutputsTestStatus() {
+  if (!m_outputTester) {
+    m_server.send(500, "application/json",
+                  "{\"error\":\"output tests unavailable\"}");
     return;
   }
-
-  if (m_logger) {
-    m_logger->info(String(F("Test 5 Hz sur ")) + pinLabel + F(" (GPIO") +
-                   String(gpio) + F(")"));
-  }
-
-  pinMode(gpio, OUTPUT);
-  digitalWrite(gpio, LOW);
-
-  const uint8_t cycles = 10; // 2 secondes à 5 Hz
-  for (uint8_t i = 0; i < cycles; ++i) {
-    digitalWrite(gpio, HIGH);
-    delay(100);
-    digitalWrite(gpio, LOW);
-    delay(100);
+  StaticJsonDocument<1536> doc;
+  if (m_server.hasArg("job")) {
+    uint32_t id = strtoul(m_server.arg("job").c_str(), nullptr, 10);
+    if (!m_outputTester->describe(id, doc.to<JsonObject>())) {
+      m_server.send(404, "application/json",
+                    "{\"error\":\"unknown job\"}");
+      return;
+    }
+  } else {
+    m_outputTester->list(doc.createNestedArray("jobs"));
   }
-
-  digitalWrite(gpio, LOW);
-
-  StaticJsonDocument<64> responseDoc;
-  responseDoc["ok"] = true;
   String response;
-  serializeJson(responseDoc, response);
+  serializeJson(doc, response);
   m_server.send(200, "application/json", response);
 }
 
+void WebApi::handleOutputsTestCancel() {
+  if (!m_outputTester) {
+    m_server.send(500, "application/json",
+                  "{\"error\":\"output tests unavailable\"}");
+    return;
+  }
+  StaticJsonDocument<128> doc;
+  if (deserializeJson(doc, m_server.arg("plain")) ||
+      !doc["job"].is<uint32_t>()) {
+    m_server.send(400, "application/json", "{\"error\":\"missing job\"}");
+    return;
+  }
+  if (!m_outputTester->cancel(doc["job"].as<uint32_t>())) {
+    m_server.send(404, "application/json",
+                  "{\"error\":\"job not running\"}");
+    return;
+  }
+  m_server.send(200, "application/json", "{\"ok\":true}");
+}
+
 void WebApi::handleUdpDiscover() {
   DynamicJsonDocument doc(4096);
   if (m_udp) {
-    m_udp->discoverPeers(doc, 800);
+    m_udp->describePeers(doc, m_server.arg("refresh") == "1");
   } else {
     doc.clear();
     doc["status"] = "udp_unavailable";
@@ -334,6 +403,7 @@ void WebApi::handlePutConfig() {
     JsonDocument &dest = m_config->getConfig(area);
     dest.clear();
     dest.set(doc);
+    m_config->touch(area);
   }
   // Enqueue file write via FileWriteService. If unavailable, fall
   // back to direct update. We construct the JSON string once.
@@ -361,33 +431,76 @@ void WebApi::handlePutConfig() {
 }
 
 void WebApi::handleDmm() {
-  // Build snapshot document
-  StaticJsonDocument<512> doc;
+  // Readings come from the DMM engine cache; ?reset_stats=1 restarts
+  // the running statistics first.
+  if (m_server.hasArg("reset_stats")) {
+    m_dmm->resetStats();
+  }
+  DynamicJsonDocument doc(m_dmm->snapshotJsonCapacity());
   m_dmm->getSnapshot(doc);
+  if (doc.overflowed()) {
+    if (m_logger) {
+      m_logger->error(F("GET /api/dmm: snapshot tronqué"));
+    }
+    m_server.send(500, "application/json",
+                  "{\"error\":\"snapshot too large\"}");
+    return;
+  }
   String response;
   serializeJson(doc, response);
   m_server.send(200, "application/json", response);
 }
 
-void WebApi::handleScope() {
-  if (!m_io) {
-    m_server.send(500, "application/json",
-                  "{\"error\":\"io unavailable\"}");
+void WebApi::handleDmmPost() {
+  // {"id":"ADS0","rel":true,"avg":8} sets the front-panel functions of a
+  // channel; "channel" (index) can be used instead of "id".
+  StaticJsonDocument<256> doc;
+  DeserializationError err = deserializeJson(doc, m_server.arg("plain"));
+  if (err) {
+    m_server.send(400, "application/json",
+                  String("{\"error\":\"invalid JSON: ") + err.c_str() +
+                      "\"}");
     return;
   }
+  int channel = doc["channel"] | -1;
+  if (channel < 0 && doc["id"].is<const char *>()) {
+    channel = m_dmm->findChannel(String(doc["id"].as<const char *>()));
+  }
+  String error;
+  bool ok = m_dmm->configure(channel, doc.as<JsonObjectConst>(), error);
 
-  struct ChannelDef {
-    String name;
-    String io;
-    String label;
-    String display;
-  };
+  DynamicJsonDocument resp(m_dmm->snapshotJsonCapacity() + error.length());
+  resp["ok"] = ok;
+  if (!ok) {
+    resp["error"] = error;
+  }
+  m_dmm->getSnapshot(resp);
+  if (resp.overflowed()) {
+    if (m_logger) {
+      m_logger->error(F("POST /api/dmm: snapshot tronqué"));
+    }
+    // The settings were applied: answer without the snapshot.
+    m_server.send(ok ? 200 : 400, "application/json",
+                  ok ? String(F("{\"ok\":true}"))
+                     : String(F("{\"ok\":false,\"error\":\"")) + error +
+                           F("\"}"));
+    return;
+  }
+  String out;
+  serializeJson(resp, out);
+  m_server.send(ok ? 200 : 400, "application/json", out);
+}
 
-  ChannelDef channels[4];
-  size_t channelCount = 0;
-  size_t sampleCount = 200;
-  float timebaseMsPerDiv = 10.0f;
-  float voltsPerDiv = 1.0f;
+void WebApi::loadScopeSetup(ScopeSetup &setup) {
+  ScopeChannel *channels = setup.channels;
+  size_t &channelCount = setup.channelCount;
+  size_t &sampleCount = setup.sampleCount;
+  float &timebaseMsPerDiv = setup.timebaseMsPerDiv;
+  float &voltsPerDiv = setup.voltsPerDiv;
+  channelCount = 0;
+  sampleCount = 200;
+  timebaseMsPerDiv = 10.0f;
+  voltsPerDiv = 1.0f;
   String defaultChannel = "CH1";
   String defaultIo = "A0";
   String defaultLabel;
@@ -395,8 +508,8 @@ void WebApi::handleScope() {
 
   auto addChannel = [&](const String &name, const String &io,
                         const String &label, const String &display) {
-    if (channelCount >= (sizeof(channels) / sizeof(channels[0]))) return;
-    ChannelDef &ch = channels[channelCount];
+    if (channelCount >= kScopeChannels) return;
+    ScopeChannel &ch = channels[channelCount];
     ch.name = name.length() ? name : String("CH") + String(channelCount + 1);
     ch.io = io.length() ? io : defaultIo;
     ch.label = label.length() ? label : ch.name;
@@ -509,7 +622,7 @@ void WebApi::handleScope() {
             if (!defaultDisplay.length() && display.length())
               defaultDisplay = display;
           }
-          if (channelCount >= (sizeof(channels) / sizeof(channels[0])))
+          if (channelCount >= kScopeChannels)
             break;
         }
       }
@@ -548,7 +661,7 @@ void WebApi::handleScope() {
             if (!defaultDisplay.length() && display.length())
               defaultDisplay = display;
           }
-          if (channelCount >= (sizeof(channels) / sizeof(channels[0])))
+          if (channelCount >= kScopeChannels)
             break;
         }
       }
@@ -569,6 +682,22 @@ void WebApi::handleScope() {
       if (!channels[i].io.length()) channels[i].io = defaultIo;
     }
   }
+}
+
+void WebApi::handleScope() {
+  if (!m_io) {
+    m_server.send(500, "application/json",
+                  "{\"error\":\"io unavailable\"}");
+    return;
+  }
+
+  ScopeSetup setup;
+  loadScopeSetup(setup);
+  const ScopeChannel *channels = setup.channels;
+  size_t channelCount = setup.channelCount;
+  size_t sampleCount = setup.sampleCount;
+  float timebaseMsPerDiv = setup.timebaseMsPerDiv;
+  float voltsPerDiv = setup.voltsPerDiv;
 
   if (channelCount == 0) {
     m_server.send(500, "application/json",
@@ -584,7 +713,7 @@ void WebApi::handleScope() {
   root["volts_per_div"] = voltsPerDiv;
   JsonObject channelsObj = root.createNestedObject("channels");
 
-  JsonArray sampleArrays[sizeof(channels) / sizeof(channels[0])];
+  JsonArray sampleArrays[kScopeChannels];
   for (size_t i = 0; i < channelCount; ++i) {
     JsonObject chObj = channelsObj.createNestedObject(channels[i].name);
     chObj["label"] = channels[i].label;
@@ -613,7 +742,7 @@ void WebApi::handleScope() {
 
   for (size_t i = 0; i < sampleCount; ++i) {
     for (size_t c = 0; c < channelCount; ++c) {
-      const ChannelDef &ch = channels[c];
+      const ScopeChannel &ch = channels[c];
       float raw = m_io->readRaw(ch.io);
       float value = m_io->convert(ch.io, raw);
       sampleArrays[c].add(value);
@@ -637,16 +766,38 @@ void WebApi::handleScope() {
 }
 
 void WebApi::handleFuncGenGet() {
-  StaticJsonDocument<512> resp;
+  // Every generator channel is listed; "channel" or "target" selects the
+  // one reported as "channel".
+  DynamicJsonDocument resp(m_funcGen ? m_funcGen->statusJsonCapacity()
+                                     : JSON_OBJECT_SIZE(1));
   JsonObject root = resp.to<JsonObject>();
   if (m_funcGen) {
-    m_funcGen->snapshotStatus(root);
+    if (m_server.hasArg("reset_stats")) {
+      m_funcGen->resetTimingStats();
+    }
+    int channel = 0;
+    if (m_server.hasArg("channel")) {
+      channel = m_server.arg("channel").toInt();
+    } else if (m_server.hasArg("target")) {
+      channel = m_funcGen->findChannelByTarget(m_server.arg("target"));
+    }
+    m_funcGen->snapshotStatus(root, channel);
   }
   root["ok"] = true;
+  if (resp.overflowed()) {
+    if (m_logger) {
+      m_logger->error(F("GET /api/funcgen: statut tronqué"));
+    }
+    m_server.send(500, "application/json",
+                  "{\"error\":\"status too large\"}");
+    return;
+  }
   String body;
   serializeJson(resp, body);
   if (m_logger) {
-    m_logger->debug(String(F("HTTP GET /api/funcgen => ")) + body);
+    m_logger->debug(String(F("HTTP GET /api/funcgen ch=")) +
+                    String(root["channel"] | 0) + F(" (") +
+                    String(body.length()) + F(" B)"));
   }
   m_server.send(200, "application/json", body);
 }
@@ -660,7 +811,8 @@ void WebApi::handleFuncGenPost() {
     return;
   }
   if (m_logger) {
-    m_logger->info(String(F("HTTP POST /api/funcgen body=")) + body);
+    m_logger->debug(String(F("HTTP POST /api/funcgen body=")) +
+                    clipped(body));
   }
   StaticJsonDocument<512> doc;
   DeserializationError err = deserializeJson(doc, body);
@@ -674,31 +826,184 @@ void WebApi::handleFuncGenPost() {
     return;
   }
   m_funcGen->updateSettings(doc);
-  StaticJsonDocument<512> resp;
+  DynamicJsonDocument resp(m_funcGen->statusJsonCapacity());
   resp["ok"] = true;
   resp["success"] = true;
   JsonObject status = resp.createNestedObject("status");
   if (m_funcGen) {
-    m_funcGen->snapshotStatus(status);
+    int channel = doc["channel"] | -1;
+    if (channel < 0 && doc["target"].is<const char *>()) {
+      channel = m_funcGen->findChannelByTarget(
+          String(doc["target"].as<const char *>()));
+    }
+    m_funcGen->snapshotStatus(status, channel);
+  }
+  JsonObjectConst selected =
+      status["channels"][status["channel"] | 0].as<JsonObjectConst>();
+  if (selected.containsKey("enabled")) {
+    resp["enabled"] = selected["enabled"];
   }
-  if (status.containsKey("enabled")) {
-    resp["enabled"] = status["enabled"];
+  if (selected.containsKey("target")) {
+    resp["target"] = selected["target"];
   }
-  if (status.containsKey("target")) {
-    resp["target"] = status["target"];
+  if (selected.containsKey("summary")) {
+    resp["summary"] = selected["summary"];
+    resp["message"] = selected["summary"];
   }
-  if (status.containsKey("summary")) {
-    resp["summary"] = status["summary"];
-    resp["message"] = status["summary"];
+  if (resp.overflowed() && m_logger) {
+    m_logger->error(F("POST /api/funcgen: statut tronqué"));
   }
   String responseBody;
   serializeJson(resp, responseBody);
   if (m_logger) {
-    m_logger->info(String(F("FuncGen POST ack=")) + responseBody);
+    m_logger->info(String(F("FuncGen POST ch=")) +
+                   String(status["channel"] | 0) + F(": ") +
+                   (selected["summary"] | ""));
   }
   m_server.send(200, "application/json", responseBody);
 }
 
+void WebApi::handleFuncGenTrigger() {
+  // Lightweight trigger endpoint: {"channel":0} or {"target":"DAC0"},
+  // optionally with "gate": true/false. Unlike POST /api/funcgen this
+  // does not log the body nor persist anything.
+  StaticJsonDocument<128> doc;
+  String body = m_server.arg("plain");
+  if (body.length() && deserializeJson(doc, body)) {
+    m_server.send(400, "application/json", "{\"error\":\"invalid JSON\"}");
+    return;
+  }
+  if (!m_funcGen) {
+    m_server.send(503, "application/json",
+                  "{\"error\":\"funcgen unavailable\"}");
+    return;
+  }
+  int channel = doc["channel"] | -1;
+  if (channel < 0 && doc["target"].is<const char *>()) {
+    channel = m_funcGen->findChannelByTarget(
+        String(doc["target"].as<const char *>()));
+  }
+  if (channel < 0) {
+    channel = 0;
+  }
+  bool ok;
+  if (doc.containsKey("gate")) {
+    ok = m_funcGen->setGate(channel, doc["gate"].as<bool>(), "http");
+  } else {
+    ok = m_funcGen->trigger(channel, "http");
+  }
+  // A short ack only: the burst starts on the next generator tick and
+  // the full status is available from GET /api/funcgen.
+  StaticJsonDocument<128> resp;
+  resp["ok"] = ok;
+  resp["channel"] = channel;
+  if (!ok) {
+    resp["error"] = "channel disabled or not in burst/gated mode";
+  }
+  String out;
+  serializeJson(resp, out);
+  m_server.send(ok ? 200 : 409, "application/json", out);
+}
+
+void WebApi::handleFuncGenCalibrate() {
+  // {"target":"AO0","input":"A0"} starts a calibration; optional keys:
+  // settle_ms, samples, reference ("endpoints" | "range"). {"cancel":
+  // true} aborts it and {"clear":true} drops the stored correction.
+  StaticJsonDocument<256> doc;
+  DeserializationError err = deserializeJson(doc, m_server.arg("plain"));
+  if (err) {
+    m_server.send(400, "application/json",
+                  String("{\"error\":\"invalid JSON: ") + err.c_str() +
+                      "\"}");
+    return;
+  }
+  if (!m_funcGen) {
+    m_server.send(503, "application/json",
+                  "{\"error\":\"funcgen unavailable\"}");
+    return;
+  }
+  int channel = doc["channel"] | -1;
+  if (channel < 0 && doc["target"].is<const char *>()) {
+    channel = m_funcGen->findChannelByTarget(
+        String(doc["target"].as<const char *>()));
+  }
+  if (channel < 0) {
+    channel = 0;
+  }
+
+  bool ok = true;
+  String error;
+  if (doc["cancel"] | false) {
+    m_funcGen->cancelCalibration();
+  } else if (doc["clear"] | false) {
+    ok = m_funcGen->clearCalibration(channel);
+    if (!ok) error = F("no calibration stored");
+  } else {
+    const char *reference = doc["reference"] | "endpoints";
+    ok = m_funcGen->startCalibration(
+        channel, String(doc["input"] | ""), doc["settle_ms"] | 0UL,
+        (uint8_t)(doc["samples"] | 4), strcmp(reference, "range") == 0,
+        error);
+  }
+
+  DynamicJsonDocument resp(m_funcGen->statusJsonCapacity());
+  resp["ok"] = ok;
+  if (!ok) {
+    resp["error"] = error;
+  }
+  m_funcGen->snapshotStatus(resp.createNestedObject("status"), channel);
+  String out;
+  serializeJson(resp, out);
+  m_server.send(ok ? 200 : 409, "application/json", out);
+}
+
+void WebApi::handleFuncGenRamp() {
+  // {"target":"AO0","to_pct":80,"duration_ms":2000,"shape":"scurve"}
+  // ramps the DC level (offset for periodic waveforms) of a channel.
+  StaticJsonDocument<192> doc;
+  DeserializationError err = deserializeJson(doc, m_server.arg("plain"));
+  if (err) {
+    m_server.send(400, "application/json",
+                  String("{\"error\":\"invalid JSON: ") + err.c_str() +
+                      "\"}");
+    return;
+  }
+  if (!m_funcGen) {
+    m_server.send(503, "application/json",
+                  "{\"error\":\"funcgen unavailable\"}");
+    return;
+  }
+  int channel = doc["channel"] | -1;
+  if (channel < 0 && doc["target"].is<const char *>()) {
+    channel = m_funcGen->findChannelByTarget(
+        String(doc["target"].as<const char *>()));
+  }
+  if (channel < 0) {
+    channel = 0;
+  }
+
+  bool ok = false;
+  String error;
+  if (!doc.containsKey("to_pct")) {
+    error = F("missing to_pct");
+  } else {
+    const char *shape = doc["shape"] | "linear";
+    ok = m_funcGen->startRamp(channel, doc["to_pct"].as<float>() / 100.0f,
+                              doc["duration_ms"] | 0UL,
+                              strcmp(shape, "scurve") == 0, error);
+  }
+
+  DynamicJsonDocument resp(m_funcGen->statusJsonCapacity());
+  resp["ok"] = ok;
+  if (!ok) {
+    resp["error"] = error;
+  }
+  m_funcGen->snapshotStatus(resp.createNestedObject("status"), channel);
+  String out;
+  serializeJson(resp, out);
+  m_server.send(ok ? 200 : 400, "application/json", out);
+}
+
 void WebApi::handleLogsTail() {
   // Parameter n determines how many lines to return. Default 100.
   int n = 100;
@@ -716,61 +1021,288 @@ void WebApi::handleLogsTail() {
   m_server.send(200, "text/plain", out);
 }
 
+void WebApi::handleLoggerGet() {
+  if (!m_dataLogger) {
+    m_server.send(500, "application/json",
+                  "{\"error\":\"logger not available\"}");
+    return;
+  }
+  DynamicJsonDocument doc(1536);
+  m_dataLogger->describe(doc.to<JsonObject>());
+  String resp;
+  serializeJson(doc, resp);
+  m_server.send(200, "application/json", resp);
+}
+
+void WebApi::handleLoggerConfig() {
+  // Body: {"enabled":true,"interval_ms":1000,"channels":[{"source":"dmm",
+  // "id":"ADS0","resolution":0.001}]}. Missing keys are left unchanged.
+  if (!m_dataLogger) {
+    m_server.send(500, "application/json",
+                  "{\"error\":\"logger not available\"}");
+    return;
+  }
+  DynamicJsonDocument doc(1024);
+  DeserializationError err = deserializeJson(doc, m_server.arg("plain"));
+  if (err) {
+    m_server.send(400, "application/json",
+                  String("{\"error\":\"invalid JSON: ") + err.c_str() +
+                      "\"}");
+    return;
+  }
+  String error;
+  if (!m_dataLogger->configure(doc.as<JsonObjectConst>(), error)) {
+    StaticJsonDocument<192> resp;
+    resp["ok"] = false;
+    resp["error"] = error;
+    String out;
+    serializeJson(resp, out);
+    m_server.send(400, "application/json", out);
+    return;
+  }
+  handleLoggerGet();
+}
+
+void WebApi::handleLoggerClear() {
+  if (!m_dataLogger) {
+    m_server.send(500, "application/json",
+                  "{\"error\":\"logger not available\"}");
+    return;
+  }
+  m_dataLogger->clear();
+  m_server.send(200, "application/json", "{\"ok\":true}");
+}
+
+void WebApi::handleLoggerData() {
+  // ?from=&to= in logger time (ms), or ?span= (ms) ending now, 1 h by
+  // default. ?points= caps the number of rows (500 by default, 0 for
+  // every record), ?tier=raw|1s|1m|1h overrides the automatic choice
+  // of rollup tier and ?format=bin selects the binary layout.
+  if (!m_dataLogger) {
+    m_server.send(500, "application/json",
+                  "{\"error\":\"logger not available\"}");
+    return;
+  }
+  DataLogger::Query q;
+  uint64_t now = m_dataLogger->now();
+  q.to = m_server.hasArg("to")
+             ? strtoull(m_server.arg("to").c_str(), nullptr, 10)
+             : now;
+  if (m_server.hasArg("from")) {
+    q.from = strtoull(m_server.arg("from").c_str(), nullptr, 10);
+  } else {
+    uint64_t span = m_server.hasArg("span")
+                        ? strtoull(m_server.arg("span").c_str(), nullptr, 10)
+                        : 3600000ULL;
+    q.from = q.to > span ? q.to - span : 0;
+  }
+  q.points = m_server.hasArg("points")
+                 ? (uint32_t)strtoul(m_server.arg("points").c_str(), nullptr,
+                                     10)
+                 : 500;
+  String tier = m_server.arg("tier");
+  q.tier = tier == "raw" ? 0
+           : tier == "1s" ? 1
+           : tier == "1m" ? 2
+           : tier == "1h" ? 3
+                          : -1;
+  bool binary = m_server.arg("format") == "bin";
+  q.format = binary ? DataLogger::EXPORT_BINARY : DataLogger::EXPORT_CSV;
+
+  // Rows are decoded a block at a time as the client reads: the
+  // response size does not depend on the free heap.
+  auto job = std::make_shared<DataLogger::Export>();
+  m_dataLogger->beginExport(q, *job);
+  DataLogger *logger = m_dataLogger;
+  m_server.sendChunked(200,
+                       binary ? "application/octet-stream" : "text/csv",
+                       [logger, job](Print &out) {
+                         return logger->exportStep(*job, out);
+                       });
+}
+
+void WebApi::handleBatch() {
+  DynamicJsonDocument req(1024);
+  if (deserializeJson(req, m_server.arg("plain"))) {
+    m_server.send(400, "application/json", "{\"error\":\"invalid json\"}");
+    return;
+  }
+  JsonArrayConst ops = req["ops"].as<JsonArrayConst>();
+  if (ops.isNull() || ops.size() == 0) {
+    m_server.send(400, "application/json", "{\"error\":\"missing ops\"}");
+    return;
+  }
+  if (ops.size() > kMaxBatchOps) {
+    m_server.send(400, "application/json", "{\"error\":\"too many ops\"}");
+    return;
+  }
+
+  // Every read happens here, before the answer goes out: the results
+  // describe the same instant.
+  String body;
+  BoundedPrint out(body, kMaxBatchBytes);
+  body += F("{\"t_ms\":");
+  body += millis();
+  body += F(",\"results\":[");
+  bool first = true;
+  for (JsonVariantConst item : ops) {
+    JsonVariantConst name = item.is<JsonObjectConst>() ? item["op"] : item;
+    const char *op = name | "";
+    if (!first) {
+      body += ',';
+    }
+    first = false;
+    body += F("{\"op\":");
+    serializeJson(name, body);
+    body += F(",\"data\":");
+    size_t start = body.length();
+    String error;
+    bool ok = batchRead(op, item, out, error);
+    if (ok && out.overflowed()) {
+      out.rewind(start);
+      ok = false;
+      error = F("response too large");
+    }
+    if (!ok) {
+      // Nothing was written for the data: report the error instead.
+      body += F("null,\"error\":\"");
+      body += error;
+      body += '"';
+    }
+    body += '}';
+  }
+  body += F("]}");
+  m_server.send(200, "application/json", body);
+}
+
+bool WebApi::batchRead(const char *op, JsonVariantConst params, Print &out,
+                       String &error) {
+  if (strcmp(op, "dmm") == 0) {
+    if (!m_dmm) {
+      error = F("dmm unavailable");
+      return false;
+    }
+    DynamicJsonDocument doc(m_dmm->snapshotJsonCapacity());
+    m_dmm->getSnapshot(doc);
+    if (doc.overflowed()) {
+      error = F("snapshot too large");
+      return false;
+    }
+    serializeJson(doc, out);
+    return true;
+  }
+  if (strcmp(op, "io") == 0) {
+    if (!m_io) {
+      error = F("io unavailable");
+      return false;
+    }
+    DynamicJsonDocument doc(4096);
+    m_io->snapshot(doc);
+    if (doc.overflowed()) {
+      error = F("snapshot too large");
+      return false;
+    }
+    serializeJson(doc, out);
+    return true;
+  }
+  if (strcmp(op, "funcgen") == 0) {
+    if (!m_funcGen) {
+      error = F("funcgen unavailable");
+      return false;
+    }
+    DynamicJsonDocument doc(m_funcGen->statusJsonCapacity());
+    m_funcGen->snapshotStatus(doc.to<JsonObject>(), params["channel"] | 0);
+    if (doc.overflowed()) {
+      error = F("status too large");
+      return false;
+    }
+    serializeJson(doc, out);
+    return true;
+  }
+  if (strcmp(op, "config") == 0) {
+    const char *area = params["area"] | "";
+    if (!area[0] || !m_config) {
+      error = F("missing area");
+      return false;
+    }
+    serializeJson(m_config->getConfig(area), out);
+    return true;
+  }
+  if (strcmp(op, "scope") == 0) {
+    if (!m_io) {
+      error = F("io unavailable");
+      return false;
+    }
+    // One reading per channel rather than a whole frame, which
+    // /api/scope takes over the timebase.
+    ScopeSetup setup;
+    loadScopeSetup(setup);
+    StaticJsonDocument<1024> doc;
+    doc["timebase_ms_per_div"] = setup.timebaseMsPerDiv;
+    doc["volts_per_div"] = setup.voltsPerDiv;
+    JsonObject channels = doc.createNestedObject("channels");
+    for (size_t c = 0; c < setup.channelCount; ++c) {
+      const ScopeChannel &ch = setup.channels[c];
+      JsonObject obj = channels.createNestedObject(ch.name);
+      obj["io"] = ch.io;
+      obj["label"] = ch.label;
+      obj["value"] = m_io->convert(ch.io, m_io->readRaw(ch.io));
+    }
+    serializeJson(doc, out);
+    return true;
+  }
+  error = F("unknown op");
+  return false;
+}
+
+void WebApi::handleHttpStats() {
+  if (m_server.hasArg("reset")) {
+    m_server.resetStats();
+  }
+  const HttpServer::Stats &stats = m_server.stats();
+  StaticJsonDocument<384> doc;
+  doc["clients"] = m_server.activeClients();
+  doc["max_clients"] = (uint32_t)HttpServer::kMaxClients;
+  doc["connections"] = stats.connections;
+  doc["requests"] = stats.requests;
+  doc["reused"] = stats.reused;
+  // Share of requests that did not need a new connection.
+  doc["reuse_pct"] =
+      stats.requests ? stats.reused * 100.0f / stats.requests : 0.0f;
+  doc["evicted"] = stats.evicted;
+  doc["idle_clients_max"] = (uint32_t)HttpServer::kMaxIdleClients;
+  doc["rejected"] = stats.rejected;
+  doc["timeouts"] = stats.timeouts;
+  doc["dropped"] = stats.dropped;
+  doc["max_pass_us"] = stats.maxPassUs;
+  doc["max_handler_us"] = stats.maxHandlerUs;
+  String resp;
+  serializeJson(doc, resp);
+  m_server.send(200, "application/json", resp);
+}
+
 void WebApi::handleWriteQueue() {
   if (!m_fileService) {
     m_server.send(500, "application/json",
                   "{\"error\":\"file service not available\"}");
     return;
   }
-  StaticJsonDocument<64> doc;
+  StaticJsonDocument<128> doc;
   doc["pending"] = m_fileService->pending();
+  doc["coalesced"] = m_fileService->coalesced();
+  doc["completed"] = m_fileService->completed();
   String resp;
   serializeJson(doc, resp);
   m_server.send(200, "application/json", resp);
 }
 
 void WebApi::handleWifiScan() {
-  int16_t count = WiFi.scanNetworks(/*async=*/false, /*hidden=*/true);
-  if (count < 0) {
-    m_server.send(500, "application/json",
-                  "{\"error\":\"scan failed\"}");
-    return;
-  }
-
+  // Never waits for the radio: answers with the last results and lets
+  // loop() collect the new ones.
   DynamicJsonDocument doc(4096);
-  JsonArray arr = doc.to<JsonArray>();
-  for (int16_t i = 0; i < count; ++i) {
-    JsonObject obj = arr.createNestedObject();
-    obj["ssid"] = WiFi.SSID(i);
-    obj["rssi"] = WiFi.RSSI(i);
-    obj["channel"] = WiFi.channel(i);
-    obj["hidden"] = WiFi.isHidden(i);
-    auto enc = WiFi.encryptionType(i);
-    obj["secure"] = enc != ENC_TYPE_NONE;
-    switch (enc) {
-    case ENC_TYPE_WEP:
-      obj["encryption"] = "WEP";
-      break;
-    case ENC_TYPE_TKIP:
-      obj["encryption"] = "WPA/TKIP";
-      break;
-    case ENC_TYPE_CCMP:
-      obj["encryption"] = "WPA2/CCMP";
-      break;
-    case ENC_TYPE_AUTO:
-      obj["encryption"] = "AUTO";
-      break;
-    case ENC_TYPE_NONE:
-      obj["encryption"] = "open";
-      break;
-    default:
-      obj["encryption"] = "unknown";
-      break;
-    }
-  }
-  WiFi.scanDelete();
+  m_wifiScanner.snapshot(doc, m_server.arg("refresh") == "1");
   String out;
-  serializeJson(arr, out);
+  serializeJson(doc, out);
   m_server.send(200, "application/json", out);
 }
 
@@ -1,13 +1,20 @@
 // WebApi exposes a simple HTTP server for configuration and data
 // retrieval. It supports reading and writing configuration files,
 // retrieving DMM snapshots, updating the function generator, fetching
-// recent logs and serving static files from the filesystem.
+// recent logs and serving static files from the filesystem. Requests
+// are served by HttpServer, which handles several clients at once
+// without blocking loop(). Live values are also pushed to WebSocket
+// clients on /ws and to Server-Sent Events clients on /api/events (see
+// Telemetry).
 
 #ifndef MINILABOESP_WEBAPI_H
 #define MINILABOESP_WEBAPI_H
 
 #include <Arduino.h>
-#include <ESP8266WebServer.h>
+#include <ArduinoJson.h>
+#include "services/HttpServer.h"
+#include "services/Telemetry.h"
+#include "services/WifiScanner.h"
 
 class ConfigStore;
 class IORegistry;
@@ -16,9 +23,16 @@ class FuncGen;
 class Logger;
 class FileWriteService;
 class UdpService;
+class DataLogger;
+class OutputTester;
 
 class WebApi {
 public:
+  // Operations accepted in one /api/batch request.
+  static const size_t kMaxBatchOps = 8;
+  // Size allowed for the data of all the results of one /api/batch.
+  static const size_t kMaxBatchBytes = 8192;
+
   WebApi(ConfigStore *config, IORegistry *ioReg, Dmm *dmm, FuncGen *funcGen,
          Logger *logger, FileWriteService *fileService, UdpService *udp);
 
@@ -26,10 +40,16 @@ public:
   // during setup().
   void begin();
 
-  // Handle incoming client requests. Should be called frequently in
-  // loop().
+  // Handle incoming client requests, push telemetry and collect WiFi
+  // scan results. Should be called frequently in loop().
   void loop();
 
+  // Enable the /api/logger endpoints.
+  void setDataLogger(DataLogger *dataLogger) { m_dataLogger = dataLogger; }
+
+  // Enable the /api/outputs/test endpoints.
+  void setOutputTester(OutputTester *tester) { m_outputTester = tester; }
+
 private:
   ConfigStore *m_config;
   IORegistry *m_io;
@@ -38,22 +58,76 @@ private:
   Logger *m_logger;
   FileWriteService *m_fileService;
   UdpService *m_udp;
-  ESP8266WebServer m_server;
+  DataLogger *m_dataLogger;
+  OutputTester *m_outputTester;
+  HttpServer m_server;
+  Telemetry m_telemetry;
+  WifiScanner m_wifiScanner;
+
+  static const size_t kScopeChannels = 4;
+
+  struct ScopeChannel {
+    String name;
+    String io;
+    String label;
+    String display;
+  };
+
+  // Scope channels and timebase resolved from the "scope" area.
+  struct ScopeSetup {
+    ScopeChannel channels[kScopeChannels];
+    size_t channelCount;
+    size_t sampleCount;
+    float timebaseMsPerDiv;
+    float voltsPerDiv;
+  };
+  void loadScopeSetup(ScopeSetup &setup);
 
   // Handler functions
   void handleGetConfig();
   void handlePutConfig();
   void handleDmm();
+  void handleDmmPost();
   void handleScope();
   void handleFuncGenGet();
   void handleFuncGenPost();
+  void handleFuncGenTrigger();
+  void handleFuncGenCalibrate();
+  void handleFuncGenRamp();
   void handleLogsTail();
+  void handleLoggerGet();
+  void handleLoggerConfig();
+  void handleLoggerClear();
+  void handleLoggerData();
+  // Cached networks with their age (see WifiScanner); ?refresh=1 asks
+  // for a new scan.
   void handleWifiScan();
   void handleIoHardware();
   void handleIoSnapshot();
+  // POST starts a test job (see OutputTester) and answers 202 with its
+  // id at once; GET ?job=<id> reports a job, GET alone lists them.
   void handleOutputsTest();
+  void handleOutputsTestStatus();
+  void handleOutputsTestCancel();
+  // Peer table of UdpService; ?refresh=1 broadcasts a new discovery
+  // request.
   void handleUdpDiscover();
 
+  // Run several read operations in one request:
+  //   {"ops": ["dmm", "io", {"op": "funcgen", "channel": 0},
+  //            {"op": "config", "area": "math"}, "scope"]}
+  // Answers {"t_ms": <millis>, "results": [{"op": ..., "data": ...} or
+  // {"op": ..., "error": ...}]} in the order of the request. All the
+  // reads happen in this one handler, between two passes of the
+  // instruments' loop(), so they describe the same instant. The answer
+  // is built in one buffer holding at most kMaxBatchBytes of data: a
+  // result that does not fit is replaced by an error.
+  void handleBatch();
+  // Write the data of one batch operation to out; false with a reason
+  // in error.
+  bool batchRead(const char *op, JsonVariantConst params, Print &out,
+                 String &error);
+
   // Handle a login request. Accepts a JSON body containing a
   // "pin" field. The provided PIN is compared against the value
   // stored in the network configuration. If they match, the server
@@ -65,6 +139,10 @@ private:
 
   // Expose pending write requests count
   void handleWriteQueue();
+
+  // Connection counters of the HTTP server, keep-alive reuse included;
+  // ?reset=1 clears them.
+  void handleHttpStats();
 };
 
 #endif // MINILABOESP_WEBAPI_H
@@ -0,0 +1,48 @@
+// Implementation of the WebAssets class
+
+#include "WebAssets.h"
+
+// Written by scripts/web_assets.py into the build directory.
+#if __has_include("WebAssetsData.h")
+#include "WebAssetsData.h"
+#else
+#define WEB_ASSET_COUNT 0
+#endif
+
+#if WEB_ASSET_COUNT
+namespace {
+
+// FNV-1a with a seed; must match scripts/web_assets.py.
+uint32_t hashPath(const char *path, uint32_t seed) {
+  uint32_t hash = 2166136261u ^ seed;
+  while (*path) {
+    hash = (hash ^ (uint8_t)*path++) * 16777619u;
+  }
+  return hash;
+}
+
+} // namespace
+#endif
+
+bool WebAssets::find(const char *path, HttpServer::FlashAsset &asset) {
+#if WEB_ASSET_COUNT
+  uint16_t seed = pgm_read_word(&kSeeds[hashPath(path, 0) % WEB_ASSET_COUNT]);
+  Entry entry;
+  memcpy_P(&entry, &kEntries[hashPath(path, seed) % WEB_ASSET_COUNT],
+           sizeof(entry));
+  if (strcmp_P(path, entry.path) != 0) {
+    return false;
+  }
+  asset.head = entry.head;
+  asset.etag = entry.etag;
+  asset.body = entry.body;
+  asset.length = entry.length;
+  return true;
+#else
+  (void)path;
+  (void)asset;
+  return false;
+#endif
+}
+
+size_t WebAssets::count() { return WEB_ASSET_COUNT; }
@@ -0,0 +1,38 @@
+// WebAssets is the web UI compiled into the firmware by
+// scripts/web_assets.py: every page, style sheet and script of data/,
+// minified and gzipped, with its HTTP header lines, in PROGMEM. Pages
+// are served straight from flash without touching LittleFS, which only
+// holds data and configuration, so the UI still loads when the
+// filesystem is empty or damaged.
+//
+// Paths are found through a minimal perfect hash built with the data:
+// the path is hashed to pick a seed, hashed again with that seed to
+// get its slot, and the slot is checked with one comparison.
+
+#ifndef MINILABOESP_WEBASSETS_H
+#define MINILABOESP_WEBASSETS_H
+
+#include <Arduino.h>
+#include "services/HttpServer.h"
+
+class WebAssets {
+public:
+  // Entry of the generated table.
+  struct Entry {
+    const char *path;
+    const char *head;
+    const char *etag;
+    const uint8_t *body;
+    uint32_t length;
+  };
+
+  // Asset for an absolute path such as "/index.html". Usable as an
+  // HttpServer::FlashLookup.
+  static bool find(const char *path, HttpServer::FlashAsset &asset);
+
+  // Number of embedded files, 0 when the firmware was built without
+  // the generated data.
+  static size_t count();
+};
+
+#endif // MINILABOESP_WEBASSETS_H
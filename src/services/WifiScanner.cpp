@@ -0,0 +1,121 @@
+// Implementation of the WifiScanner class
+
+#include "WifiScanner.h"
+
+#include <ESP8266WiFi.h>
+
+#include "core/Logger.h"
+
+WifiScanner::WifiScanner(Logger *logger)
+    : m_logger(logger), m_count(0), m_scanning(false), m_valid(false),
+      m_startMs(0), m_doneMs(0), m_failed(0) {}
+
+void WifiScanner::snapshot(JsonDocument &doc, bool refresh) {
+  unsigned long now = millis();
+  bool stale = !m_valid || now - m_doneMs >= kMaxAgeMs;
+  bool allowed = m_startMs == 0 || now - m_startMs >= kMinIntervalMs;
+  if (!m_scanning && (stale || refresh) && allowed) {
+    startScan();
+  }
+
+  JsonArray arr = doc.createNestedArray("networks");
+  for (size_t i = 0; i < m_count; ++i) {
+    const Network &net = m_networks[i];
+    JsonObject obj = arr.createNestedObject();
+    obj["ssid"] = net.ssid;
+    obj["rssi"] = net.rssi;
+    obj["channel"] = net.channel;
+    obj["hidden"] = net.hidden;
+    obj["secure"] = net.encryption != ENC_TYPE_NONE;
+    obj["encryption"] = encryptionName(net.encryption);
+  }
+  if (m_valid) {
+    doc["age_ms"] = (uint32_t)(now - m_doneMs);
+  } else {
+    doc["age_ms"] = nullptr;
+  }
+  doc["scanning"] = m_scanning;
+  doc["failed"] = m_failed;
+}
+
+void WifiScanner::loop() {
+  if (!m_scanning) {
+    return;
+  }
+  int count = WiFi.scanComplete();
+  if (count == WIFI_SCAN_RUNNING) {
+    if (millis() - m_startMs >= kScanTimeoutMs) {
+      WiFi.scanDelete();
+      m_scanning = false;
+      m_failed++;
+      if (m_logger) {
+        m_logger->warning(F("Scan WiFi abandonné (délai dépassé)"));
+      }
+    }
+    return;
+  }
+  m_scanning = false;
+  if (count < 0) {
+    m_failed++;
+    if (m_logger) {
+      m_logger->warning(F("Scan WiFi échoué"));
+    }
+    return;
+  }
+  collect(count);
+  WiFi.scanDelete();
+}
+
+void WifiScanner::startScan() {
+  m_startMs = millis();
+  // Asynchronous: returns at once, loop() picks up the results.
+  WiFi.scanNetworks(/*async=*/true, /*hidden=*/true);
+  m_scanning = true;
+}
+
+void WifiScanner::collect(int count) {
+  // Keep the strongest networks, sorted by RSSI.
+  m_count = 0;
+  for (int i = 0; i < count; ++i) {
+    int8_t rssi = WiFi.RSSI(i);
+    size_t pos = m_count;
+    while (pos > 0 && m_networks[pos - 1].rssi < rssi) {
+      --pos;
+    }
+    if (pos >= kMaxNetworks) {
+      continue;
+    }
+    size_t last = m_count < kMaxNetworks ? m_count : kMaxNetworks - 1;
+    for (size_t j = last; j > pos; --j) {
+      m_networks[j] = m_networks[j - 1];
+    }
+    Network &net = m_networks[pos];
+    net.ssid = WiFi.SSID(i);
+    net.rssi = rssi;
+    net.channel = WiFi.channel(i);
+    net.encryption = WiFi.encryptionType(i);
+    net.hidden = WiFi.isHidden(i);
+    if (m_count < kMaxNetworks) {
+      m_count++;
+    }
+  }
+  m_valid = true;
+  m_doneMs = millis();
+}
+
+const char *WifiScanner::encryptionName(uint8_t encryption) {
+  switch (encryption) {
+  case ENC_TYPE_WEP:
+    return "WEP";
+  case ENC_TYPE_TKIP:
+    return "WPA/TKIP";
+  case ENC_TYPE_CCMP:
+    return "WPA2/CCMP";
+  case ENC_TYPE_AUTO:
+    return "AUTO";
+  case ENC_TYPE_NONE:
+    return "open";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,67 @@
+// WifiScanner keeps the result of the last WiFi scan so /api/wifi/scan
+// answers at once. A blocking WiFi.scanNetworks() holds loop() for
+// several seconds (every channel is visited in turn); here the scan is
+// started in the background and its results are copied into a small
+// table, timestamped, when loop() sees it complete.
+//
+// Scans only run on request: snapshot() starts one when the table is
+// older than kMaxAgeMs (or when a refresh is asked for), and never
+// more often than every kMinIntervalMs, so a page reloaded over and
+// over does not keep the radio away from its channel while the
+// instruments stream their data. The strongest kMaxNetworks networks
+// are kept.
+
+#ifndef MINILABOESP_WIFISCANNER_H
+#define MINILABOESP_WIFISCANNER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+class Logger;
+
+class WifiScanner {
+public:
+  static const size_t kMaxNetworks = 24;
+  // Results older than this trigger a new scan when requested.
+  static const uint32_t kMaxAgeMs = 30000;
+  // Shortest time between the start of two scans.
+  static const uint32_t kMinIntervalMs = 10000;
+  // A scan that has not completed by then is abandoned.
+  static const uint32_t kScanTimeoutMs = 15000;
+
+  explicit WifiScanner(Logger *logger);
+
+  // Describe the cached networks:
+  //   {"networks": [{ssid, rssi, channel, hidden, secure, encryption}],
+  //    "age_ms": <since the scan completed, null if none yet>,
+  //    "scanning": bool, "failed": <scans that failed>}
+  // and start a scan if the table is stale, or if refresh is true.
+  void snapshot(JsonDocument &doc, bool refresh);
+
+  // Collect the results of a running scan. Call from loop().
+  void loop();
+
+private:
+  struct Network {
+    String ssid;
+    int8_t rssi;
+    uint8_t channel;
+    uint8_t encryption;
+    bool hidden;
+  };
+
+  void startScan();
+  void collect(int count);
+  static const char *encryptionName(uint8_t encryption);
+
+  Logger *m_logger;
+  Network m_networks[kMaxNetworks];
+  size_t m_count;
+  bool m_scanning;
+  bool m_valid; // a scan has completed
+  unsigned long m_startMs;
+  unsigned long m_doneMs;
+  uint32_t m_failed;
+};
+
+#endif // MINILABOESP_WIFISCANNER_H